@@ -7,7 +7,7 @@ use vars qw($VERSION @ISA $USE_LIBXML_DATA_TYPES);
 
 use XML::LibXML::NodeList;
 
-$VERSION = '0.07';
+$VERSION = '0.08';
 require DynaLoader;
 
 @ISA = qw(DynaLoader);
@@ -47,8 +47,310 @@ sub findvalue {
     return $self->find(@_)->to_literal->value;
 }
 
+sub findnodes_many {
+    my ($self, $xpath, $nodes) = @_;
+    return map {
+        my ($type, @params) = @$_;
+        XML::LibXML::NodeList->new($type eq 'XML::LibXML::NodeList' ? @params : ());
+    } $self->_find_many_results($xpath, $nodes);
+}
+
+sub findvalue_many {
+    my ($self, $xpath, $nodes) = @_;
+    return map {
+        my ($type, @params) = @$_;
+        $type->new(@params)->to_literal->value;
+    } $self->_find_many_results($xpath, $nodes);
+}
+
+sub _find_many_results {
+    my ($self, $xpath, $nodes) = @_;
+
+    my @results = eval { $self->_find_many($xpath, $nodes) };
+    if ($@) { die "ERROR: $@"; }
+    return @results if @results or !@$nodes;
+
+    # not possible in parallel, run node by node
+    return map {
+        die "ERROR: XPathContext: not a node\n" unless ref($_);
+        [ $self->_guarded_find_call('_find', $xpath, $_) ];
+    } @$nodes;
+}
+
+sub findserialize {
+    my ($self, $xpath, $fh, %opts) = @_;
+    my $c14n = $opts{c14n} || 0;
+    $c14n = 2 if $c14n eq 'exclusive';
+    my ($ret) = $self->_guarded_find_call('_findserialize', $xpath, $opts{node},
+                                          $fh, $opts{separator}, $c14n,
+                                          $opts{comments} ? 1 : 0,
+                                          $opts{format} ? 1 : 0);
+    return $ret;
+}
+
+my %EXPORT_FORMATS = (csv => 0, tsv => 1, ndjson => 2);
+
+sub findexport {
+    my ($self, $xpath, $columns, $fh, %opts) = @_;
+    my $format = $EXPORT_FORMATS{lc($opts{format} || 'csv')};
+    die "ERROR: XPathContext: unknown export format $opts{format}\n"
+        unless defined $format;
+    my $header = exists $opts{header} ? $opts{header} : 1;
+    my ($ret) = $self->_guarded_find_call('_findexport', $xpath, $opts{node},
+                                          $columns, $fh, $format,
+                                          $header ? 1 : 0, $opts{stream});
+    return $ret;
+}
+
+sub getElementsByTagName {
+    my ($self, $name, $node) = @_;
+    my @nodes = $self->_guarded_find_call('_getElementsByTagName', $name, $node);
+    return wantarray ? @nodes : XML::LibXML::NodeList->new(@nodes);
+}
+
+sub getElementsByTagNameNS {
+    my ($self, $nsURI, $name, $node) = @_;
+    my @nodes = $self->_guarded_find_call('_getElementsByTagNameNS', $name, $node,
+                                          $nsURI);
+    return wantarray ? @nodes : XML::LibXML::NodeList->new(@nodes);
+}
+
+sub streamrecords {
+    my ($self, $source, $pattern, $xpaths, $sub) = @_;
+    return $self->_streamrecords($source, $pattern, sub {
+        my $record = shift;
+        $sub->($record, map {
+            my ($type, @params) = @$_;
+            $type->new(@params);
+        } @_);
+    }, $xpaths);
+}
+
+# the names libxml2's dump gives the axes and node tests
+my %EXPLAIN_AXES = (
+    'ancestors' => 'ancestor', 'ancestors-or-self' => 'ancestor-or-self',
+    'attributes' => 'attribute', 'following-siblings' => 'following-sibling',
+    'namespaces' => 'namespace',
+);
+my %EXPLAIN_TYPES = (
+    node => 'node()', comment => 'comment()', text => 'text()',
+    PI => 'processing-instruction()',
+);
+
+sub explain {
+    my ($self, $xpath) = @_;
+    my ($dump) = $self->_guarded_find_call('_explain', $xpath);
+    my ($head, @lines) = split /\n/, $dump;
+    my $plan = { expression => $xpath, scans => [], optimizations => [] };
+    if ($head =~ /^Streaming Expression/) {
+        $plan->{streaming} = 1;
+        return $plan;
+    }
+    ($plan->{steps}) = map { $_ + 0 } $head =~ /(\d+) elements/;
+
+    # the dump is indented by two spaces per level
+    my @stack = ({ children => [] });
+    for (@lines) {
+        my ($indent, $label) = /^( *)(.*?)\s*$/;
+        my $raw = { label => $label, children => [] };
+        $#stack = length($indent) / 2 - 1;
+        push @{$stack[-1]{children}}, $raw;
+        push @stack, $raw;
+    }
+    $plan->{tree} = _explain_node($stack[0]{children}[0], $plan);
+    _explain_rewrites($plan, $xpath);
+    return $plan;
+}
+
+sub _explain_node {
+    my ($raw, $plan) = @_;
+    my $label = $raw->{label};
+
+    # literals get the operation before them as a child in the dump
+    if ($label =~ /^ELEM Object is an? (\w+) : ?(.*)$/) {
+        return { op => 'VALUE', type => lc $1, value => $2 };
+    }
+    my @children = map { _explain_node($_, $plan) } @{$raw->{children}};
+    my $node;
+
+    if ($label =~ /^COLLECT\s+'([^']*)'\s+'([^']*)'\s+'([^']*)'\s*(.*)$/) {
+        my ($axis, $test, $type, $name) = ($1, $2, $3, $4);
+        $axis = $EXPLAIN_AXES{$axis} || $axis;
+        $test = $test eq 'name'      ? $name
+              : $test eq 'all'       ? ($name ne '' ? "$name*" : '*')
+              : $test eq 'namespace' ? "$name*"
+              : $test eq 'PI'        ? "processing-instruction('$name')"
+              :                        $EXPLAIN_TYPES{$type} || $type;
+        $node = { op => 'COLLECT', axis => $axis, test => $test,
+                  input => (grep { $_->{op} ne 'PREDICATE' } @children)[0],
+                  predicates => [ map { _explain_predicates($_) }
+                                  grep { $_->{op} eq 'PREDICATE' } @children ] };
+        _explain_collect($node, $plan);
+    }
+    elsif ($label =~ /^FUNCTION (.*)\((\d+) args\)$/) {
+        $node = { op => 'FUNCTION', name => $1,
+                  args => [ map { _explain_args($_) } @children ] };
+    }
+    elsif ($label =~ /^VARIABLE (.*)$/) {
+        $node = { op => 'VARIABLE', name => $1 };
+    }
+    elsif ($label =~ /^(EQUAL|CMP|PLUS|MULT) (.*)$/) {
+        $node = { op => $1, operator => $2, operands => \@children };
+    }
+    elsif ($label eq 'FILTER') {
+        $node = { op => 'FILTER', input => $children[0],
+                  predicates => [ @children[1 .. $#children] ] };
+        _explain_filter($node, $plan);
+    }
+    else {
+        $node = { op => $label };
+        $node->{children} = \@children if @children;
+    }
+    return $node;
+}
+
+# predicates and arguments are chained, the earlier ones first
+sub _explain_predicates {
+    my $node = shift;
+    return $node unless $node->{op} eq 'PREDICATE';
+    return map { _explain_predicates($_) } @{$node->{children} || []};
+}
+
+sub _explain_args {
+    my $node = shift;
+    return $node unless $node->{op} eq 'ARG';
+    return map { _explain_args($_) } @{$node->{children} || []};
+}
+
+sub _explain_step { "$_[0]{axis}::$_[0]{test}" }
+
+sub _explain_from_root {
+    my $node = shift;
+    $node = $node->{input} || ($node->{children} || [])->[0]
+        while $node && $node->{op} =~ /^(COLLECT|SORT|FILTER)$/;
+    return $node && $node->{op} eq 'ROOT';
+}
+
+sub _explain_collect {
+    my ($node, $plan) = @_;
+    if ($node->{axis} =~ /^descendant/) {
+        $node->{scan} = _explain_from_root($node) ? 'document' : 'subtree';
+        push @{$plan->{scans}}, _explain_step($node)
+            if $node->{scan} eq 'document';
+    }
+    # a number as the last predicate stops the axis at that position
+    my $last = $node->{predicates}[-1];
+    if ($last && $last->{op} eq 'VALUE' && $last->{type} eq 'number'
+        && $last->{value} =~ /^\d+$/ && $last->{value} > 0) {
+        $node->{position_limit} = $last->{value};
+        push @{$plan->{optimizations}},
+             _explain_step($node) . "[$last->{value}] stops at that position";
+    }
+}
+
+sub _explain_filter {
+    my ($node, $plan) = @_;
+    my ($input, $pred) = ($node->{input}, $node->{predicates}[0]);
+    return unless $input && $pred && @{$node->{predicates}} == 1;
+    if ($pred->{op} eq 'VALUE' && $pred->{type} eq 'number'
+        && $pred->{value} eq '1' && $input->{op} =~ /^(SORT|FILTER)$/) {
+        $node->{shortcut} = 'first';
+    }
+    elsif ($pred->{op} eq 'SORT' && $input->{op} eq 'SORT'
+           && ($pred->{children} || [])->[0]
+           && $pred->{children}[0]{op} eq 'FUNCTION'
+           && $pred->{children}[0]{name} eq 'last'
+           && !@{$pred->{children}[0]{args}}) {
+        $node->{shortcut} = 'last';
+    }
+    push @{$plan->{optimizations}},
+         "(...)[" . ($node->{shortcut} eq 'first' ? '1' : 'last()')
+         . "] evaluates the expression for the $node->{shortcut} node only"
+        if $node->{shortcut};
+}
+
+# libxml2 compiles descendant-or-self::node()/child::x, also written
+# //x, to descendant::x unless x has predicates. which steps were
+# rewritten is found by matching the descendant steps with the
+# statement as written, in the same order
+sub _explain_rewrites {
+    my ($plan, $xpath) = @_;
+    my @steps;
+    my $walk;
+    $walk = sub {
+        my $node = shift or return;
+        $walk->($node->{input}) if $node->{input};
+        push @steps, $node
+            if $node->{op} eq 'COLLECT' && $node->{axis} =~ /^descendant/;
+        $walk->($_) for @{$node->{predicates} || []}, @{$node->{args} || []},
+                        @{$node->{operands} || []}, @{$node->{children} || []};
+    };
+    $walk->($plan->{tree});
+
+    my @written;
+    while ($xpath =~ m{\G(?:"[^"]*"|'[^']*'|(//)|(descendant(?:-or-self)?)\s*::|.)}gs) {
+        push @written, $1 || $2 if $1 || $2;
+    }
+    my @rewritten;
+    for my $token (@written) {
+        my $step = shift @steps or return;
+        if ($token eq 'descendant') {
+            return unless $step->{axis} eq 'descendant';
+        }
+        elsif ($step->{axis} eq 'descendant') {
+            push @rewritten, $step;
+        }
+    }
+    return if @steps;
+    for (@rewritten) {
+        $_->{rewritten} = 1;
+        push @{$plan->{optimizations}},
+             "descendant-or-self::node()/child::$_->{test} rewritten to "
+             . _explain_step($_);
+    }
+}
+
+my @STATS_COUNTERS = (
+    [ queries => 'queries', 'Statements evaluated by findnodes() and find()' ],
+    [ nodes => 'nodes_returned', 'Nodes returned to Perl' ],
+    [ proxies_created => 'proxies_created', 'Nodes wrapped into new Perl objects' ],
+    [ pool_nodes => 'pool_nodes', 'Nodes kept alive for callbacks' ],
+);
+
+sub stats_openmetrics {
+    my ($self, $prefix) = @_;
+    $prefix = 'xpathcontext' unless defined $prefix;
+    my $stats = $self->stats;
+    my $out = '';
+    for (@STATS_COUNTERS) {
+        my ($key, $name, $help) = @$_;
+        $out .= "# TYPE ${prefix}_$name counter\n"
+              . "# HELP ${prefix}_$name $help.\n"
+              . "${prefix}_${name}_total $stats->{$key}\n";
+    }
+    $out .= "# TYPE ${prefix}_compile_cache counter\n"
+          . "# HELP ${prefix}_compile_cache Lookups of compiled statements.\n"
+          . "${prefix}_compile_cache_total{result=\"hit\"} $stats->{compile_cache_hits}\n"
+          . "${prefix}_compile_cache_total{result=\"miss\"} $stats->{compile_cache_misses}\n"
+          . "# TYPE ${prefix}_pool_peak gauge\n"
+          . "# HELP ${prefix}_pool_peak Most nodes kept alive for one query.\n"
+          . "${prefix}_pool_peak $stats->{pool_peak}\n";
+    my @phases = sort keys %{$stats->{phases}};
+    $out .= "# TYPE ${prefix}_phase_calls counter\n"
+          . "# HELP ${prefix}_phase_calls Times a phase of a query ran.\n";
+    $out .= "${prefix}_phase_calls_total{phase=\"$_\"} $stats->{phases}{$_}{count}\n"
+        for @phases;
+    $out .= "# TYPE ${prefix}_phase_seconds counter\n"
+          . "# UNIT ${prefix}_phase_seconds seconds\n"
+          . "# HELP ${prefix}_phase_seconds Time spent in a phase of a query.\n";
+    $out .= sprintf("%s_phase_seconds_total{phase=\"%s\"} %.9f\n",
+                    $prefix, $_, $stats->{phases}{$_}{seconds})
+        for @phases;
+    return $out . "# EOF\n";
+}
+
 sub _guarded_find_call {
-    my ($self, $method, $xpath, $node) = @_;
+    my ($self, $method, $xpath, $node, @args) = @_;
 
     my $prev_node;
     if (ref($node)) {
@@ -57,7 +359,7 @@ sub _guarded_find_call {
     }
     my @ret;
     eval {
-        @ret = $self->$method($xpath);
+        @ret = $self->$method($xpath, @args);
     };
     $self->_free_node_pool;
     $self->setContextNode($prev_node) if ref($node);
@@ -97,6 +399,31 @@ sub unregisterVarLookupFunc {
     return;
 }
 
+sub unregisterDocumentLoader {
+    my ($self) = @_;
+    $self->registerDocumentLoader(undef, undef);
+    return;
+}
+
+sub unregisterDocument {
+    my ($self, $uri) = @_;
+    $self->registerDocument($uri, undef);
+    return;
+}
+
+sub unregisterKey {
+    my ($self, $name) = @_;
+    $self->registerKey($name, undef, undef);
+    return;
+}
+
+# contexts hold C structures and perl values of the interpreter they
+# were created in; a new thread must not get a copy
+sub CLONE_SKIP { 1 }
+
+# push streams refer to their context
+sub XML::LibXML::XPathContext::PushStream::CLONE_SKIP { 1 }
+
 # extension function perl dispatcher
 # borrowed from XML::LibXSLT
 
@@ -165,6 +492,27 @@ XML::LibXML::XPathContext - Perl interface to libxml2's xmlXPathContext
     $data = $xc->getVarLookupData();
     $sub = $xc->getVarLookupFunc();
 
+    $xc->registerKey($name, $match_xpath, $use_xpath);
+    $xc->unregisterKey($name);
+
+    $xc->registerDocument($uri, $doc_or_stringref_or_filename);
+    $xc->unregisterDocument($uri);
+    $xc->registerDocumentLoader(sub { ... }, $data);
+    $xc->unregisterDocumentLoader();
+    $xc->setDocumentParseOptions(noblanks => 1, huge => 1);
+    $xc->setDocumentPrefetchThreads(4);
+    $xc->setSharedDictionary(1);
+    $xc->setQueryThreads(8);
+    my $xc2 = $xc->clone($node);
+    $xc->setCompiledCache(1000);
+    $xc->setParallelScan(1);
+    $xc->setNameIndex(1);
+    $xc->indexAttribute($element_qname, $attribute_qname);
+    $xc->setAttributeIndexThreshold(3);
+    $xc->indexNumbers($element_qname, $attribute_qname);
+    my $bytes = $xc->getIndexMemory($doc);
+    $xc->dropIndexes($doc);
+
     my @nodes = $xc->findnodes($xpath);
     my @nodes = $xc->findnodes($xpath, $context_node);
     my $nodelist = $xc->findnodes($xpath);
@@ -173,6 +521,27 @@ XML::LibXML::XPathContext - Perl interface to libxml2's xmlXPathContext
     my $result = $xc->find($xpath, $context_node);
     my $value = $xc->findvalue($xpath);
     my $value = $xc->findvalue($xpath, $context_node);
+    my @nodelists = $xc->findnodes_many($xpath, \@nodes);
+    my @values = $xc->findvalue_many($xpath, \@nodes);
+    my $xml = $xc->findserialize($xpath, undef, separator => "\n");
+    my $count = $xc->findserialize($xpath, $fh, c14n => 1, node => $context_node);
+    my $count = $xc->findexport($xpath, [ $name => $xpath, ... ], $fh,
+                                format => 'tsv');
+    my @nodes = $xc->getElementsByTagName($qname, [ $context_node ]);
+    my @nodes = $xc->getElementsByTagNameNS($namespace_uri, $localname,
+                                            [ $context_node ]);
+    my $count = $xc->streamfind($file_or_fh, $pattern, sub { my $node = shift; ... });
+    my $count = $xc->streamrecords($file_or_fh, $pattern, \@xpaths,
+                                   sub { my ($record, @results) = @_; ... });
+    my $stream = $xc->newPushStream($pattern => sub { my $node = shift; ... },
+                                    ...);
+    $stream->feed($bytes);
+    $stream->finish;
+    my $plan = $xc->explain($xpath);
+    $xc->setStats(1);
+    my $stats = $xc->stats;
+    my $text = $xc->stats_openmetrics('myapp_xpath');
+    $xc->reset_stats;
 
 
 =head1 DESCRIPTION
@@ -337,6 +706,93 @@ Same as I<registerFunctionNS> but without a namespace.
 
 Same as I<unregisterFunctionNS> but without a namespace.
 
+=item B<registerKey($name, $match, $use)>
+
+Defines the key I<$name> for the XPath function key(), which works as
+in XSLT: C<key($name, $value)> returns the nodes of the context node's
+document which have the string I<$value>, or any of the string values
+of a nodeset I<$value>, as a value of the key.  The nodes of a key are
+those the expression I<$match> selects with the document as context
+node; their values are the string values of the expression I<$use>
+evaluated with each of them as context node, or of every node it
+returns.  For example
+
+    $xc->registerKey('part', '//part', '@id');
+    $xc->findnodes('//use[key("part", @ref)/@stock > 0]');
+
+finds references to parts in stock without comparing every reference
+with every part.  A key is indexed on its first use in a query and the
+index is dropped when the query finishes, so it follows changes made
+to the document between queries.  Registering a key replaces an
+extension function called key().
+
+=item B<unregisterKey($name)>
+
+Removes the key I<$name> registered with I<registerKey>.
+
+=item B<registerDocument($uri, $source)>
+
+Makes the XPath function document() return I<$source> for I<$uri>
+without touching the network or the file system. I<$uri> is compared
+both with the string passed to document() and with the URI resolved
+against the base URI of the context. I<$source> can be an
+L<XML::LibXML::Document|XML::LibXML::Document> (or any other node), a
+reference to a string containing XML, or the name of a local file.
+Strings and files are parsed on first use only; the parsed document
+is kept by the context and returned by every later call.
+
+=item B<unregisterDocument($uri)>
+
+Removes I<$uri> from the documents registered with
+I<registerDocument>.
+
+=item B<registerDocumentLoader($callback, $data)>
+
+Registers a function that resolves URIs passed to document() which
+are not registered with I<registerDocument>. It is called with three
+arguments: I<$data>, the resolved URI and the string passed to
+document(), and may return the same kinds of values I<registerDocument>
+accepts. If it returns C<undef>, the URI is parsed as usual. Documents
+parsed for a loader are not cached; the loader may cache them itself
+by returning the same Document object.
+
+=item B<unregisterDocumentLoader()>
+
+Unregisters the document loader function and the associated data.
+
+=item B<setDocumentParseOptions(%options)>
+
+Sets the libxml2 parser options used for documents parsed by
+document(). The options are given as name/value pairs and replace
+any options set before; known names are C<compact>, C<huge>,
+C<nonet>, C<noblanks>, C<nocdata>, C<nsclean>, C<noent> and
+C<recover> (see the libxml2 XML_PARSE_* flags). Local files are
+mapped into memory and parsed in place, gzip compressed files are
+decompressed while being read. All documents loaded through one
+context share the parser's string dictionary.
+
+=item B<setDocumentPrefetchThreads($threads)>
+
+When document() is given a nodeset, the URIs of all its nodes are
+collected and resolved before any of them is loaded; every distinct
+URI is loaded only once per query. Documents that are neither
+registered nor provided by the document loader are then parsed by up
+to I<$threads> threads at once (default 1, i.e. one after the other).
+Documents parsed this way use a dictionary of their own on top of the
+context's shared dictionary (see setSharedDictionary()). Parse
+errors are reported as usual. Has no effect if the module was built
+without thread support.
+
+=item B<setSharedDictionary($flag)>
+
+If I<$flag> is true, the context creates a string dictionary which is
+used by every document document() parses and by every expression the
+context compiles, so that element and attribute names are stored only
+once and name tests compare them by pointer. Without it, expressions
+the context does not cache (see setCompiledCache()) are compiled
+against the dictionary of the context node's document.
+Documents already loaded keep the dictionary they were parsed with.
+
 =item B<findnodes($xpath, [ $context_node ])>
 
 Performs the xpath statement on the current node and returns the
@@ -371,6 +827,303 @@ certain shortcuts. This could be used as the equivalent of
 <xsl:value-of select="some_xpath"/>. Optionally, a node may be passed
 in the second argument to set the context node for the query.
 
+=item B<findnodes_many($xpath, \@nodes)>
+
+Performs the xpath statement once for every node in I<@nodes>, using
+it as the context node, and returns a list with one
+L<XML::LibXML::NodeList|XML::LibXML::NodeList> per node.  The
+statements are evaluated by up to as many threads as set with
+setQueryThreads(), each with its own copy of the registered
+namespaces; the results are turned into Perl objects afterwards.  The
+nodes must not be changed while this runs.  If extension functions or
+a variable lookup function are registered, if the statement uses
+document() or if a node does not belong to a document, the statements
+are evaluated one after the other instead.
+
+=item B<findvalue_many($xpath, \@nodes)>
+
+Like findnodes_many(), but returns a list with the result of
+findvalue() for every node.
+
+=item B<findserialize($xpath, $fh, %options)>
+
+Evaluates the xpath statement and serializes the nodes found, in
+document order, in one go without making Perl objects of them.  If
+I<$fh> is undefined the XML is returned as a string, otherwise it is
+printed to the filehandle as UTF-8 and the number of nodes written is
+returned.  The options are
+
+=over 4
+
+=item separator
+
+a string written between two nodes, nothing by default
+
+=item c14n
+
+1 for canonical XML, C<'exclusive'> for exclusive canonical XML; each
+node is canonicalized with its subtree as toStringC14N() would
+
+=item comments
+
+keeps comments in canonical XML
+
+=item format
+
+indents the XML unless it is canonical
+
+=item node
+
+the context node, the context's own by default
+
+=back
+
+A result which is not a node-set is written as its string value.
+
+=item B<findexport($xpath, [ $name =E<gt> $column_xpath, ... ], $fh, %options)>
+
+Writes a table with a row for every node found by the xpath statement
+and a column for every pair of name and XPath expression, which is
+evaluated with the row node as the context node.  The expressions are
+compiled once and evaluated, quoted and written in C, so no Perl code
+runs per row or value.  If I<$fh> is undefined the table is returned
+as a string, otherwise it is printed to the filehandle as UTF-8 and
+the number of rows written is returned.  The options are
+
+=over 4
+
+=item format
+
+C<'csv'> (the default), quoted as in RFC 4180; C<'tsv'>, with tabs,
+newlines, carriage returns and backslashes written as C<\t>, C<\n>,
+C<\r> and C<\\>; or C<'ndjson'>, one JSON object per line keyed by
+the column names, where numbers and booleans stay such and an empty
+node-set is C<null>
+
+=item header
+
+whether CSV and TSV start with a line of the column names, the
+default
+
+=item stream
+
+a file name or an open filehandle to read the rows from instead of
+the context's document, as streamfind() does; I<$xpath> has to be a
+streamable pattern then and only one row is in memory at a time
+
+=item node
+
+the context node, the context's own by default
+
+=back
+
+Other values are written as their string values, with lines ending
+in a newline.
+
+=item B<getElementsByTagName($qname, [ $context_node ])>
+
+Returns the element descendants of the context node, or of
+I<$context_node> if given, whose qualified name is I<$qname>, in
+document order, as a list or an
+L<XML::LibXML::NodeList|XML::LibXML::NodeList> like findnodes().
+C<*> matches all elements.  Unlike the method of the same name of
+L<XML::LibXML::Node|XML::LibXML::Node> no XPath is evaluated: the tree
+is walked once, comparing names by pointer where they come from the
+document's dictionary, so this is well suited to very large
+documents.
+
+=item B<getElementsByTagNameNS($namespace_uri, $localname, [ $context_node ])>
+
+Like getElementsByTagName(), but matches the namespace URI and local
+name; either may be C<*> to match any.  An undefined or empty
+I<$namespace_uri> matches elements in no namespace.
+
+=item B<streamfind($file_or_fh, $pattern, sub { ... })>
+
+Reads a file, given by name or as an open filehandle, with libxml2's
+xmlTextReader and calls the subroutine with every element matched by
+I<$pattern>, without loading the whole document.  The pattern is the
+streamable subset of XPath libxml2's xmlPatterncompile() accepts:
+location paths of child and descendant steps without predicates, such
+as C</feed/item> or C<//p:entry>, possibly joined with C<|>; the
+prefixes registered with this context may be used.  Each match is
+passed as the root element of a new document holding a copy of its
+subtree, so it may be kept; elements within a matching one are
+matched as well.  The options set with setDocumentParseOptions() are
+used for reading.  Returns the number of matches; dies if the pattern
+cannot be streamed, the input is not well-formed or the subroutine
+dies.
+
+=item B<streamrecords($file_or_fh, $pattern, \@xpaths, sub { ... })>
+
+Like streamfind(), but evaluates each of the XPath expressions in
+I<@xpaths> with the matching record as the context node and passes
+the record followed by the results, as find() would return them, to
+the subroutine.  The expressions are compiled once and may use
+everything registered with the context: namespaces, functions,
+variables and keys.  Only one record is in memory at a time, plus
+whatever the subroutine keeps, so records such as
+C</export/customer> can be queried in full out of documents of any
+size.
+
+=item B<newPushStream($pattern =E<gt> sub { ... }, ...)>
+
+Returns a push parser for XML arriving in pieces, such as from a pipe
+or a socket.  Each chunk of bytes is passed with
+C<$stream-E<gt>feed($bytes)>, and C<$stream-E<gt>finish> ends the
+document.  As soon as the end tag of an element matching one of the
+streamable patterns (see streamfind()) has been parsed, its
+subroutine is called with a copy of the element, as the root of a new
+document, so nothing waits for the rest of the input.  Elements which
+are closed and not inside a matching one are freed, so memory stays
+bounded by the open elements and the largest match.  feed() and
+finish() die with the parser error on malformed input or with the
+error of a subroutine which died; the stream cannot be fed after
+that.
+
+=item B<setParallelScan($flag)>
+
+If I<$flag> is true, statements of the form C<//name[predicate]...>
+are evaluated by up to as many threads as set with setQueryThreads(),
+each taking some of the subtrees of the document; the partial results
+are merged in document order.  This is only done where it gives the
+same result as evaluating the statement at once: the predicates of the
+first step must not depend on the position (as C<[1]> or
+C<[last()]> do), and no variables or extension functions may be used.
+Other statements are evaluated as usual.  The document must not be
+changed while a statement is evaluated.
+
+=item B<clone([ $node ])>
+
+Returns a new context which shares the registered namespaces,
+extension functions and compiled statements (see setCompiledCache())
+with this one until either of them registers or unregisters a
+namespace or function, after which it has copies of its own.  Variable
+lookup function, document loader, registered documents and settings
+are taken over.  The context node of the copy is I<$node> if given and
+the one of this context otherwise.  Cloning is much cheaper than
+creating a context and registering everything again.
+
+=item B<setCompiledCache($size)>
+
+Statements are compiled once and kept for later evaluations, up to
+I<$size> (256 by default) different ones; the cache is shared with
+clones.  A size of 0 disables the cache.  Registering or unregistering
+an extension function empties it.
+
+=item B<setNameIndex($flag)>
+
+With a true I<$flag>, expressions starting with C<//name>, possibly
+followed by predicates which do not depend on the position and further
+steps, are answered from an index of the elements of the document by
+name instead of visiting all of its nodes.  The index is built in one
+pass on first use and kept by the context until the numbering of the
+elements done before every query (see L<"BUGS AND CAVEATS">) finds an
+element inserted, moved, removed, renamed or put in another
+namespace, or an attribute changed, since then; a node found through
+it is also checked for having been renamed or unlinked.  The indexes
+are freed with the context.
+
+=item B<indexAttribute($element, $attribute)>
+
+Makes expressions of the form C<//element[@attribute = 'value']>,
+possibly followed by further predicates and steps as for
+I<setNameIndex>, look the elements up in an index of the values of
+I<$attribute> of all I<$element> elements of the document.  The index
+is built on first use and kept like the element name index.  Both
+names are given as written in the expressions, with the same prefixes.
+
+=item B<setAttributeIndexThreshold($count)>
+
+Indexes the values of an attribute as if I<indexAttribute> had been
+called for it once I<$count> expressions of the above form have asked
+for it.  0, the default, leaves it to I<indexAttribute>.
+
+=item B<indexNumbers($element, $attribute)>
+
+Makes expressions such as C<//element[@attribute E<gt> 10 and
+@attribute E<lt>= 20]>, comparing the attribute with number literals
+by C<E<lt>>, C<E<lt>=>, C<E<gt>>, C<E<gt>=> or C<=> once or twice,
+look the elements up in an index of the number values of
+I<$attribute> sorted by value.  Elements whose attribute is not a
+number are left out of the index as they never compare true.  The
+index is kept like the attribute value index and is not built by
+I<setAttributeIndexThreshold>.
+
+=item B<getIndexMemory($node)>
+
+Returns the approximate number of bytes the indexes this context keeps
+for I<$node>'s document take, 0 if it has none.
+
+=item B<dropIndexes($node)>
+
+Frees the indexes this context keeps for I<$node>'s document.  They
+are built again when needed.
+
+=item B<setQueryThreads($threads)>
+
+Sets the number of threads findnodes_many(), findvalue_many() and
+setParallelScan() use.
+The default is the number of processors online; 0 restores it.  Has
+no effect if the module was built without thread support.
+
+=item B<explain($xpath)>
+
+Returns how libxml2 compiled I<$xpath>, as a hash reference with the
+I<expression>, the number of I<steps> libxml2 made of it and the
+I<tree> of those operations, from the one evaluated last.  Location
+steps are I<COLLECT> operations with the I<axis>, the node I<test>, the
+I<input> they start from and their I<predicates>; descendant steps
+carry a I<scan> of I<document> if they go down from the root and
+I<subtree> otherwise.  Other operations are I<VALUE>s with a I<type>
+and a I<value>, I<FUNCTION>s with a I<name> and I<args>, I<VARIABLE>s,
+I<EQUAL>, I<CMP>, I<PLUS> and I<MULT> with an I<operator> and
+I<operands>, I<FILTER>s with an I<input> and I<predicates>, and
+I<SORT>, I<UNION>, I<AND>, I<OR>, I<ROOT> and I<NODE> with their
+I<children>.
+
+I<scans> lists the steps which go through the whole document and
+I<optimizations> what libxml2 does to save work: a step written as
+//name without predicates is I<rewritten> to the descendant axis, an
+axis whose last predicate is a number stops at that
+I<position_limit>, and (...)[1] and (...)[last()] have a I<shortcut>
+which evaluates only the node needed.
+
+    print "$_\n" for @{ $xc->explain('//item[@id = $id]')->{scans} };
+
+Needs libxml2 built with debugging support, which it is by default.
+
+=item B<setStats($flag)>
+
+Switches the statistics of the context on or off; they are off by
+default and cost nothing then.  Switching them off drops what was
+counted.  Only findnodes(), find() and findvalue() are counted, with
+times taken from a monotonic clock.
+
+=item B<stats()>
+
+Returns a hash reference with what was counted since the statistics
+were switched on or last reset: I<enabled>, I<queries>, I<nodes>
+returned, I<proxies_created> for nodes not yet seen by Perl,
+I<compile_cache_hits> and I<compile_cache_misses> (see
+setCompiledCache()), I<pool_nodes> and I<pool_peak>, the nodes returned
+by callbacks that were kept alive in total and for a single query, and
+I<phases>, which maps I<convert>, I<configure>, I<normalize>,
+I<compile>, I<eval>, I<proxy> and I<callback> to hashes of the
+I<count> of times the phase ran and the I<seconds> it took.  The time
+spent in callbacks is part of the time of I<eval> as well; statements
+answered from an index or by setParallelScan() count as I<eval> only.
+
+=item B<stats_openmetrics([ $prefix ])>
+
+Returns stats() in the OpenMetrics text format, with metric names
+starting with I<$prefix>, I<xpathcontext> by default.
+
+=item B<reset_stats()>
+
+Sets what stats() returns back to 0 without switching the statistics
+off.
+
 =item B<getContextNode()>
 
 Get the current context node.
@@ -423,6 +1176,24 @@ avoid registering new extension functions, namespaces and a variable
 lookup function from within extension functions and a variable lookup
 function, unless you want to experience untested behavior.
 
+XML::LibXML::XPathContext objects may be used from several Perl
+threads at once, provided that every thread creates its own objects:
+a context that exists when a thread is started is not copied, the new
+thread sees an unblessed reference to undef instead.  Errors are
+collected per query and per thread, so a failing query in one thread
+does not affect the others.
+
+Before every query the elements of the tree holding the context node
+are numbered in document order, which lets results be sorted without
+walking up the tree to compare nodes.  The numbers are kept in the
+elements' content field, as libxml2's xmlXPathOrderDocElems() does,
+and removed again when the query finishes, also if it dies in a
+callback, so queries made through XML::LibXML itself never sort by numbers left over from this module.
+Only if a callback moves the context node out of its tree in the
+middle of a query do the elements of the old tree keep their numbers
+until the tree is queried again.  C code which uses that field of
+elements for its own purposes cannot be mixed with this module.
+
 =head1 AUTHORS
 
 Based on L<XML::LibXML|XML::LibXML> and L<XML::XSLT|XML::XSLT> code by
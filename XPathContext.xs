@@ -18,63 +18,307 @@ extern "C" {
 /* XML::LibXML stuff */
 #include "perl-libxml-mm.h"
 
+#include "dom.h"
 #include "xpath.h"
+#include "index.h"
 
 #ifdef __cplusplus
 }
 #endif
 
-static SV * xpc_LibXML_error    = NULL;
+/* errors are collected for the duration of a query into an SV of
+ * the context, see xpc_LibXML_error_enter() */
+#define xpc_LibXML_init_error(ctxt) ENTER; \
+                            xpc_LibXML_error_enter(aTHX_ ctxt); \
+                            xpc_LibXML_fragment_enter(aTHX_ ctxt);
+
+#define xpc_LibXML_croak_error(ctxt) { \
+                                 SV * xpc_error = XPathContextDATA(ctxt)->error; \
+                                 SvREFCNT_inc(xpc_error); \
+                                 LEAVE; \
+                                 sv_2mortal(xpc_error); \
+                                 if ( SvCUR( xpc_error ) > 0 ) { \
+                                     croak("%s",SvPV_nolen(xpc_error)); \
+                                 } \
+                             }
+
+/* the namespace and function tables of a context are shared with its
+ * clones until one of them changes them; so are the expressions
+ * compiled for them */
+struct _xpc_SharedTables {
+    int refs;
+    xmlHashTablePtr compiled;
+    int ncompiled;
+};
+typedef struct _xpc_SharedTables xpc_SharedTables;
+
+/* the indexes key() built during a query, by key name and document */
+struct _xpc_KeyIndex {
+    xmlChar * name;
+    xmlDocPtr doc;
+    xmlHashTablePtr index;
+    struct _xpc_KeyIndex * next;
+};
+typedef struct _xpc_KeyIndex xpc_KeyIndex;
+
+/* the phases of a query timed by setStats(), in the order stats()
+ * lists them */
+enum {
+    XPC_STAT_CONVERT = 0,
+    XPC_STAT_CONFIGURE,
+    XPC_STAT_NORMALIZE,
+    XPC_STAT_COMPILE,
+    XPC_STAT_EVAL,
+    XPC_STAT_PROXY,
+    XPC_STAT_CALLBACK,
+    XPC_STAT_PHASES
+};
 
-/* NEWSV(0, 512); \ */
-#define xpc_LibXML_init_error() if (xpc_LibXML_error == NULL || !SvOK(xpc_LibXML_error)) \
-                            xpc_LibXML_error = NEWSV(0,512); \
-                            sv_setpvn(xpc_LibXML_error, "", 0); \
-                            xmlSetGenericErrorFunc( NULL ,  \
-                                (xmlGenericErrorFunc)xpc_LibXML_error_handler);
+static const char * xpc_LibXML_stat_names[XPC_STAT_PHASES] = {
+    "convert", "configure", "normalize", "compile", "eval", "proxy",
+    "callback"
+};
 
-#define xpc_LibXML_croak_error() if ( SvCUR( xpc_LibXML_error ) > 0 ) { \
-                                 croak("%s",SvPV(xpc_LibXML_error, len)); \
-                             } 
+/* counters of a context while setStats() is on. kept behind a pointer
+ * so that they survive the context being saved and restored around
+ * callbacks */
+struct _xpc_Stats {
+    UV queries;
+    UV calls[XPC_STAT_PHASES];
+    NV nanos[XPC_STAT_PHASES];
+    UV compileHits;
+    UV compileMisses;
+    UV nodes;
+    UV proxies;
+    UV poolNodes;
+    UV poolPeak;
+};
+typedef struct _xpc_Stats xpc_Stats;
 
 struct _XPathContextData {
     SV* node;
     HV* pool;  
     SV* varLookup;
     SV* varData;
+    SV* docLoader;
+    SV* docLoaderData;
+    HV* docCatalog;
+    HV* docCache;
+    xmlParserCtxtPtr docParser;
+    int docParseOptions;
+    int docThreads;
+    int queryThreads;
+    int parallelScan;
+    int nameIndex;
+    xmlHashTablePtr attrIndex;
+    int attrThreshold;
+    xpc_SharedTables* tables;
+    int compiledMax;
+    xmlDictPtr dict;
+    xmlDocPtr shadowDoc;
+    HV* keys;
+    xpc_KeyIndex* keyIndex;
+    xpc_Stats* stats;
+    xpc_DocIndex* indexes;
+    SV* error;
 };
 typedef struct _XPathContextData XPathContextData;
 typedef XPathContextData* XPathContextDataPtr;
 
 #define XPathContextDATA(ctxt) ((XPathContextDataPtr) ctxt->user)
 
+/* ****************************************************************
+ * Statistics
+ * **************************************************************** */
+
+/* nanoseconds of a monotonic clock */
+static NV
+xpc_LibXML_stats_now( void )
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (NV)ts.tv_sec * 1e9 + (NV)ts.tv_nsec;
+#else
+    return (NV)clock() * (1e9 / CLOCKS_PER_SEC);
+#endif
+}
+
+/* with the statistics off both only test a pointer; phases started
+ * before they were switched on are not counted */
+#define xpc_LibXML_stat_start(data, t) \
+    ( (t) = (data)->stats != NULL ? xpc_LibXML_stats_now() : 0 )
+
+#define xpc_LibXML_stat_stop(data, phase, t) STMT_START { \
+    if ( (data)->stats != NULL && (t) > 0 ) { \
+        (data)->stats->calls[phase]++; \
+        (data)->stats->nanos[phase] += xpc_LibXML_stats_now() - (t); \
+    } \
+} STMT_END
+
 
 /* ****************************************************************
  * Error handler
  * **************************************************************** */
 
-/* stores libxml errors into $@ */
+/* appends libxml errors to the SV given as ctxt */
 static void
 xpc_LibXML_error_handler(void * ctxt, const char * msg, ...)
 {
     va_list args;
     SV * sv;
     dTHX;
-    /* xmlParserCtxtPtr context = (xmlParserCtxtPtr) ctxt; */
+
     sv = NEWSV(0,512);
 
     va_start(args, msg);
     sv_vsetpvfn(sv, msg, strlen(msg), &args, NULL, 0, NULL);
     va_end(args);
     
-    if (xpc_LibXML_error != NULL) {
-        sv_catsv(xpc_LibXML_error, sv); /* remember the last error */
+    if (ctxt != NULL) {
+        sv_catsv((SV *)ctxt, sv); /* remember the last error */
+        SvREFCNT_dec(sv);
     }
     else {
         croak("%s",SvPV(sv, PL_na));
     }
+}
+
+/* the same for structured errors, formatted as libxml2 would */
+static void
+xpc_LibXML_structured_error_handler(void * ctxt, const xmlError * error)
+{
+    SV * sv = (SV *)ctxt;
+    const char * domain;
+    dTHX;
+
+    if (sv == NULL || error == NULL)
+        return;
+
+    switch (error->domain) {
+        case XML_FROM_PARSER:    domain = "parser "; break;
+        case XML_FROM_NAMESPACE: domain = "namespace "; break;
+        case XML_FROM_IO:        domain = "I/O "; break;
+        case XML_FROM_XPATH:     domain = "XPath "; break;
+        case XML_FROM_XPOINTER:  domain = "XPointer "; break;
+        default:                 domain = ""; break;
+    }
+    if (error->file != NULL)
+        sv_catpvf(sv, "%s:%d: ", error->file, error->line);
+    sv_catpvf(sv, "%s%s : %s", domain,
+              error->level == XML_ERR_WARNING ? "warning" : "error",
+              error->message != NULL ? error->message : "unknown error\n");
+    if (error->domain == XML_FROM_XPATH && error->str1 != NULL) {
+        /* the expression and where it went wrong */
+        sv_catpvf(sv, "%s\n%*s^\n", error->str1, error->int1, "");
+    }
+}
+
+/* what a query replaces while it collects errors */
+struct _xpc_ErrorScope {
+    xmlXPathContextPtr ctxt;
+    SV * error;
+    xmlStructuredErrorFunc ctxtError;
+    void * ctxtErrorData;
+    xmlStructuredErrorFunc structured;
+    void * structuredData;
+    xmlGenericErrorFunc generic;
+    void * genericData;
+};
+typedef struct _xpc_ErrorScope xpc_ErrorScope;
+
+static void
+xpc_LibXML_error_leave(pTHX_ void * p)
+{
+    xpc_ErrorScope * scope = (xpc_ErrorScope *)p;
+    xmlXPathContextPtr ctxt = scope->ctxt;
+
+    xmlSetStructuredErrorFunc(scope->structuredData, scope->structured);
+    xmlSetGenericErrorFunc(scope->genericData, scope->generic);
+    ctxt->error    = scope->ctxtError;
+    ctxt->userData = scope->ctxtErrorData;
+
+    SvREFCNT_dec(XPathContextDATA(ctxt)->error);
+    XPathContextDATA(ctxt)->error = scope->error;
+    Safefree(scope);
+}
+
+/* starts collecting the errors of a query into a new SV of the
+ * context. the handlers are those of the calling thread; the previous
+ * ones are put back when the enclosing scope is left, even if the
+ * query croaks. */
+static void
+xpc_LibXML_error_enter(pTHX_ xmlXPathContextPtr ctxt)
+{
+    xpc_ErrorScope * scope;
+    SV * error = newSVpvn("", 0);
+
+    Newx(scope, 1, xpc_ErrorScope);
+    scope->ctxt           = ctxt;
+    scope->error          = XPathContextDATA(ctxt)->error;
+    scope->ctxtError      = ctxt->error;
+    scope->ctxtErrorData  = ctxt->userData;
+    scope->structured     = xmlStructuredError;
+    scope->structuredData = xmlStructuredErrorContext;
+    scope->generic        = xmlGenericError;
+    scope->genericData    = xmlGenericErrorContext;
+    SAVEDESTRUCTOR_X(xpc_LibXML_error_leave, scope);
+
+    XPathContextDATA(ctxt)->error = error;
+    ctxt->error    = (xmlStructuredErrorFunc)xpc_LibXML_structured_error_handler;
+    ctxt->userData = error;
+    xmlSetStructuredErrorFunc(error,
+        (xmlStructuredErrorFunc)xpc_LibXML_structured_error_handler);
+    xmlSetGenericErrorFunc(error,
+        (xmlGenericErrorFunc)xpc_LibXML_error_handler);
+}
+
+/* the fragment a query links to a document, see
+ * xpc_domXPathFindCompiled() */
+struct _xpc_FragmentScope {
+    xmlXPathContextPtr ctxt;
+    xmlNodePtr top;
+};
+typedef struct _xpc_FragmentScope xpc_FragmentScope;
+
+static void
+xpc_LibXML_fragment_leave(pTHX_ void * p)
+{
+    xpc_FragmentScope * scope = (xpc_FragmentScope *)p;
+    xmlXPathContextPtr ctxt = scope->ctxt;
+    xmlDocPtr doc;
+
+    /* still linked if the query croaked */
+    if (scope->top->parent != NULL) {
+        doc = (xmlDocPtr)scope->top->parent;
+        if (ctxt->doc == doc)
+            ctxt->doc = NULL;
+        xpc_domXPathUnshadow(doc, &XPathContextDATA(ctxt)->shadowDoc);
+    }
+    Safefree(scope);
+}
 
-    SvREFCNT_dec(sv);
+/* makes sure the fragment of the context node, if it is in one, is
+ * unlinked from the document a query links it to when the enclosing
+ * scope is left, even if the query croaks. a fragment linked already
+ * is left to the query this one is nested in. */
+static void
+xpc_LibXML_fragment_enter(pTHX_ xmlXPathContextPtr ctxt)
+{
+    xpc_FragmentScope * scope;
+    xmlNodePtr top = ctxt->node;
+
+    if (top == NULL || top->doc != NULL)
+        return;
+    while (top->parent != NULL)
+        top = top->parent;
+    if (top->type == XML_DOCUMENT_NODE)
+        return;
+
+    Newx(scope, 1, xpc_FragmentScope);
+    scope->ctxt = ctxt;
+    scope->top  = top;
+    SAVEDESTRUCTOR_X(xpc_LibXML_fragment_leave, scope);
 }
 
 /* ****************************************************************
@@ -192,6 +436,22 @@ xpc_LibXML_perldata_to_LibXMLdata(xmlXPathParserContextPtr ctxt,
 }
 
 
+/* the indexes key() built are only valid while the documents do not
+ * change, which is assumed for one query */
+static void
+xpc_LibXML_free_key_indexes(XPathContextDataPtr data)
+{
+    xpc_KeyIndex * ki;
+
+    while (data->keyIndex != NULL) {
+        ki = data->keyIndex;
+        data->keyIndex = ki->next;
+        xpc_domFreeKeyIndex(ki->index);
+        xmlFree(ki->name);
+        Safefree(ki);
+    }
+}
+
 /* save XPath context and XPathContextDATA for recursion */
 static xmlXPathContextPtr
 xpc_LibXML_save_context(xmlXPathContextPtr ctxt)
@@ -210,6 +470,8 @@ xpc_LibXML_save_context(xmlXPathContextPtr ctxt)
 	    memcpy(XPathContextDATA(copy), XPathContextDATA(ctxt),sizeof(XPathContextData));
 	    /* clear ctxt->pool, so that it is not used freed during re-entrance */
 	    XPathContextDATA(ctxt)->pool = NULL; 
+	    XPathContextDATA(ctxt)->docCache = NULL;
+	    XPathContextDATA(ctxt)->keyIndex = NULL;
 	}
     }
     return copy;
@@ -227,6 +489,11 @@ xpc_LibXML_restore_context(xmlXPathContextPtr ctxt, xmlXPathContextPtr copy)
 	    SvOK(XPathContextDATA(ctxt)->pool)) {
 	    SvREFCNT_dec((SV *)XPathContextDATA(ctxt)->pool);
 	}
+	/* and the documents loaded during recursion */
+	if (XPathContextDATA(ctxt)->docCache != NULL) {
+	    SvREFCNT_dec((SV *)XPathContextDATA(ctxt)->docCache);
+	}
+	xpc_LibXML_free_key_indexes(XPathContextDATA(ctxt));
     }
     if (ctxt->namespaces) {
 	/* free namespaces allocated during recursion */
@@ -237,6 +504,14 @@ xpc_LibXML_restore_context(xmlXPathContextPtr ctxt, xmlXPathContextPtr copy)
     if (copy) {
 	/* 1st restore our data */
 	if (XPathContextDATA(copy)) {
+	    /* keep what was created lazily during recursion */
+	    if (XPathContextDATA(copy)->docParser == NULL)
+		XPathContextDATA(copy)->docParser = XPathContextDATA(ctxt)->docParser;
+	    if (XPathContextDATA(copy)->shadowDoc == NULL)
+		XPathContextDATA(copy)->shadowDoc = XPathContextDATA(ctxt)->shadowDoc;
+	    /* and the statistics as switched by a callback */
+	    XPathContextDATA(copy)->stats = XPathContextDATA(ctxt)->stats;
+	    XPathContextDATA(copy)->indexes = XPathContextDATA(ctxt)->indexes;
 	    memcpy(XPathContextDATA(ctxt),XPathContextDATA(copy),sizeof(XPathContextData));
 	    xmlFree(XPathContextDATA(copy));
 	    copy->user = XPathContextDATA(ctxt);
@@ -248,6 +523,25 @@ xpc_LibXML_restore_context(xmlXPathContextPtr ctxt, xmlXPathContextPtr copy)
 }
 
 
+/* the proxy a node returned to perl has to be owned by */
+static xpc_ProxyNodePtr
+xpc_LibXML_node_owner(xmlNodePtr node)
+{
+    if (node->doc != NULL) {
+        return xpc_PmmOWNERPO(xpc_PmmNewNode((xmlNodePtr) node->doc));
+    }
+    /* a node of a fragment belongs to whatever owns the nearest
+       node on its ancestor axis that perl knows */
+    while (node != NULL && node->_private == NULL) {
+        node = node->parent;
+    }
+    if (node != NULL) {
+        xpc_ProxyNodePtr proxy = (xpc_ProxyNodePtr)node->_private;
+        return xpc_PmmOWNERPO(proxy);
+    }
+    return NULL;
+}
+
 /* ****************************************************************
  * Variable Lookup
  * **************************************************************** */
@@ -262,6 +556,7 @@ xpc_LibXML_generic_variable_lookup(void* varLookupData,
     xmlXPathContextPtr copy;
     XPathContextDataPtr data;
     I32 count;
+    NV started;
     dTHX;
     dSP;
 
@@ -287,7 +582,9 @@ xpc_LibXML_generic_variable_lookup(void* varLookupData,
     copy = xpc_LibXML_save_context(ctxt);
 
     PUTBACK ;    
+    xpc_LibXML_stat_start(data, started);
     count = perl_call_sv(data->varLookup, G_SCALAR|G_EVAL);
+    xpc_LibXML_stat_stop(data, XPC_STAT_CALLBACK, started);
     SPAGAIN;
 
     /* restore the xpath context */
@@ -329,6 +626,7 @@ xpc_LibXML_generic_extension_function(xmlXPathParserContextPtr ctxt, int nargs)
     dSP;
     SV * data;
     xmlXPathContextPtr copy;
+    NV started;
 
     /* warn("entered xpc_LibXML_generic_extension_function for %s\n",ctxt->context->function); */
     data = (SV *) ctxt->context->funcLookupData;
@@ -383,11 +681,6 @@ xpc_LibXML_generic_extension_function(xmlXPathParserContextPtr ctxt, int nargs)
                     len = nodelist->nodeNr;
                     for( j ; j < len; j++){
                         tnode = nodelist->nodeTab[j];
-                        if( tnode != NULL && tnode->doc != NULL) {
-                            owner = xpc_PmmOWNERPO(xpc_PmmNewNode((xmlNodePtr) tnode->doc));
-                        } else {
-                            owner = NULL;
-                        }
                         if (tnode->type == XML_NAMESPACE_DECL) {
                             element = sv_newmortal();
                             cls = xpc_PmmNodeTypeName( tnode );
@@ -397,6 +690,7 @@ xpc_LibXML_generic_extension_function(xmlXPathParserContextPtr ctxt, int nargs)
                                 );
                         }
                         else {
+                            owner = xpc_LibXML_node_owner(tnode);
                             element = xpc_PmmNodeToSv(tnode, owner);
                         }
                         XPUSHs( sv_2mortal(element) );
@@ -437,7 +731,10 @@ xpc_LibXML_generic_extension_function(xmlXPathParserContextPtr ctxt, int nargs)
     /* call perl dispatcher */
     PUTBACK;
     perl_dispatch = sv_2mortal(newSVpv("XML::LibXML::XPathContext::_perl_dispatcher",0));
+    xpc_LibXML_stat_start(XPathContextDATA(ctxt->context), started);
     count = perl_call_sv(perl_dispatch, G_SCALAR|G_EVAL);    
+    xpc_LibXML_stat_stop(XPathContextDATA(ctxt->context), XPC_STAT_CALLBACK,
+                         started);
     SPAGAIN;
 
     /* restore the xpath context */
@@ -458,6 +755,340 @@ xpc_LibXML_generic_extension_function(xmlXPathParserContextPtr ctxt, int nargs)
     LEAVE;    
 }
 
+/* ****************************************************************
+ * Document loading for document()
+ * **************************************************************** */
+
+/* names accepted by setDocumentParseOptions() */
+static const struct {
+    const char * name;
+    int flag;
+} xpc_LibXML_parse_options[] = {
+    { "compact",  XML_PARSE_COMPACT },
+    { "huge",     XML_PARSE_HUGE },
+    { "nonet",    XML_PARSE_NONET },
+    { "noblanks", XML_PARSE_NOBLANKS },
+    { "nocdata",  XML_PARSE_NOCDATA },
+    { "nsclean",  XML_PARSE_NSCLEAN },
+    { "noent",    XML_PARSE_NOENT },
+    { "recover",  XML_PARSE_RECOVER },
+    { NULL, 0 }
+};
+
+/* the parser shared by all documents this context loads; reusing it
+ * also reuses its dictionary, which is replaced by the context's own
+ * dictionary if there is one */
+static xmlParserCtxtPtr
+xpc_LibXML_document_parser( xmlXPathContextPtr ctxt )
+{
+    XPathContextDataPtr data = XPathContextDATA(ctxt);
+
+    if (data->docParser == NULL) {
+        data->docParser = xmlNewParserCtxt();
+        if (data->docParser == NULL)
+            croak("XPathContext: cannot create parser context");
+    }
+    if (data->dict != NULL && data->docParser->dict != data->dict) {
+        xmlDictFree(data->docParser->dict);
+        data->docParser->dict = data->dict;
+        xmlDictReference(data->dict);
+    }
+    return data->docParser;
+}
+
+/* remembers the document loaded for URI until the current query is
+ * finished, so that every document() call asking for it gets the same
+ * document. fresh documents get their perl owner here; afterwards
+ * they live as long as perl refers to them. */
+static xmlNodePtr
+xpc_LibXML_cache_document( xmlXPathContextPtr ctxt, const xmlChar * URI,
+                           xmlNodePtr node, SV * source )
+{
+    XPathContextDataPtr data = XPathContextDATA(ctxt);
+    SV * pdoc;
+    dTHX;
+
+    if (node == NULL)
+        return NULL;
+    if (source != NULL) {
+        pdoc = newSVsv(source);
+    } else {
+        pdoc = xpc_PmmNodeToSv(node, NULL);
+    }
+    if (data->docCache == NULL)
+        data->docCache = newHV();
+    hv_store(data->docCache, (const char *)URI, xmlStrlen(URI), pdoc, 0);
+    return node;
+}
+
+/* turns a catalog entry or a loader result into a document:
+ * XML::LibXML nodes are used as they are, a reference to a scalar
+ * holds the XML text and any other defined scalar is a file name.
+ * existing nodes are passed back in *node, a newly parsed document
+ * is returned (and has no perl owner yet). */
+static xmlDocPtr
+xpc_LibXML_source_to_doc( xmlXPathContextPtr ctxt, SV * source,
+                          const xmlChar * URI, xmlNodePtr * node )
+{
+    STRLEN len;
+    char * buffer;
+    dTHX;
+
+    *node = NULL;
+    if (source == NULL || !SvOK(source)) {
+        return NULL;
+    }
+    if (sv_isobject(source) && sv_derived_from(source, "XML::LibXML::Node")) {
+        *node = xpc_PmmSvNode(source);
+        return NULL;
+    }
+    if (SvROK(source) && SvTYPE(SvRV(source)) < SVt_PVAV) {
+        buffer = SvPV(SvRV(source), len);
+        return xmlCtxtReadMemory(xpc_LibXML_document_parser(ctxt),
+                                 buffer, len, (const char *)URI, NULL,
+                                 XPathContextDATA(ctxt)->docParseOptions);
+    }
+    if (SvROK(source)) {
+        croak("XPathContext: document source for %s is neither a node, a reference to a string nor a file name", URI);
+    }
+    return xpc_domReadDocument(xpc_LibXML_document_parser(ctxt),
+                               SvPV_nolen(source),
+                               XPathContextDATA(ctxt)->docParseOptions);
+}
+
+/* asks the catalog and then the perl loader for URI. returns 0 if
+ * neither of them knows it and it has to be parsed as it is. */
+static int
+xpc_LibXML_resolve_document( xmlXPathContextPtr ctxt,
+                             const xmlChar * URI,
+                             const xmlChar * href,
+                             xmlNodePtr * node )
+{
+    XPathContextDataPtr data;
+    xmlXPathContextPtr copy;
+    xmlDocPtr doc = NULL;
+    SV ** entry = NULL;
+    SV * pdoc;
+    I32 count;
+    NV started;
+    int handled = 0;
+    dTHX;
+    dSP;
+
+    *node = NULL;
+    data = XPathContextDATA(ctxt);
+    if ( data == NULL )
+        croak("XPathContext: missing xpath context private data");
+
+    if (data->docCatalog != NULL) {
+        if (href != NULL)
+            entry = hv_fetch(data->docCatalog, (const char *)href,
+                             xmlStrlen(href), 0);
+        if (entry == NULL)
+            entry = hv_fetch(data->docCatalog, (const char *)URI,
+                             xmlStrlen(URI), 0);
+        if (entry != NULL) {
+            doc = xpc_LibXML_source_to_doc(ctxt, *entry, URI, node);
+            if (doc != NULL) {
+                /* parse once, serve the document from now on */
+                pdoc = xpc_PmmNodeToSv((xmlNodePtr)doc, NULL);
+                sv_setsv(*entry, pdoc);
+                SvREFCNT_dec(pdoc);
+                *node = (xmlNodePtr)doc;
+            }
+            xpc_LibXML_cache_document(ctxt, URI, *node, *entry);
+            return 1;
+        }
+    }
+
+    if (data->docLoader != NULL && SvOK(data->docLoader)) {
+        ENTER;
+        SAVETMPS;
+        PUSHMARK(SP);
+
+        XPUSHs( (data->docLoaderData != NULL) ? data->docLoaderData : &PL_sv_undef );
+        XPUSHs(sv_2mortal(xpc_C2Sv(URI,NULL)));
+        XPUSHs(sv_2mortal(xpc_C2Sv(href,NULL)));
+
+        /* save context to allow recursive usage of XPathContext */
+        copy = xpc_LibXML_save_context(ctxt);
+
+        PUTBACK ;
+        xpc_LibXML_stat_start(data, started);
+        count = perl_call_sv(data->docLoader, G_SCALAR|G_EVAL);
+        xpc_LibXML_stat_stop(data, XPC_STAT_CALLBACK, started);
+        SPAGAIN;
+
+        /* restore the xpath context */
+        xpc_LibXML_restore_context(ctxt, copy);
+
+        if (SvTRUE(ERRSV)) {
+            POPs;
+            croak("XPathContext: error coming back from document loader. %s", SvPV_nolen(ERRSV));
+        }
+        if (count != 1) croak("XPathContext: document loader returned more than one argument!");
+
+        pdoc = POPs;
+        handled = SvOK(pdoc);
+        if (handled) {
+            doc = xpc_LibXML_source_to_doc(ctxt, pdoc, URI, node);
+            if (doc != NULL) {
+                *node = xpc_LibXML_cache_document(ctxt, URI, (xmlNodePtr)doc, NULL);
+            } else {
+                xpc_LibXML_cache_document(ctxt, URI, *node, pdoc);
+            }
+        }
+        PUTBACK;
+        FREETMPS;
+        LEAVE;
+    }
+    return handled;
+}
+
+/* document() loader: serves documents already loaded by this query,
+ * then asks the catalog and the perl loader and finally falls back to
+ * parsing the URI */
+static xmlNodePtr
+xpc_LibXML_load_document( xmlXPathContextPtr ctxt,
+                          const xmlChar * URI,
+                          const xmlChar * href )
+{
+    XPathContextDataPtr data = XPathContextDATA(ctxt);
+    xmlNodePtr node = NULL;
+    SV ** entry;
+    dTHX;
+
+    if (data->docCache != NULL) {
+        entry = hv_fetch(data->docCache, (const char *)URI, xmlStrlen(URI), 0);
+        if (entry != NULL)
+            return xpc_PmmSvNode(*entry);
+    }
+    if (xpc_LibXML_resolve_document(ctxt, URI, href, &node))
+        return node;
+
+    return xpc_LibXML_cache_document(ctxt, URI,
+               (xmlNodePtr)xpc_domReadDocument(xpc_LibXML_document_parser(ctxt),
+                                               (const char *)URI,
+                                               data->docParseOptions),
+               NULL);
+}
+
+/* document() prefetch: resolves all URIs of a nodeset argument and
+ * parses the remaining ones in parallel */
+static void
+xpc_LibXML_prefetch_documents( xmlXPathContextPtr ctxt,
+                               const xmlChar ** URIs,
+                               const xmlChar ** hrefs,
+                               int count )
+{
+    XPathContextDataPtr data = XPathContextDATA(ctxt);
+    const xmlChar ** pending;
+    xmlDocPtr * docs;
+    xmlNodePtr node;
+    int i, npending = 0;
+    dTHX;
+
+    New(0, pending, count, const xmlChar *);
+    for (i = 0; i < count; i++) {
+        if (data->docCache != NULL &&
+            hv_exists(data->docCache, (const char *)URIs[i], xmlStrlen(URIs[i])))
+            continue;
+        if (!xpc_LibXML_resolve_document(ctxt, URIs[i], hrefs[i], &node))
+            pending[npending++] = URIs[i];
+    }
+
+    /* a single document is parsed on demand, failed ones are retried
+     * on demand too, so that their errors are reported */
+    if (npending > 1 && data->docThreads > 1) {
+        New(0, docs, npending, xmlDocPtr);
+        xpc_domReadDocuments(pending, docs, npending,
+                             data->docParseOptions, data->dict,
+                             data->docThreads);
+        for (i = 0; i < npending; i++) {
+            xpc_LibXML_cache_document(ctxt, pending[i], (xmlNodePtr)docs[i], NULL);
+        }
+        Safefree(docs);
+    }
+    Safefree(pending);
+}
+
+static const xpc_DocumentLoader xpc_LibXML_document_loader = {
+    xpc_LibXML_load_document,
+    xpc_LibXML_prefetch_documents
+};
+
+static void
+xpc_LibXML_document_function(xmlXPathParserContextPtr ctxt, int nargs)
+{
+    xpc_domDocumentFunction(ctxt, nargs, &xpc_LibXML_document_loader);
+}
+
+/* ****************************************************************
+ * key()
+ * **************************************************************** */
+
+static xmlXPathCompExprPtr
+xpc_LibXML_compile( xmlXPathContextPtr ctxt, const xmlChar * xpath, int * owned );
+
+/* the index of a key registered with registerKey() for doc, built on
+ * first use in a query */
+static xmlHashTablePtr
+xpc_LibXML_key_index( xmlXPathContextPtr ctxt, const xmlChar * name,
+                      xmlDocPtr doc )
+{
+    XPathContextDataPtr data = XPathContextDATA(ctxt);
+    xmlXPathCompExprPtr match, use;
+    xmlHashTablePtr index = NULL;
+    xpc_KeyIndex * ki;
+    SV ** def = NULL;
+    AV * av;
+    int ownmatch, ownuse;
+    dTHX;
+
+    for (ki = data->keyIndex; ki != NULL; ki = ki->next) {
+        if (ki->doc == doc && xmlStrEqual(ki->name, name))
+            return ki->index;
+    }
+
+    if (data->keys != NULL)
+        def = hv_fetch(data->keys, (const char *)name, xmlStrlen(name), 0);
+    if (def == NULL) {
+        if (data->error != NULL)
+            sv_catpvf(data->error, "XPathContext: unknown key '%s'\n", name);
+        return NULL;
+    }
+    av = (AV *)SvRV(*def);
+
+    match = xpc_LibXML_compile(ctxt,
+                               (const xmlChar *)SvPV_nolen(*av_fetch(av, 0, 0)),
+                               &ownmatch);
+    use   = xpc_LibXML_compile(ctxt,
+                               (const xmlChar *)SvPV_nolen(*av_fetch(av, 1, 0)),
+                               &ownuse);
+    if (match != NULL && use != NULL)
+        index = xpc_domBuildKeyIndex(ctxt, doc, match, use);
+    if (match != NULL && ownmatch)
+        xmlXPathFreeCompExpr(match);
+    if (use != NULL && ownuse)
+        xmlXPathFreeCompExpr(use);
+    if (index == NULL)
+        return NULL;
+
+    Newx(ki, 1, xpc_KeyIndex);
+    ki->name  = xmlStrdup(name);
+    ki->doc   = doc;
+    ki->index = index;
+    ki->next  = data->keyIndex;
+    data->keyIndex = ki;
+    return index;
+}
+
+static void
+xpc_LibXML_key_function(xmlXPathParserContextPtr ctxt, int nargs)
+{
+    xpc_domKeyFunction(ctxt, nargs, xpc_LibXML_key_index);
+}
+
 static void
 xpc_LibXML_configure_namespaces( xmlXPathContextPtr ctxt ) {
     xmlNodePtr node = ctxt->node;
@@ -492,94 +1123,875 @@ xpc_LibXML_configure_xpathcontext( xmlXPathContextPtr ctxt ) {
     }
     ctxt->node = node;
 
+    /* expressions are compiled against the shared dictionary or, if
+       there is none, against the one of the context document */
+    if (XPathContextDATA(ctxt)->dict != NULL) {
+        ctxt->dict = XPathContextDATA(ctxt)->dict;
+    } else if (ctxt->doc != NULL) {
+        ctxt->dict = ctxt->doc->dict;
+    } else {
+        ctxt->dict = NULL;
+    }
+
     xpc_LibXML_configure_namespaces(ctxt);
 }
 
-MODULE = XML::LibXML::XPathContext     PACKAGE = XML::LibXML::XPathContext
+/* ****************************************************************
+ * Shared tables and compiled expressions
+ * **************************************************************** */
 
-PROTOTYPES: DISABLE
+#define XPC_COMPILED_MAX 256
 
-SV*
-new( CLASS, ... )
-        const char * CLASS
-    PREINIT:
-        SV * pnode = &PL_sv_undef;
-    INIT:
-        xmlXPathContextPtr ctxt;
-    CODE:
-        if( items > 1 )
-            pnode = ST(1);
+static xpc_SharedTables *
+xpc_LibXML_new_tables( void )
+{
+    xpc_SharedTables * tables;
 
-        ctxt = xmlXPathNewContext( NULL );
-        ctxt->namespaces = NULL;
+    Newx(tables, 1, xpc_SharedTables);
+    tables->refs      = 1;
+    tables->compiled  = NULL;
+    tables->ncompiled = 0;
+    return tables;
+}
 
-        New(0, ctxt->user, sizeof(XPathContextData), XPathContextData);
-        if (ctxt->user == NULL) {
-            croak("XPathContext: failed to allocate proxy object");
-        } 
+static void
+xpc_LibXML_free_compiled( void * payload, const xmlChar * name )
+{
+    xmlXPathFreeCompExpr((xmlXPathCompExprPtr)payload);
+}
 
-        if (SvOK(pnode)) {
-          XPathContextDATA(ctxt)->node = newSVsv(pnode); 
-        } else {
-          XPathContextDATA(ctxt)->node = &PL_sv_undef;
-        }
+static void
+xpc_LibXML_clear_compiled( xpc_SharedTables * tables )
+{
+    if (tables->compiled != NULL) {
+        xmlHashFree(tables->compiled, xpc_LibXML_free_compiled);
+        tables->compiled  = NULL;
+        tables->ncompiled = 0;
+    }
+}
 
-        XPathContextDATA(ctxt)->pool = NULL;
-        XPathContextDATA(ctxt)->varLookup = NULL;
-        XPathContextDATA(ctxt)->varData = NULL;
+static void *
+xpc_LibXML_copy_ns( void * payload, const xmlChar * name )
+{
+    return xmlStrdup((const xmlChar *)payload);
+}
 
-        xmlXPathRegisterFunc(ctxt,
-                             (const xmlChar *) "document",
-                             xpc_perlDocumentFunction);
+static void *
+xpc_LibXML_copy_func( void * payload, const xmlChar * name )
+{
+    return payload;
+}
 
-        RETVAL = NEWSV(0,0),
-        RETVAL = sv_setref_pv( RETVAL,
-                               CLASS,
-                               (void*)ctxt );
-    OUTPUT:
-        RETVAL
+/* gives the context tables of its own before they are changed; if
+ * functions change, expressions compiled before may have looked up
+ * the old ones */
+static void
+xpc_LibXML_unshare_tables( xmlXPathContextPtr ctxt, int functions )
+{
+    XPathContextDataPtr data = XPathContextDATA(ctxt);
+
+    if (data->tables->refs > 1) {
+        if (ctxt->nsHash != NULL)
+            ctxt->nsHash = xmlHashCopy(ctxt->nsHash, xpc_LibXML_copy_ns);
+        if (ctxt->funcHash != NULL)
+            ctxt->funcHash = xmlHashCopy(ctxt->funcHash, xpc_LibXML_copy_func);
+        data->tables->refs--;
+        data->tables = xpc_LibXML_new_tables();
+    }
+    else if (functions) {
+        xpc_LibXML_clear_compiled(data->tables);
+    }
+}
 
-void
-DESTROY( self )
-        SV * self
-    INIT:
-        xmlXPathContextPtr ctxt = (xmlXPathContextPtr)SvIV(SvRV(self)); 
-    CODE:
-        xs_warn( "DESTROY XPATH CONTEXT" );
-        if (ctxt) {
-            if (XPathContextDATA(ctxt) != NULL) {
-                if (XPathContextDATA(ctxt)->node != NULL &&
-                    SvOK(XPathContextDATA(ctxt)->node)) {
-                    SvREFCNT_dec(XPathContextDATA(ctxt)->node);
-                }
-                if (XPathContextDATA(ctxt)->varLookup != NULL &&
-                    SvOK(XPathContextDATA(ctxt)->varLookup)) {
-                    SvREFCNT_dec(XPathContextDATA(ctxt)->varLookup);
-                }
-                if (XPathContextDATA(ctxt)->varData != NULL &&
-                    SvOK(XPathContextDATA(ctxt)->varData)) {
-                    SvREFCNT_dec(XPathContextDATA(ctxt)->varData);
-                }
-                if (XPathContextDATA(ctxt)->pool != NULL &&
-                    SvOK(XPathContextDATA(ctxt)->pool)) {
-                    SvREFCNT_dec((SV *)XPathContextDATA(ctxt)->pool);
-                }
-                Safefree(XPathContextDATA(ctxt));
-            }
+/* drops the context's share of the tables; the last one frees them */
+static void
+xpc_LibXML_release_tables( xmlXPathContextPtr ctxt )
+{
+    XPathContextDataPtr data = XPathContextDATA(ctxt);
 
-            if (ctxt->namespaces != NULL) {
-                xmlFree( ctxt->namespaces );
-            }
-            if (ctxt->funcLookupData != NULL && SvROK((SV*)ctxt->funcLookupData)
-                && SvTYPE(SvRV((SV *)ctxt->funcLookupData)) == SVt_PVHV) {
-                SvREFCNT_dec((SV *)ctxt->funcLookupData);
-            }
-            
-            xmlXPathFreeContext(ctxt);
-        }
+    if (data->tables->refs > 1) {
+        /* keep xmlXPathFreeContext() from freeing them */
+        ctxt->nsHash   = NULL;
+        ctxt->funcHash = NULL;
+        data->tables->refs--;
+    }
+    else {
+        xpc_LibXML_clear_compiled(data->tables);
+        Safefree(data->tables);
+    }
+    data->tables = NULL;
+}
 
-SV*
-getContextNode( self )
+/* looks xpath up among the expressions compiled for the context's
+ * tables, compiling and adding it if it is not there. *owned tells if
+ * the caller has to free the expression, which is the case if the
+ * cache is full or disabled. cached expressions are compiled without
+ * the in-scope namespaces of the context node, which are looked up
+ * when they are evaluated, and against the shared dictionary only. */
+static xmlXPathCompExprPtr
+xpc_LibXML_compile( xmlXPathContextPtr ctxt, const xmlChar * xpath, int * owned )
+{
+    XPathContextDataPtr data = XPathContextDATA(ctxt);
+    xpc_SharedTables * tables = data->tables;
+    xmlXPathCompExprPtr comp;
+    xmlNsPtr * namespaces;
+    xmlDictPtr dict;
+    int nsNr;
+
+    *owned = 1;
+    if (data->compiledMax > 0 && tables->compiled != NULL) {
+        comp = (xmlXPathCompExprPtr)xmlHashLookup(tables->compiled, xpath);
+        if (comp != NULL) {
+            if (data->stats != NULL)
+                data->stats->compileHits++;
+            *owned = 0;
+            return comp;
+        }
+    }
+    if (data->stats != NULL)
+        data->stats->compileMisses++;
+    if (data->compiledMax <= 0)
+        return xmlXPathCtxtCompile(ctxt, xpath);
+
+    namespaces = ctxt->namespaces;
+    nsNr       = ctxt->nsNr;
+    dict       = ctxt->dict;
+    ctxt->namespaces = NULL;
+    ctxt->nsNr       = 0;
+    ctxt->dict       = data->dict;
+    comp = xmlXPathCtxtCompile(ctxt, xpath);
+    ctxt->namespaces = namespaces;
+    ctxt->nsNr       = nsNr;
+    ctxt->dict       = dict;
+
+    if (comp == NULL || tables->ncompiled >= data->compiledMax)
+        return comp;
+    if (tables->compiled == NULL) {
+        tables->compiled = xmlHashCreate(16);
+        if (tables->compiled == NULL)
+            return comp;
+    }
+    if (xmlHashAddEntry(tables->compiled, xpath, comp) == 0) {
+        tables->ncompiled++;
+        *owned = 0;
+    }
+    return comp;
+}
+
+/* attribute value indexes are used for the pairs given to
+ * indexAttribute(), marked with -1, and for those asked for as often as
+ * the threshold says; number indexes only for those given to
+ * indexNumbers(), kept as elem@attr#n */
+static int
+xpc_LibXML_attribute_hot( xmlXPathContextPtr ctxt, const xmlChar * elem,
+                          const xmlChar * attr, int numbers )
+{
+    XPathContextDataPtr data = XPathContextDATA(ctxt);
+    xmlChar * pair;
+    IV count;
+
+    if ( data->attrIndex == NULL ) {
+        if ( data->attrThreshold <= 0 )
+            return 0;
+        data->attrIndex = xmlHashCreate(8);
+        if ( data->attrIndex == NULL )
+            return 0;
+    }
+    pair = xmlStrdup(elem);
+    pair = xmlStrcat(pair, (const xmlChar *)"@");
+    pair = xmlStrcat(pair, attr);
+    if ( numbers ) {
+        pair = xmlStrcat(pair, (const xmlChar *)"#n");
+        count = PTR2IV(xmlHashLookup(data->attrIndex, pair));
+        xmlFree(pair);
+        return count < 0;
+    }
+    count = PTR2IV(xmlHashLookup(data->attrIndex, pair));
+    if ( count >= 0 && data->attrThreshold > 0 ) {
+        count++;
+        xmlHashUpdateEntry(data->attrIndex, pair, INT2PTR(void *, count), NULL);
+    }
+    xmlFree(pair);
+    return count < 0 || (data->attrThreshold > 0 && count >= data->attrThreshold);
+}
+
+static void
+xpc_LibXML_clear_order(pTHX_ void * node)
+{
+    xpc_domNodeClearOrder( (xmlNodePtr)node );
+}
+
+/* numbers the elements of the tree of the context node for a query,
+ * checking the indexes of its document on the way. the numbers are
+ * removed again when the query's error scope is left, even if the
+ * query croaks, so this has to be called within it. */
+static void
+xpc_LibXML_number_order( pTHX_ xmlXPathContextPtr ctxt )
+{
+    if ( ctxt->node->doc ) {
+        xpc_domNodeNormalizeOrder( ctxt->node, &XPathContextDATA(ctxt)->indexes );
+    }
+    else {
+        xpc_domNodeNormalizeOrder( xpc_PmmOWNER(xpc_PmmNewNode(ctxt->node)), NULL );
+    }
+    SAVEDESTRUCTOR_X(xpc_LibXML_clear_order, ctxt->node);
+}
+
+/* evaluates xpath for the context node, splitting a descendant scan
+ * over several threads if enabled and possible */
+static xmlXPathObjectPtr
+xpc_LibXML_find( xmlXPathContextPtr ctxt, const xmlChar * xpath )
+{
+    XPathContextDataPtr data = XPathContextDATA(ctxt);
+    xmlXPathCompExprPtr comp;
+    xmlXPathObjectPtr res;
+    int owned;
+    NV started;
+
+    /* statements answered from an index or scanned in parallel count
+       as evaluated without being compiled */
+    if ( data->nameIndex || data->attrIndex != NULL || data->attrThreshold > 0 ) {
+        int handled = 0;
+        xpc_LibXML_stat_start(data, started);
+        res = xpc_domXPathFindIndexed( ctxt, xpath, &data->indexes,
+                                       data->nameIndex,
+                                       xpc_LibXML_attribute_hot, &handled );
+        if ( handled ) {
+            xpc_LibXML_stat_stop(data, XPC_STAT_EVAL, started);
+            return res;
+        }
+    }
+
+    if ( data->parallelScan && data->queryThreads > 1 ) {
+        int handled = 0;
+        xpc_LibXML_stat_start(data, started);
+        res = xpc_domXPathScanParallel( ctxt, xpath, data->queryThreads,
+                                        &handled );
+        if ( handled ) {
+            xpc_LibXML_stat_stop(data, XPC_STAT_EVAL, started);
+            return res;
+        }
+    }
+
+    xpc_LibXML_stat_start(data, started);
+    comp = xpc_LibXML_compile( ctxt, xpath, &owned );
+    xpc_LibXML_stat_stop(data, XPC_STAT_COMPILE, started);
+    if ( comp == NULL )
+        return NULL;
+    xpc_LibXML_stat_start(data, started);
+    res = xpc_domXPathFindCompiled( ctxt, comp, &data->shadowDoc );
+    xpc_LibXML_stat_stop(data, XPC_STAT_EVAL, started);
+    if ( owned )
+        xmlXPathFreeCompExpr( comp );
+    return res;
+}
+
+/* a query result as an array of its type and values, the way _find
+ * puts them on the stack */
+static SV *
+xpc_LibXML_result_to_sv( pTHX_ xmlXPathObjectPtr found )
+{
+    AV * av = newAV();
+    xmlNodeSetPtr nodelist;
+    xmlNodePtr tnode;
+    int i;
+
+    switch (found->type) {
+        case XPATH_NODESET:
+            av_push(av, newSVpv("XML::LibXML::NodeList", 0));
+            nodelist = found->nodesetval;
+            if ( nodelist != NULL ) {
+                for ( i = 0; i < nodelist->nodeNr; i++ ) {
+                    tnode = nodelist->nodeTab[i];
+                    if (tnode->type == XML_NAMESPACE_DECL) {
+                        xmlNsPtr newns = xmlCopyNamespace((xmlNsPtr)tnode);
+                        if ( newns != NULL ) {
+                            av_push(av, sv_setref_pv(NEWSV(0,0),
+                                        xpc_PmmNodeTypeName( tnode ),
+                                        (void*)newns));
+                        }
+                    }
+                    else {
+                        av_push(av, xpc_PmmNodeToSv(tnode,
+                                        xpc_LibXML_node_owner(tnode)));
+                    }
+                }
+            }
+            /* prevent libxml2 from freeing the actual nodes */
+            if (found->boolval) found->boolval=0;
+            break;
+        case XPATH_BOOLEAN:
+            av_push(av, newSVpv("XML::LibXML::Boolean", 0));
+            av_push(av, newSViv(found->boolval));
+            break;
+        case XPATH_NUMBER:
+            av_push(av, newSVpv("XML::LibXML::Number", 0));
+            av_push(av, newSVnv(found->floatval));
+            break;
+        case XPATH_STRING:
+            av_push(av, newSVpv("XML::LibXML::Literal", 0));
+            av_push(av, xpc_C2Sv(found->stringval, NULL));
+            break;
+        default:
+            SvREFCNT_dec((SV*)av);
+            croak("Unknown XPath return type");
+    }
+    return newRV_noinc((SV*)av);
+}
+
+/* feeds xmlReaderForIO() from a perl filehandle */
+static int
+xpc_LibXML_read_perlio( void * context, char * buffer, int len )
+{
+    dTHX;
+    return (int)PerlIO_read((PerlIO *)context, buffer, len);
+}
+
+/* what the perl objects a query made live on; dropped after every
+ * query */
+static void
+xpc_LibXML_free_node_pool( XPathContextDataPtr data )
+{
+    dTHX;
+
+    if (data->pool != NULL) {
+        if (data->stats != NULL) {
+            UV used = HvKEYS(data->pool);
+            data->stats->poolNodes += used;
+            if (used > data->stats->poolPeak)
+                data->stats->poolPeak = used;
+        }
+        SvREFCNT_dec((SV *)data->pool);
+        data->pool = NULL;
+    }
+    if (data->docCache != NULL) {
+        SvREFCNT_dec((SV *)data->docCache);
+        data->docCache = NULL;
+    }
+    xpc_LibXML_free_key_indexes(data);
+}
+
+/* opens a file name or a perl filehandle for streaming */
+static xmlTextReaderPtr
+xpc_LibXML_stream_reader( pTHX_ SV * source, int options )
+{
+    if (SvROK(source) && (SvTYPE(SvRV(source)) == SVt_PVGV
+                          || SvTYPE(SvRV(source)) == SVt_PVIO)) {
+        IO * io = sv_2io(source);
+        if (io == NULL || IoIFP(io) == NULL)
+            return NULL;
+        return xmlReaderForIO(xpc_LibXML_read_perlio, NULL, IoIFP(io),
+                              NULL, NULL, options);
+    }
+    return xmlReaderForFile(SvPV_nolen(source), NULL, options);
+}
+
+struct _xpc_StreamMatch {
+    SV * callback;
+    int failed;
+    xmlXPathContextPtr ctxt;
+    xmlXPathCompExprPtr * comps;  /* evaluated for every record */
+    int ncomps;
+};
+typedef struct _xpc_StreamMatch xpc_StreamMatch;
+
+/* hands a copy of the matching subtree, as the root of a document of
+ * its own, to the callback, followed by the results of the expressions
+ * of a record scan for it; the reader frees the original as it moves
+ * on, so the callback may keep what it is given */
+static int
+xpc_LibXML_stream_match( xmlNodePtr node, void * data )
+{
+    xpc_StreamMatch * match = (xpc_StreamMatch *)data;
+    xmlXPathContextPtr ctxt = match->ctxt;
+    xmlXPathObjectPtr found;
+    xmlNodePtr oldnode = ctxt->node;
+    xmlDocPtr olddoc = ctxt->doc;
+    xmlDocPtr doc;
+    xmlNodePtr copy;
+    SV * pdoc;
+    int i;
+    dTHX;
+    dSP;
+
+    doc = xmlNewDoc((const xmlChar *)"1.0");
+    if (doc == NULL)
+        return 1;
+    copy = xmlDocCopyNode(node, doc, 1);
+    if (copy == NULL) {
+        xmlFreeDoc(doc);
+        return 1;
+    }
+    xmlDocSetRootElement(doc, copy);
+    pdoc = xpc_PmmNodeToSv((xmlNodePtr)doc, NULL);
+
+    ENTER;
+    SAVETMPS;
+    PUSHMARK(SP);
+    XPUSHs(sv_2mortal(xpc_PmmNodeToSv(copy, xpc_PmmPROXYNODE(doc))));
+    if (match->ncomps > 0) {
+        ctxt->node = copy;
+        ctxt->doc  = doc;
+        xpc_domNodeNormalizeOrder(copy, NULL);
+        for (i = 0; i < match->ncomps; i++) {
+            PUTBACK;
+            found = xpc_domXPathFindCompiled(ctxt, match->comps[i],
+                                             &XPathContextDATA(ctxt)->shadowDoc);
+            SPAGAIN;
+            if (found == NULL || SvCUR(XPathContextDATA(ctxt)->error) > 0) {
+                xmlXPathFreeObject(found);
+                match->failed = 1;
+                break;
+            }
+            XPUSHs(sv_2mortal(xpc_LibXML_result_to_sv(aTHX_ found)));
+            xmlXPathFreeObject(found);
+        }
+        xpc_domNodeClearOrder(copy);
+        ctxt->node = oldnode;
+        ctxt->doc  = olddoc;
+    }
+    PUTBACK;
+    if (!match->failed)
+        perl_call_sv(match->callback, G_DISCARD|G_EVAL);
+    FREETMPS;
+    LEAVE;
+    SvREFCNT_dec(pdoc);
+    if (match->ncomps > 0)
+        xpc_LibXML_free_node_pool(XPathContextDATA(ctxt));
+
+    if (match->failed || SvTRUE(ERRSV)) {
+        match->failed = 1;
+        return 1;
+    }
+    return 0;
+}
+
+/* xmlOutputBuffer writers appending to an SV or printing to a perl
+ * filehandle */
+static int
+xpc_LibXML_write_sv( void * context, const char * buffer, int len )
+{
+    dTHX;
+    sv_catpvn((SV *)context, buffer, len);
+    return len;
+}
+
+static int
+xpc_LibXML_write_perlio( void * context, const char * buffer, int len )
+{
+    dTHX;
+    return (int)PerlIO_write((PerlIO *)context, buffer, len);
+}
+
+/* writes a row of an export, stopping at the first error reported */
+static int
+xpc_LibXML_export_row( xmlNodePtr row, void * data )
+{
+    xpc_Export * export = (xpc_Export *)data;
+    dTHX;
+
+    if (xpc_domExportRow(row, export) != 0)
+        return 1;
+    return SvCUR(XPathContextDATA(export->ctxt)->error) > 0;
+}
+
+/* a push stream with the perl side of it */
+struct _xpc_LibXML_PushStream {
+    xpc_PushStream * stream;
+    SV * context;    /* the XPathContext, kept while the stream lives */
+    AV * callbacks;  /* one per pattern */
+    int finished;
+};
+typedef struct _xpc_LibXML_PushStream xpc_LibXML_PushStream;
+
+static int
+xpc_LibXML_push_match( xmlNodePtr node, int pattern, void * data )
+{
+    xpc_LibXML_PushStream * push = (xpc_LibXML_PushStream *)data;
+    xpc_StreamMatch match;
+    SV ** callback;
+    dTHX;
+
+    callback = av_fetch(push->callbacks, pattern, 0);
+    if (callback == NULL)
+        return 0;
+    match.callback = *callback;
+    match.failed   = 0;
+    match.ctxt     = (xmlXPathContextPtr)SvIV(SvRV(push->context));
+    match.comps    = NULL;
+    match.ncomps   = 0;
+    return xpc_LibXML_stream_match(node, &match);
+}
+
+MODULE = XML::LibXML::XPathContext     PACKAGE = XML::LibXML::XPathContext
+
+PROTOTYPES: DISABLE
+
+SV*
+new( CLASS, ... )
+        const char * CLASS
+    PREINIT:
+        SV * pnode = &PL_sv_undef;
+    INIT:
+        xmlXPathContextPtr ctxt;
+    CODE:
+        if( items > 1 )
+            pnode = ST(1);
+
+        ctxt = xmlXPathNewContext( NULL );
+        ctxt->namespaces = NULL;
+
+        New(0, ctxt->user, sizeof(XPathContextData), XPathContextData);
+        if (ctxt->user == NULL) {
+            croak("XPathContext: failed to allocate proxy object");
+        } 
+
+        if (SvOK(pnode)) {
+          XPathContextDATA(ctxt)->node = newSVsv(pnode); 
+        } else {
+          XPathContextDATA(ctxt)->node = &PL_sv_undef;
+        }
+
+        XPathContextDATA(ctxt)->pool = NULL;
+        XPathContextDATA(ctxt)->varLookup = NULL;
+        XPathContextDATA(ctxt)->varData = NULL;
+        XPathContextDATA(ctxt)->docLoader = NULL;
+        XPathContextDATA(ctxt)->docLoaderData = NULL;
+        XPathContextDATA(ctxt)->docCatalog = NULL;
+        XPathContextDATA(ctxt)->docCache = NULL;
+        XPathContextDATA(ctxt)->docParser = NULL;
+        XPathContextDATA(ctxt)->docParseOptions = 0;
+        XPathContextDATA(ctxt)->docThreads = 1;
+        XPathContextDATA(ctxt)->queryThreads = xpc_domDefaultThreads();
+        XPathContextDATA(ctxt)->parallelScan = 0;
+        XPathContextDATA(ctxt)->nameIndex = 0;
+        XPathContextDATA(ctxt)->attrIndex = NULL;
+        XPathContextDATA(ctxt)->attrThreshold = 0;
+        XPathContextDATA(ctxt)->tables = xpc_LibXML_new_tables();
+        XPathContextDATA(ctxt)->compiledMax = XPC_COMPILED_MAX;
+        XPathContextDATA(ctxt)->dict = NULL;
+        XPathContextDATA(ctxt)->shadowDoc = NULL;
+        XPathContextDATA(ctxt)->keys = NULL;
+        XPathContextDATA(ctxt)->keyIndex = NULL;
+        XPathContextDATA(ctxt)->stats = NULL;
+        XPathContextDATA(ctxt)->indexes = NULL;
+        XPathContextDATA(ctxt)->error = NULL;
+
+        xmlXPathRegisterFunc(ctxt,
+                             (const xmlChar *) "document",
+                             xpc_LibXML_document_function);
+
+        RETVAL = NEWSV(0,0),
+        RETVAL = sv_setref_pv( RETVAL,
+                               CLASS,
+                               (void*)ctxt );
+    OUTPUT:
+        RETVAL
+
+void
+DESTROY( self )
+        SV * self
+    INIT:
+        xmlXPathContextPtr ctxt = (xmlXPathContextPtr)SvIV(SvRV(self)); 
+    CODE:
+        xs_warn( "DESTROY XPATH CONTEXT" );
+        if (ctxt) {
+            if (XPathContextDATA(ctxt) != NULL) {
+                if (XPathContextDATA(ctxt)->node != NULL &&
+                    SvOK(XPathContextDATA(ctxt)->node)) {
+                    SvREFCNT_dec(XPathContextDATA(ctxt)->node);
+                }
+                if (XPathContextDATA(ctxt)->varLookup != NULL &&
+                    SvOK(XPathContextDATA(ctxt)->varLookup)) {
+                    SvREFCNT_dec(XPathContextDATA(ctxt)->varLookup);
+                }
+                if (XPathContextDATA(ctxt)->varData != NULL &&
+                    SvOK(XPathContextDATA(ctxt)->varData)) {
+                    SvREFCNT_dec(XPathContextDATA(ctxt)->varData);
+                }
+                if (XPathContextDATA(ctxt)->pool != NULL &&
+                    SvOK(XPathContextDATA(ctxt)->pool)) {
+                    SvREFCNT_dec((SV *)XPathContextDATA(ctxt)->pool);
+                }
+                if (XPathContextDATA(ctxt)->docLoader != NULL &&
+                    SvOK(XPathContextDATA(ctxt)->docLoader)) {
+                    SvREFCNT_dec(XPathContextDATA(ctxt)->docLoader);
+                }
+                if (XPathContextDATA(ctxt)->docLoaderData != NULL &&
+                    SvOK(XPathContextDATA(ctxt)->docLoaderData)) {
+                    SvREFCNT_dec(XPathContextDATA(ctxt)->docLoaderData);
+                }
+                if (XPathContextDATA(ctxt)->docCatalog != NULL) {
+                    SvREFCNT_dec((SV *)XPathContextDATA(ctxt)->docCatalog);
+                }
+                if (XPathContextDATA(ctxt)->docCache != NULL) {
+                    SvREFCNT_dec((SV *)XPathContextDATA(ctxt)->docCache);
+                }
+                if (XPathContextDATA(ctxt)->docParser != NULL) {
+                    xmlFreeParserCtxt(XPathContextDATA(ctxt)->docParser);
+                }
+                if (XPathContextDATA(ctxt)->dict != NULL) {
+                    xmlDictFree(XPathContextDATA(ctxt)->dict);
+                }
+                if (XPathContextDATA(ctxt)->shadowDoc != NULL) {
+                    /* never free a fragment left linked to it */
+                    xpc_domXPathUnshadow(XPathContextDATA(ctxt)->shadowDoc, NULL);
+                }
+                if (XPathContextDATA(ctxt)->keys != NULL) {
+                    SvREFCNT_dec((SV *)XPathContextDATA(ctxt)->keys);
+                }
+                xpc_LibXML_free_key_indexes(XPathContextDATA(ctxt));
+                if (XPathContextDATA(ctxt)->attrIndex != NULL) {
+                    xmlHashFree(XPathContextDATA(ctxt)->attrIndex, NULL);
+                }
+                if (XPathContextDATA(ctxt)->stats != NULL) {
+                    Safefree(XPathContextDATA(ctxt)->stats);
+                }
+                xpc_domIndexDropAll(&XPathContextDATA(ctxt)->indexes);
+                xpc_LibXML_release_tables(ctxt);
+                Safefree(XPathContextDATA(ctxt));
+            }
+
+            if (ctxt->namespaces != NULL) {
+                xmlFree( ctxt->namespaces );
+            }
+            ctxt->dict = NULL;
+            if (ctxt->funcLookupData != NULL && SvROK((SV*)ctxt->funcLookupData)
+                && SvTYPE(SvRV((SV *)ctxt->funcLookupData)) == SVt_PVHV) {
+                SvREFCNT_dec((SV *)ctxt->funcLookupData);
+            }
+            
+            xmlXPathFreeContext(ctxt);
+        }
+
+SV*
+clone( self, ... )
+        SV * self
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+        xmlXPathContextPtr copy = NULL;
+        XPathContextDataPtr data = NULL;
+        XPathContextDataPtr cdata = NULL;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(self));
+        if ( ctxt == NULL ) {
+            croak("XPathContext: missing xpath context");
+        }
+        data = XPathContextDATA(ctxt);
+    CODE:
+        copy = xmlXPathNewContext( NULL );
+        if ( copy == NULL ) {
+            croak("XPathContext: cannot create xpath context");
+        }
+        copy->namespaces = NULL;
+        New(0, copy->user, sizeof(XPathContextData), XPathContextData);
+        if (copy->user == NULL) {
+            croak("XPathContext: failed to allocate proxy object");
+        } 
+        cdata = XPathContextDATA(copy);
+        Copy(data, cdata, 1, XPathContextData);
+
+        /* the clone's own */
+        if (items > 1 && SvOK(ST(1))) {
+            cdata->node = newSVsv(ST(1));
+        } else if (SvOK(data->node)) {
+            cdata->node = newSVsv(data->node);
+        } else {
+            cdata->node = &PL_sv_undef;
+        }
+        cdata->pool      = NULL;
+        cdata->docCache  = NULL;
+        cdata->docParser = NULL;
+        cdata->shadowDoc = NULL;
+        cdata->keyIndex  = NULL;
+        cdata->stats     = NULL;
+        cdata->indexes   = NULL;
+        cdata->error     = NULL;
+        copy->contextSize       = ctxt->contextSize;
+        copy->proximityPosition = ctxt->proximityPosition;
+
+        /* shared with the original */
+        if (data->varLookup != NULL) {
+            cdata->varLookup = newSVsv(data->varLookup);
+            xmlXPathRegisterVariableLookup(copy,
+                                           xpc_LibXML_generic_variable_lookup, copy);
+        }
+        if (data->varData != NULL)
+            cdata->varData = newSVsv(data->varData);
+        if (data->docLoader != NULL)
+            cdata->docLoader = newSVsv(data->docLoader);
+        if (data->docLoaderData != NULL)
+            cdata->docLoaderData = newSVsv(data->docLoaderData);
+        if (data->docCatalog != NULL)
+            cdata->docCatalog = newHVhv(data->docCatalog);
+        if (data->keys != NULL)
+            cdata->keys = newHVhv(data->keys);
+        if (data->attrIndex != NULL)
+            cdata->attrIndex = xmlHashCopy(data->attrIndex, xpc_LibXML_copy_func);
+        if (data->dict != NULL)
+            xmlDictReference(data->dict);
+        if (ctxt->funcLookupData != NULL)
+            copy->funcLookupData = newSVsv((SV *)ctxt->funcLookupData);
+
+        /* the tables until one of the two changes them */
+        if (copy->nsHash != NULL)
+            xmlHashFree(copy->nsHash, xmlHashDefaultDeallocator);
+        if (copy->funcHash != NULL)
+            xmlHashFree(copy->funcHash, NULL);
+        copy->nsHash   = ctxt->nsHash;
+        copy->funcHash = ctxt->funcHash;
+        data->tables->refs++;
+
+        RETVAL = NEWSV(0,0);
+        RETVAL = sv_setref_pv( RETVAL,
+                               sv_reftype(SvRV(self), TRUE),
+                               (void*)copy );
+    OUTPUT:
+        RETVAL
+
+SV*
+_explain( pxpath_context, perl_xpath )
+        SV * pxpath_context
+        SV * perl_xpath
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+        xmlXPathCompExprPtr comp = NULL;
+        const xmlChar * xpath = NULL;
+        xmlChar * dump = NULL;
+        int owned = 0;
+        int compOwned = 0;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL ) {
+            croak("XPathContext: missing xpath context");
+        }
+        xpc_LibXML_configure_xpathcontext(ctxt);
+        xpath = nodexpc_Sv2CBorrow(perl_xpath, ctxt->node, &owned);
+        if ( !(xpath && xmlStrlen(xpath)) ) {
+            if ( owned )
+                xmlFree((xmlChar *)xpath);
+            croak("XPathContext: empty XPath found");
+        }
+    CODE:
+        /* the expression as the queries use it, cached or not */
+        xpc_LibXML_init_error(ctxt);
+        comp = xpc_LibXML_compile( ctxt, xpath, &compOwned );
+        if ( owned )
+            xmlFree((xmlChar *)xpath);
+        if ( comp != NULL ) {
+            dump = xpc_domXPathDump( comp );
+            if ( compOwned )
+                xmlXPathFreeCompExpr( comp );
+        }
+        xpc_LibXML_croak_error(ctxt);
+        if ( comp == NULL ) {
+            croak("XPathContext: cannot compile XPath");
+        }
+        if ( dump == NULL ) {
+            croak("XPathContext: libxml2 was built without debugging support");
+        }
+        RETVAL = newSVpv((const char *)dump, 0);
+        xmlFree( dump );
+    OUTPUT:
+        RETVAL
+
+void
+setCompiledCache( pxpath_context, size )
+        SV * pxpath_context
+        int size
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL )
+            croak("XPathContext: missing xpath context");
+    PPCODE:
+        XPathContextDATA(ctxt)->compiledMax = size > 0 ? size : 0;
+        if (size <= 0 && XPathContextDATA(ctxt)->tables->refs == 1)
+            xpc_LibXML_clear_compiled(XPathContextDATA(ctxt)->tables);
+
+void
+setStats( pxpath_context, enable )
+        SV * pxpath_context
+        int enable
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+        XPathContextDataPtr data = NULL;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL )
+            croak("XPathContext: missing xpath context");
+        data = XPathContextDATA(ctxt);
+    PPCODE:
+        if ( enable && data->stats == NULL ) {
+            Newz(0, data->stats, 1, xpc_Stats);
+        }
+        else if ( !enable && data->stats != NULL ) {
+            Safefree(data->stats);
+            data->stats = NULL;
+        }
+
+void
+reset_stats( pxpath_context )
+        SV * pxpath_context
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL )
+            croak("XPathContext: missing xpath context");
+    PPCODE:
+        if ( XPathContextDATA(ctxt)->stats != NULL )
+            Zero(XPathContextDATA(ctxt)->stats, 1, xpc_Stats);
+
+SV*
+stats( pxpath_context )
+        SV * pxpath_context
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+        xpc_Stats * stats = NULL;
+        xpc_Stats none;
+        HV * hv;
+        HV * phases;
+        HV * phase;
+        int i;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL )
+            croak("XPathContext: missing xpath context");
+        stats = XPathContextDATA(ctxt)->stats;
+    CODE:
+        if ( stats == NULL ) {
+            Zero(&none, 1, xpc_Stats);
+        }
+        hv = newHV();
+        hv_store(hv, "enabled", 7, newSViv(stats != NULL), 0);
+        if ( stats == NULL )
+            stats = &none;
+        hv_store(hv, "queries", 7, newSVuv(stats->queries), 0);
+        hv_store(hv, "nodes", 5, newSVuv(stats->nodes), 0);
+        hv_store(hv, "proxies_created", 15, newSVuv(stats->proxies), 0);
+        hv_store(hv, "compile_cache_hits", 18, newSVuv(stats->compileHits), 0);
+        hv_store(hv, "compile_cache_misses", 20,
+                 newSVuv(stats->compileMisses), 0);
+        hv_store(hv, "pool_nodes", 10, newSVuv(stats->poolNodes), 0);
+        hv_store(hv, "pool_peak", 9, newSVuv(stats->poolPeak), 0);
+        phases = newHV();
+        for ( i = 0; i < XPC_STAT_PHASES; i++ ) {
+            phase = newHV();
+            hv_store(phase, "count", 5, newSVuv(stats->calls[i]), 0);
+            hv_store(phase, "seconds", 7, newSVnv(stats->nanos[i] / 1e9), 0);
+            hv_store(phases, xpc_LibXML_stat_names[i],
+                     strlen(xpc_LibXML_stat_names[i]),
+                     newRV_noinc((SV *)phase), 0);
+        }
+        hv_store(hv, "phases", 6, newRV_noinc((SV *)phases), 0);
+        RETVAL = newRV_noinc((SV *)hv);
+    OUTPUT:
+        RETVAL
+
+SV*
+getContextNode( self )
         SV * self
     INIT:
         xmlXPathContextPtr ctxt = (xmlXPathContextPtr)SvIV(SvRV(self)); 
@@ -686,6 +2098,7 @@ registerNs( pxpath_context, prefix, ns_uri )
             croak("XPathContext: missing xpath context");
         }
         xpc_LibXML_configure_xpathcontext(ctxt);
+        xpc_LibXML_unshare_tables(ctxt, 0);
     PPCODE:
         if(SvOK(ns_uri)) {
             if(xmlXPathRegisterNs(ctxt, SvPV_nolen(prefix),
@@ -811,11 +2224,12 @@ registerFunctionNS( pxpath_context, name, uri, func)
             croak("XPathContext: missing xpath context");
         }
         xpc_LibXML_configure_xpathcontext(ctxt);
+        xpc_LibXML_unshare_tables(ctxt, 1);
         if ( !SvOK(func) || SvOK(func) && 
              ((SvROK(func) && SvTYPE(SvRV(func)) == SVt_PVCV ) || SvPOK(func))) {
             if (ctxt->funcLookupData == NULL) {
                 if (SvOK(func)) {
-                    pfdr = newRV_inc((SV*) newHV());
+                    pfdr = newRV_noinc((SV*) newHV());
                     ctxt->funcLookupData = pfdr;
                 } else {
                     /* looks like no perl function was never registered, */
@@ -827,6 +2241,12 @@ registerFunctionNS( pxpath_context, name, uri, func)
                 if (SvTYPE(SvRV((SV *)ctxt->funcLookupData)) == SVt_PVHV) {
                     /* good, it's a HV */
                     pfdr = (SV *)ctxt->funcLookupData;
+                    if (SvREFCNT(SvRV(pfdr)) > 1) {
+                        /* shared with a clone */
+                        pfdr = newRV_noinc((SV*) newHVhv((HV *)SvRV(pfdr)));
+                        SvREFCNT_dec((SV *)ctxt->funcLookupData);
+                        ctxt->funcLookupData = pfdr;
+                    }
                 } else {
                     croak ("XPathContext: cannot register: funcLookupData structure occupied");
                 }
@@ -862,20 +2282,336 @@ registerFunctionNS( pxpath_context, name, uri, func)
         }
 
 void
-_free_node_pool( pxpath_context )
+registerKey( pxpath_context, name, match, use )
         SV * pxpath_context
+        SV * name
+        SV * match
+        SV * use
     PREINIT:
         xmlXPathContextPtr ctxt = NULL;
+        XPathContextDataPtr data = NULL;
+        xmlChar * key = NULL;
+        xmlChar * str = NULL;
+        AV * def = NULL;
     INIT:
         ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
         if ( ctxt == NULL ) {
             croak("XPathContext: missing xpath context");
         }
+        data = XPathContextDATA(ctxt);
+        if ( !SvOK(name) ) {
+            croak("XPathContext: key name required");
+        }
+        if ( SvOK(match) && !SvOK(use) ) {
+            croak("XPathContext: use expression required");
+        }
     PPCODE:
-        if (XPathContextDATA(ctxt)->pool != NULL) {
-            SvREFCNT_dec((SV *)XPathContextDATA(ctxt)->pool);
-            XPathContextDATA(ctxt)->pool = NULL;
+        xpc_LibXML_free_key_indexes(data);
+        key = xpc_Sv2C(name, NULL);
+        if ( SvOK(match) ) {
+            def = newAV();
+            str = xpc_Sv2C(match, NULL);
+            av_push(def, newSVpv((char *)str, 0));
+            xmlFree(str);
+            str = xpc_Sv2C(use, NULL);
+            av_push(def, newSVpv((char *)str, 0));
+            xmlFree(str);
+            if ( data->keys == NULL )
+                data->keys = newHV();
+            hv_store(data->keys, (const char *)key, xmlStrlen(key),
+                     newRV_noinc((SV *)def), 0);
+            if ( xmlXPathFunctionLookup(ctxt, (const xmlChar *)"key")
+                 != xpc_LibXML_key_function ) {
+                /* replaces a perl function of that name */
+                xpc_LibXML_unshare_tables(ctxt, 1);
+                xmlXPathRegisterFunc(ctxt, (const xmlChar *)"key", NULL);
+                xmlXPathRegisterFunc(ctxt, (const xmlChar *)"key",
+                                     xpc_LibXML_key_function);
+            }
+        }
+        else if ( data->keys != NULL ) {
+            hv_delete(data->keys, (const char *)key, xmlStrlen(key), G_DISCARD);
         }
+        xmlFree(key);
+
+void
+registerDocumentLoader( pxpath_context, loader_func, loader_data )
+        SV * pxpath_context
+        SV * loader_func
+        SV * loader_data
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+        XPathContextDataPtr data = NULL;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL )
+            croak("XPathContext: missing xpath context");
+        data = XPathContextDATA(ctxt);
+        if ( data == NULL )
+            croak("XPathContext: missing xpath context private data");
+        /* free previous loader function and data */
+        if (data->docLoader && SvOK(data->docLoader))
+            SvREFCNT_dec(data->docLoader);
+        if (data->docLoaderData && SvOK(data->docLoaderData))
+            SvREFCNT_dec(data->docLoaderData);
+        data->docLoader=NULL;
+        data->docLoaderData=NULL;
+    PPCODE:
+        if (SvOK(loader_func)) {
+            if ( SvROK(loader_func) && SvTYPE(SvRV(loader_func)) == SVt_PVCV ) {
+                data->docLoader = newSVsv(loader_func);
+                if (SvOK(loader_data))
+                    data->docLoaderData = newSVsv(loader_data);
+            } else {
+                croak("XPathContext: 1st argument is not a CODE reference");
+            }
+        }
+
+void
+registerDocument( pxpath_context, uri, source )
+        SV * pxpath_context
+        SV * uri
+        SV * source
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+        XPathContextDataPtr data = NULL;
+        STRLEN len;
+        char * strkey;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL )
+            croak("XPathContext: missing xpath context");
+        data = XPathContextDATA(ctxt);
+        if ( data == NULL )
+            croak("XPathContext: missing xpath context private data");
+        if ( !SvOK(uri) )
+            croak("XPathContext: missing document URI");
+    PPCODE:
+        strkey = SvPV(uri, len);
+        if (SvOK(source)) {
+            if ( SvROK(source) && !sv_isobject(source) &&
+                 SvTYPE(SvRV(source)) >= SVt_PVAV ) {
+                croak("XPathContext: 2nd argument is neither a node, a reference to a string nor a file name");
+            }
+            if (sv_isobject(source) &&
+                !sv_derived_from(source, "XML::LibXML::Node")) {
+                croak("XPathContext: 2nd argument is not a XML::LibXML::Node");
+            }
+            if (data->docCatalog == NULL)
+                data->docCatalog = newHV();
+            hv_store(data->docCatalog, strkey, len, newSVsv(source), 0);
+        } else if (data->docCatalog != NULL) {
+            /* unregister */
+            hv_delete(data->docCatalog, strkey, len, G_DISCARD);
+        }
+
+void
+setDocumentParseOptions( pxpath_context, ... )
+        SV * pxpath_context
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+        int options = 0;
+        int i, j;
+        char * name;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL )
+            croak("XPathContext: missing xpath context");
+        if ( items % 2 == 0 )
+            croak("XPathContext: odd number of parse options");
+    PPCODE:
+        for (i = 1; i < items; i += 2) {
+            name = SvPV_nolen(ST(i));
+            for (j = 0; xpc_LibXML_parse_options[j].name != NULL; j++) {
+                if (strEQ(name, xpc_LibXML_parse_options[j].name))
+                    break;
+            }
+            if (xpc_LibXML_parse_options[j].name == NULL)
+                croak("XPathContext: unknown parse option '%s'", name);
+            if (SvTRUE(ST(i+1)))
+                options |= xpc_LibXML_parse_options[j].flag;
+        }
+        XPathContextDATA(ctxt)->docParseOptions = options;
+
+void
+setDocumentPrefetchThreads( pxpath_context, threads )
+        SV * pxpath_context
+        int threads
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL )
+            croak("XPathContext: missing xpath context");
+    PPCODE:
+        XPathContextDATA(ctxt)->docThreads =
+            (threads > 1 && xpc_domHaveThreads()) ? threads : 1;
+
+void
+setQueryThreads( pxpath_context, threads )
+        SV * pxpath_context
+        int threads
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL )
+            croak("XPathContext: missing xpath context");
+    PPCODE:
+        if (threads <= 0)
+            threads = xpc_domDefaultThreads();
+        XPathContextDATA(ctxt)->queryThreads =
+            (threads > 1 && xpc_domHaveThreads()) ? threads : 1;
+
+void
+setParallelScan( pxpath_context, enable )
+        SV * pxpath_context
+        int enable
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL )
+            croak("XPathContext: missing xpath context");
+    PPCODE:
+        XPathContextDATA(ctxt)->parallelScan = enable ? 1 : 0;
+
+void
+setNameIndex( pxpath_context, enable )
+        SV * pxpath_context
+        int enable
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL ) {
+            croak("XPathContext: missing xpath context");
+        }
+    PPCODE:
+        XPathContextDATA(ctxt)->nameIndex = enable;
+
+void
+indexAttribute( pxpath_context, elem, attr )
+        SV * pxpath_context
+        char * elem
+        char * attr
+    ALIAS:
+        indexNumbers = 1
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+        XPathContextDataPtr data = NULL;
+        xmlChar * pair = NULL;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL ) {
+            croak("XPathContext: missing xpath context");
+        }
+        data = XPathContextDATA(ctxt);
+    PPCODE:
+        if ( data->attrIndex == NULL )
+            data->attrIndex = xmlHashCreate(8);
+        if ( data->attrIndex == NULL )
+            croak("XPathContext: cannot create attribute index table");
+        pair = xmlStrdup((const xmlChar *)elem);
+        pair = xmlStrcat(pair, (const xmlChar *)"@");
+        pair = xmlStrcat(pair, (const xmlChar *)attr);
+        if ( ix == 1 )
+            pair = xmlStrcat(pair, (const xmlChar *)"#n");
+        xmlHashUpdateEntry(data->attrIndex, pair, INT2PTR(void *, -1), NULL);
+        xmlFree(pair);
+
+void
+setAttributeIndexThreshold( pxpath_context, threshold )
+        SV * pxpath_context
+        int threshold
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL ) {
+            croak("XPathContext: missing xpath context");
+        }
+    PPCODE:
+        XPathContextDATA(ctxt)->attrThreshold = threshold > 0 ? threshold : 0;
+
+IV
+getIndexMemory( pxpath_context, pnode )
+        SV * pxpath_context
+        SV * pnode
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+        xmlNodePtr node = NULL;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL ) {
+            croak("XPathContext: missing xpath context");
+        }
+    CODE:
+        node = xpc_PmmSvNode(pnode);
+        if ( node == NULL ) {
+            croak("XPathContext: node required");
+        }
+        RETVAL = node->doc != NULL
+                 ? (IV)xpc_domIndexMemory(XPathContextDATA(ctxt)->indexes, node->doc)
+                 : 0;
+    OUTPUT:
+        RETVAL
+
+void
+dropIndexes( pxpath_context, pnode )
+        SV * pxpath_context
+        SV * pnode
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+        xmlNodePtr node = NULL;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL ) {
+            croak("XPathContext: missing xpath context");
+        }
+    PPCODE:
+        node = xpc_PmmSvNode(pnode);
+        if ( node == NULL ) {
+            croak("XPathContext: node required");
+        }
+        if ( node->doc != NULL )
+            xpc_domIndexDrop(&XPathContextDATA(ctxt)->indexes, node->doc);
+
+void
+setSharedDictionary( pxpath_context, shared )
+        SV * pxpath_context
+        int shared
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+        XPathContextDataPtr data = NULL;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL )
+            croak("XPathContext: missing xpath context");
+        data = XPathContextDATA(ctxt);
+    PPCODE:
+        if (shared && data->dict == NULL) {
+            data->dict = xmlDictCreate();
+            if (data->dict == NULL)
+                croak("XPathContext: cannot create dictionary");
+        } else if (!shared && data->dict != NULL) {
+            /* documents and parsers using it hold their own reference */
+            xmlDictFree(data->dict);
+            data->dict = NULL;
+        }
+
+void
+_free_node_pool( pxpath_context )
+        SV * pxpath_context
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL ) {
+            croak("XPathContext: missing xpath context");
+        }
+    PPCODE:
+        xpc_LibXML_free_node_pool(XPathContextDATA(ctxt));
 
 void
 _findnodes( pxpath_context, perl_xpath )
@@ -888,35 +2624,44 @@ _findnodes( pxpath_context, perl_xpath )
         xmlNodeSetPtr nodelist = NULL;
         SV * element = NULL ;
         STRLEN len = 0 ;
-        xmlChar * xpath = NULL;
+        const xmlChar * xpath = NULL;
+        int owned = 0;
+        XPathContextDataPtr data = NULL;
+        NV started = 0;
     INIT:
         ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
         if ( ctxt == NULL ) {
             croak("XPathContext: missing xpath context");
         }
+        data = XPathContextDATA(ctxt);
+        if ( data->stats != NULL )
+            data->stats->queries++;
+        xpc_LibXML_stat_start(data, started);
         xpc_LibXML_configure_xpathcontext(ctxt);
+        xpc_LibXML_stat_stop(data, XPC_STAT_CONFIGURE, started);
         if ( ctxt->node == NULL ) {
             croak("XPathContext: lost current node");
         }
-        xpath = nodexpc_Sv2C(perl_xpath, ctxt->node);
+        /* the private copy made by _guarded_find_call, used as it is
+           unless it needs converting */
+        xpc_LibXML_stat_start(data, started);
+        xpath = nodexpc_Sv2CBorrow(perl_xpath, ctxt->node, &owned);
+        xpc_LibXML_stat_stop(data, XPC_STAT_CONVERT, started);
         if ( !(xpath && xmlStrlen(xpath)) ) {
-            if ( xpath ) 
-                xmlFree(xpath);
+            if ( owned ) 
+                xmlFree((xmlChar *)xpath);
             croak("XPathContext: empty XPath found");
             XSRETURN_UNDEF;
         }
     PPCODE:
-        if ( ctxt->node->doc ) {
-            xpc_domNodeNormalize( xmlDocGetRootElement(ctxt->node->doc) );
-        }
-        else {
-            xpc_domNodeNormalize( xpc_PmmOWNER(xpc_PmmNewNode(ctxt->node)) );
-        }
+        xpc_LibXML_init_error(ctxt);
 
-        xpc_LibXML_init_error();
+        xpc_LibXML_stat_start(data, started);
+        xpc_LibXML_number_order(aTHX_ ctxt);
+        xpc_LibXML_stat_stop(data, XPC_STAT_NORMALIZE, started);
 
         PUTBACK ;
-        found = xpc_domXPathFind( ctxt, xpath );
+        found = xpc_LibXML_find( ctxt, xpath );
         SPAGAIN ;
 
         if (found != NULL) {
@@ -924,9 +2669,10 @@ _findnodes( pxpath_context, perl_xpath )
         } else {
           nodelist = NULL;
         }
-        xmlFree(xpath);
+        if ( owned )
+            xmlFree((xmlChar *)xpath);
 
-        xpc_LibXML_croak_error();
+        xpc_LibXML_croak_error(ctxt);
 
         if ( nodelist ) {
             if ( nodelist->nodeNr > 0 ) {
@@ -934,6 +2680,7 @@ _findnodes( pxpath_context, perl_xpath )
                 const char * cls = "XML::LibXML::Node";
                 xmlNodePtr tnode;
                 len = nodelist->nodeNr;
+                xpc_LibXML_stat_start(data, started);
                 for( i ; i < len; i++){
                     /* we have to create a new instance of an objectptr. 
                      * and then place the current node into the new object. 
@@ -956,15 +2703,16 @@ _findnodes( pxpath_context, perl_xpath )
                         }
                     }
                     else {
-                        if (tnode->doc) {
-                            owner = xpc_PmmOWNERPO(xpc_PmmNewNode((xmlNodePtr) tnode->doc));
-                        } else {
-                            owner = NULL; /* self contained node */
-                        }
+                        if ( data->stats != NULL && tnode->_private == NULL )
+                            data->stats->proxies++;
+                        owner = xpc_LibXML_node_owner(tnode);
                         element = xpc_PmmNodeToSv(tnode, owner);
                     }
                     XPUSHs( sv_2mortal(element) );
                 }
+                xpc_LibXML_stat_stop(data, XPC_STAT_PROXY, started);
+                if ( data->stats != NULL )
+                    data->stats->nodes += len;
             }
             /* prevent libxml2 from freeing the actual nodes */
             if (found->boolval) found->boolval=0;
@@ -972,7 +2720,6 @@ _findnodes( pxpath_context, perl_xpath )
         }
         else {
             xmlXPathFreeObject(found);
-            xpc_LibXML_croak_error();
         }
 
 void
@@ -986,41 +2733,51 @@ _find( pxpath_context, pxpath )
         xmlNodeSetPtr nodelist = NULL;
         SV* element = NULL ;
         STRLEN len = 0 ;
-        xmlChar * xpath = NULL;
+        const xmlChar * xpath = NULL;
+        int owned = 0;
+        XPathContextDataPtr data = NULL;
+        NV started = 0;
     INIT:
         ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
         if ( ctxt == NULL ) {
             croak("XPathContext: missing xpath context");
         }
+        data = XPathContextDATA(ctxt);
+        if ( data->stats != NULL )
+            data->stats->queries++;
+        xpc_LibXML_stat_start(data, started);
         xpc_LibXML_configure_xpathcontext(ctxt);
+        xpc_LibXML_stat_stop(data, XPC_STAT_CONFIGURE, started);
         if ( ctxt->node == NULL ) {
             croak("XPathContext: lost current node");
         }
-        xpath = nodexpc_Sv2C(pxpath, ctxt->node);
+        /* the private copy made by _guarded_find_call, used as it is
+           unless it needs converting */
+        xpc_LibXML_stat_start(data, started);
+        xpath = nodexpc_Sv2CBorrow(pxpath, ctxt->node, &owned);
+        xpc_LibXML_stat_stop(data, XPC_STAT_CONVERT, started);
         if ( !(xpath && xmlStrlen(xpath)) ) {
-            if ( xpath ) 
-                xmlFree(xpath);
+            if ( owned ) 
+                xmlFree((xmlChar *)xpath);
             croak("XPathContext: empty XPath found");
             XSRETURN_UNDEF;
         }
 
     PPCODE:
-        if ( ctxt->node->doc ) {
-            xpc_domNodeNormalize( xmlDocGetRootElement( ctxt->node->doc ) );
-        }
-        else {
-            xpc_domNodeNormalize( xpc_PmmOWNER(xpc_PmmNewNode(ctxt->node)) );
-        }
+        xpc_LibXML_init_error(ctxt);
 
-        xpc_LibXML_init_error();
+        xpc_LibXML_stat_start(data, started);
+        xpc_LibXML_number_order(aTHX_ ctxt);
+        xpc_LibXML_stat_stop(data, XPC_STAT_NORMALIZE, started);
 
         PUTBACK ;
-        found = xpc_domXPathFind( ctxt, xpath );
+        found = xpc_LibXML_find( ctxt, xpath );
         SPAGAIN ;
 
-        xmlFree( xpath );
+        if ( owned )
+            xmlFree( (xmlChar *)xpath );
 
-        xpc_LibXML_croak_error();
+        xpc_LibXML_croak_error(ctxt);
 
         if (found) {
             switch (found->type) {
@@ -1037,6 +2794,7 @@ _find( pxpath_context, pxpath )
                             SV * element;
                         
                             len = nodelist->nodeNr;
+                            xpc_LibXML_stat_start(data, started);
                             for( i ; i < len; i++){
                                 /* we have to create a new instance of an
                                  * objectptr. and then
@@ -1062,15 +2820,18 @@ _find( pxpath_context, pxpath )
                                     }
                                 }
                                 else {
-                                    if (tnode->doc) {
-                                        owner = xpc_PmmOWNERPO(xpc_PmmNewNode((xmlNodePtr) tnode->doc));
-                                    } else {
-                                        owner = NULL; /* self contained node */
-                                    }
+                                    if ( data->stats != NULL
+                                         && tnode->_private == NULL )
+                                        data->stats->proxies++;
+                                    owner = xpc_LibXML_node_owner(tnode);
                                     element = xpc_PmmNodeToSv(tnode, owner);
                                 }
                                 XPUSHs( sv_2mortal(element) );
                             }
+                            xpc_LibXML_stat_stop(data, XPC_STAT_PROXY,
+                                                 started);
+                            if ( data->stats != NULL )
+                                data->stats->nodes += len;
                         }
                     }
                     /* prevent libxml2 from freeing the actual nodes */
@@ -1099,6 +2860,693 @@ _find( pxpath_context, pxpath )
             }
             xmlXPathFreeObject(found);
         }
+
+int
+streamfind( pxpath_context, source, ppattern, callback, ... )
+        SV * pxpath_context
+        SV * source
+        SV * ppattern
+        SV * callback
+    ALIAS:
+        _streamrecords = 1
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+        xmlTextReaderPtr reader = NULL;
+        xmlPatternPtr pattern = NULL;
+        xmlChar * xpattern = NULL;
+        xmlChar * xpath = NULL;
+        AV * xpaths = NULL;
+        SV ** pxpath;
+        xpc_StreamMatch match;
+        int i;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL ) {
+            croak("XPathContext: missing xpath context");
+        }
+        if ( !SvROK(callback) || SvTYPE(SvRV(callback)) != SVt_PVCV ) {
+            croak("XPathContext: streamfind needs a code reference");
+        }
+        if ( ix == 1 ) {
+            if ( items < 5 || !SvROK(ST(4)) || SvTYPE(SvRV(ST(4))) != SVt_PVAV ) {
+                croak("XPathContext: streamrecords needs a list of expressions");
+            }
+            xpaths = (AV *)SvRV(ST(4));
+        }
+        xpc_LibXML_configure_xpathcontext(ctxt);
+        xpattern = nodexpc_Sv2C(ppattern, ctxt->node);
+        if ( !(xpattern && xmlStrlen(xpattern)) ) {
+            if ( xpattern )
+                xmlFree(xpattern);
+            croak("XPathContext: empty pattern found");
+        }
+        match.callback = callback;
+        match.failed   = 0;
+        match.ctxt     = ctxt;
+        match.comps    = NULL;
+        match.ncomps   = 0;
+    CODE:
+        xpc_LibXML_init_error(ctxt);
+
+        if ( xpaths != NULL && av_len(xpaths) >= 0 ) {
+            Newxz(match.comps, av_len(xpaths) + 1, xmlXPathCompExprPtr);
+            for ( i = 0; i <= av_len(xpaths); i++ ) {
+                pxpath = av_fetch(xpaths, i, 0);
+                xpath = pxpath != NULL ? nodexpc_Sv2C(*pxpath, ctxt->node) : NULL;
+                if ( xpath != NULL )
+                    match.comps[i] = xmlXPathCtxtCompile(ctxt, xpath);
+                xmlFree(xpath);
+                if ( match.comps[i] == NULL )
+                    break;
+                match.ncomps++;
+            }
+        }
+
+        if ( xpaths == NULL || match.ncomps == av_len(xpaths) + 1 ) {
+            pattern = xpc_domCompilePattern(ctxt, xpattern);
+            if ( pattern == NULL ) {
+                sv_catpvf(XPathContextDATA(ctxt)->error,
+                          "XPathContext: '%s' is not a streamable pattern\n",
+                          (char *)xpattern);
+            }
+            else {
+                reader = xpc_LibXML_stream_reader(aTHX_ source,
+                             XPathContextDATA(ctxt)->docParseOptions);
+            }
+        }
+        else if ( SvCUR(XPathContextDATA(ctxt)->error) == 0 ) {
+            sv_catpvf(XPathContextDATA(ctxt)->error,
+                      "XPathContext: invalid expression\n");
+        }
+        xmlFree(xpattern);
+
+        RETVAL = -1;
+        if ( reader != NULL ) {
+            xmlTextReaderSetStructuredErrorHandler(reader,
+                (xmlStructuredErrorFunc)xpc_LibXML_structured_error_handler,
+                XPathContextDATA(ctxt)->error);
+            RETVAL = xpc_domStreamFind(reader, pattern, xpc_LibXML_stream_match,
+                                       &match);
+            xmlFreeTextReader(reader);
+        }
+        else if ( pattern != NULL ) {
+            sv_catpvf(XPathContextDATA(ctxt)->error,
+                      "XPathContext: cannot read %s\n",
+                      SvROK(source) ? "the filehandle" : SvPV_nolen(source));
+        }
+        if ( pattern != NULL )
+            xmlFreePattern(pattern);
+        for ( i = 0; i < match.ncomps; i++ )
+            xmlXPathFreeCompExpr(match.comps[i]);
+        Safefree(match.comps);
+
+        if ( match.failed && SvCUR(XPathContextDATA(ctxt)->error) == 0 ) {
+            croak("XPathContext: error coming back from streamfind callback. %s",
+                  SvTRUE(ERRSV) ? SvPV_nolen(ERRSV) : "");
+        }
+        if ( RETVAL < 0 && SvCUR(XPathContextDATA(ctxt)->error) == 0 ) {
+            sv_catpvf(XPathContextDATA(ctxt)->error,
+                      "XPathContext: error while reading\n");
+        }
+
+        xpc_LibXML_croak_error(ctxt);
+    OUTPUT:
+        RETVAL
+
+SV*
+newPushStream( pxpath_context, ... )
+        SV * pxpath_context
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+        xpc_LibXML_PushStream * push = NULL;
+        xmlPatternPtr * patterns = NULL;
+        xmlChar * xpattern = NULL;
+        int npatterns, i;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL ) {
+            croak("XPathContext: missing xpath context");
+        }
+        if ( items < 3 || (items - 1) % 2 != 0 ) {
+            croak("XPathContext: newPushStream needs patterns and code references");
+        }
+        for ( i = 2; i < items; i += 2 ) {
+            if ( !SvROK(ST(i)) || SvTYPE(SvRV(ST(i))) != SVt_PVCV ) {
+                croak("XPathContext: newPushStream needs a code reference per pattern");
+            }
+        }
+        xpc_LibXML_configure_xpathcontext(ctxt);
+        npatterns = (items - 1) / 2;
+    CODE:
+        xpc_LibXML_init_error(ctxt);
+
+        patterns = (xmlPatternPtr *)xmlMalloc(npatterns * sizeof(xmlPatternPtr));
+        if ( patterns == NULL ) {
+            croak("XPathContext: out of memory");
+        }
+        for ( i = 0; i < npatterns; i++ ) {
+            xpattern = nodexpc_Sv2C(ST(1 + 2 * i), ctxt->node);
+            patterns[i] = xpattern != NULL
+                          ? xpc_domCompilePattern(ctxt, xpattern) : NULL;
+            if ( patterns[i] == NULL ) {
+                sv_catpvf(XPathContextDATA(ctxt)->error,
+                          "XPathContext: '%s' is not a streamable pattern\n",
+                          xpattern != NULL ? (char *)xpattern : "");
+                xmlFree(xpattern);
+                while ( i-- > 0 )
+                    xmlFreePattern(patterns[i]);
+                xmlFree(patterns);
+                patterns = NULL;
+                break;
+            }
+            xmlFree(xpattern);
+        }
+
+        RETVAL = &PL_sv_undef;
+        if ( patterns != NULL ) {
+            Newxz(push, 1, xpc_LibXML_PushStream);
+            push->context   = newSVsv(pxpath_context);
+            push->callbacks = newAV();
+            for ( i = 0; i < npatterns; i++ )
+                av_push(push->callbacks, newSVsv(ST(2 + 2 * i)));
+            push->stream = xpc_domPushStreamNew(patterns, npatterns,
+                               xpc_LibXML_push_match, push,
+                               XPathContextDATA(ctxt)->docParseOptions);
+            if ( push->stream == NULL ) {
+                for ( i = 0; i < npatterns; i++ )
+                    xmlFreePattern(patterns[i]);
+                xmlFree(patterns);
+                SvREFCNT_dec(push->context);
+                SvREFCNT_dec((SV *)push->callbacks);
+                Safefree(push);
+                sv_catpvf(XPathContextDATA(ctxt)->error,
+                          "XPathContext: cannot create push parser\n");
+            }
+            else {
+                RETVAL = sv_setref_pv(NEWSV(0,0),
+                             "XML::LibXML::XPathContext::PushStream",
+                             (void *)push);
+            }
+        }
+
+        xpc_LibXML_croak_error(ctxt);
+    OUTPUT:
+        RETVAL
+
+SV*
+_findserialize( pxpath_context, perl_xpath, pfh, pseparator, c14n, comments, format )
+        SV * pxpath_context
+        SV * perl_xpath
+        SV * pfh
+        SV * pseparator
+        int c14n
+        int comments
+        int format
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+        xmlXPathObjectPtr found = NULL;
+        xmlOutputBufferPtr out = NULL;
+        xmlChar * xpath = NULL;
+        xmlChar * separator = NULL;
+        xmlChar * value = NULL;
+        SV * string = NULL;
+        IO * io = NULL;
+        int count = 0;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL ) {
+            croak("XPathContext: missing xpath context");
+        }
+        xpc_LibXML_configure_xpathcontext(ctxt);
+        if ( ctxt->node == NULL ) {
+            croak("XPathContext: lost current node");
+        }
+        if ( SvOK(pfh) ) {
+            io = sv_2io(pfh);
+            if ( io == NULL || IoOFP(io) == NULL ) {
+                croak("XPathContext: filehandle not open for writing");
+            }
+        }
+        xpath = nodexpc_Sv2C(perl_xpath, ctxt->node);
+        if ( !(xpath && xmlStrlen(xpath)) ) {
+            if ( xpath )
+                xmlFree(xpath);
+            croak("XPathContext: empty XPath found");
+        }
+    CODE:
+        xpc_LibXML_init_error(ctxt);
+
+        xpc_LibXML_number_order(aTHX_ ctxt);
+        found = xpc_LibXML_find( ctxt, xpath );
+        xmlFree(xpath);
+
+        if ( found != NULL ) {
+            if ( io != NULL ) {
+                out = xmlOutputBufferCreateIO(xpc_LibXML_write_perlio, NULL,
+                                              IoOFP(io), NULL);
+            }
+            else {
+                string = newSVpvn("", 0);
+                out = xmlOutputBufferCreateIO(xpc_LibXML_write_sv, NULL,
+                                              string, NULL);
+            }
+        }
+        if ( out != NULL ) {
+            if ( SvOK(pseparator) )
+                separator = nodexpc_Sv2C(pseparator, ctxt->node);
+            if ( found->type == XPATH_NODESET ) {
+                count = xpc_domSerializeNodeSet(found->nodesetval, out,
+                                                separator, c14n, comments,
+                                                format);
+            }
+            else {
+                /* the value of an expression which is not a nodeset */
+                value = xmlXPathCastToString(found);
+                if ( value != NULL )
+                    xmlOutputBufferWriteString(out, (const char *)value);
+                xmlFree(value);
+                count = 1;
+            }
+            xmlFree(separator);
+            if ( xmlOutputBufferClose(out) < 0 )
+                count = -1;
+            if ( count < 0 && SvCUR(XPathContextDATA(ctxt)->error) == 0 ) {
+                sv_catpvf(XPathContextDATA(ctxt)->error,
+                          "XPathContext: cannot serialize the result\n");
+            }
+        }
+        xmlXPathFreeObject(found);
+
+        if ( string != NULL )
+            sv_2mortal(string);
+        xpc_LibXML_croak_error(ctxt);
+
+        if ( string != NULL ) {
+            SvUTF8_on(string);
+            RETVAL = SvREFCNT_inc(string);
+        }
+        else {
+            RETVAL = newSViv(count);
+        }
+    OUTPUT:
+        RETVAL
+
+SV*
+_findexport( pxpath_context, perl_xpath, pcolumns, pfh, format, header, source )
+        SV * pxpath_context
+        SV * perl_xpath
+        SV * pcolumns
+        SV * pfh
+        int format
+        int header
+        SV * source
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+        xmlXPathObjectPtr found = NULL;
+        xmlTextReaderPtr reader = NULL;
+        xmlPatternPtr pattern = NULL;
+        xmlChar * xpath = NULL;
+        xpc_Export export;
+        AV * columns = NULL;
+        SV ** pcolumn;
+        SV * string = NULL;
+        IO * io = NULL;
+        int count = 0;
+        int i;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL ) {
+            croak("XPathContext: missing xpath context");
+        }
+        if ( !SvROK(pcolumns) || SvTYPE(SvRV(pcolumns)) != SVt_PVAV
+             || av_len((AV *)SvRV(pcolumns)) % 2 == 0 ) {
+            croak("XPathContext: findexport needs a list of names and expressions");
+        }
+        columns = (AV *)SvRV(pcolumns);
+        xpc_LibXML_configure_xpathcontext(ctxt);
+        if ( ctxt->node == NULL && !SvOK(source) ) {
+            croak("XPathContext: lost current node");
+        }
+        if ( SvOK(pfh) ) {
+            io = sv_2io(pfh);
+            if ( io == NULL || IoOFP(io) == NULL ) {
+                croak("XPathContext: filehandle not open for writing");
+            }
+        }
+        xpath = nodexpc_Sv2C(perl_xpath, ctxt->node);
+        if ( !(xpath && xmlStrlen(xpath)) ) {
+            if ( xpath )
+                xmlFree(xpath);
+            croak("XPathContext: empty XPath found");
+        }
+        export.ctxt     = ctxt;
+        export.ncolumns = 0;
+        export.format   = format;
+        export.out      = NULL;
+        export.shadow   = &XPathContextDATA(ctxt)->shadowDoc;
+        Newxz(export.columns, (av_len(columns) + 1) / 2, xmlXPathCompExprPtr);
+        Newxz(export.names, (av_len(columns) + 1) / 2, const xmlChar *);
+    CODE:
+        xpc_LibXML_init_error(ctxt);
+
+        for ( i = 0; i < av_len(columns); i += 2 ) {
+            pcolumn = av_fetch(columns, i, 0);
+            export.names[i / 2] = pcolumn != NULL
+                ? nodexpc_Sv2C(*pcolumn, ctxt->node) : xmlStrdup((const xmlChar *)"");
+            pcolumn = av_fetch(columns, i + 1, 0);
+            if ( pcolumn != NULL ) {
+                xmlChar * column = nodexpc_Sv2C(*pcolumn, ctxt->node);
+                if ( column != NULL )
+                    export.columns[i / 2] = xmlXPathCtxtCompile(ctxt, column);
+                xmlFree(column);
+            }
+            export.ncolumns++;
+            if ( export.names[i / 2] == NULL || export.columns[i / 2] == NULL )
+                break;
+        }
+
+        if ( i <= av_len(columns) ) {
+            /* a column did not compile */
+            if ( SvCUR(XPathContextDATA(ctxt)->error) == 0 )
+                sv_catpvf(XPathContextDATA(ctxt)->error,
+                          "XPathContext: invalid expression\n");
+        }
+        else if ( SvOK(source) ) {
+            /* the rows are matched while reading */
+            pattern = xpc_domCompilePattern(ctxt, xpath);
+            if ( pattern == NULL ) {
+                sv_catpvf(XPathContextDATA(ctxt)->error,
+                          "XPathContext: '%s' is not a streamable pattern\n",
+                          (char *)xpath);
+            }
+            else {
+                reader = xpc_LibXML_stream_reader(aTHX_ source,
+                             XPathContextDATA(ctxt)->docParseOptions);
+                if ( reader == NULL ) {
+                    sv_catpvf(XPathContextDATA(ctxt)->error,
+                              "XPathContext: cannot read %s\n",
+                              SvROK(source) ? "the filehandle" : SvPV_nolen(source));
+                }
+            }
+        }
+        else {
+            xpc_LibXML_number_order(aTHX_ ctxt);
+            found = xpc_LibXML_find( ctxt, xpath );
+            if ( found != NULL && found->type != XPATH_NODESET ) {
+                sv_catpvf(XPathContextDATA(ctxt)->error,
+                          "XPathContext: the rows have to be nodes\n");
+                xmlXPathFreeObject(found);
+                found = NULL;
+            }
+        }
+        xmlFree(xpath);
+
+        if ( found != NULL || reader != NULL ) {
+            if ( io != NULL ) {
+                export.out = xmlOutputBufferCreateIO(xpc_LibXML_write_perlio,
+                                                     NULL, IoOFP(io), NULL);
+            }
+            else {
+                string = newSVpvn("", 0);
+                export.out = xmlOutputBufferCreateIO(xpc_LibXML_write_sv, NULL,
+                                                     string, NULL);
+            }
+        }
+        if ( export.out != NULL ) {
+            if ( header )
+                xpc_domExportHeader(&export);
+            if ( reader != NULL ) {
+                xmlTextReaderSetStructuredErrorHandler(reader,
+                    (xmlStructuredErrorFunc)xpc_LibXML_structured_error_handler,
+                    XPathContextDATA(ctxt)->error);
+                count = xpc_domStreamFind(reader, pattern,
+                                          xpc_LibXML_export_row, &export);
+            }
+            else if ( found->nodesetval != NULL ) {
+                for ( ; count < found->nodesetval->nodeNr; count++ ) {
+                    if ( xpc_LibXML_export_row(found->nodesetval->nodeTab[count],
+                                               &export) != 0 ) {
+                        count = -1;
+                        break;
+                    }
+                }
+            }
+            if ( xmlOutputBufferClose(export.out) < 0 )
+                count = -1;
+            if ( count < 0 && SvCUR(XPathContextDATA(ctxt)->error) == 0 ) {
+                sv_catpvf(XPathContextDATA(ctxt)->error,
+                          "XPathContext: cannot export the rows\n");
+            }
+        }
+        xmlXPathFreeObject(found);
+        if ( reader != NULL )
+            xmlFreeTextReader(reader);
+        if ( pattern != NULL )
+            xmlFreePattern(pattern);
+        for ( i = 0; i < export.ncolumns; i++ ) {
+            xmlFree((xmlChar *)export.names[i]);
+            if ( export.columns[i] != NULL )
+                xmlXPathFreeCompExpr(export.columns[i]);
+        }
+        Safefree(export.names);
+        Safefree(export.columns);
+
+        if ( string != NULL )
+            sv_2mortal(string);
+        xpc_LibXML_croak_error(ctxt);
+
+        if ( string != NULL ) {
+            SvUTF8_on(string);
+            RETVAL = SvREFCNT_inc(string);
+        }
         else {
-            xpc_LibXML_croak_error();
+            RETVAL = newSViv(count);
+        }
+    OUTPUT:
+        RETVAL
+
+void
+_getElementsByTagName( pxpath_context, pname, ... )
+        SV * pxpath_context
+        SV * pname
+    ALIAS:
+        _getElementsByTagNameNS = 1
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+        xpc_ProxyNodePtr owner = NULL;
+        xmlNodeSetPtr nodelist = NULL;
+        xmlChar * name = NULL;
+        xmlChar * nsURI = NULL;
+        int i;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL ) {
+            croak("XPathContext: missing xpath context");
+        }
+        xpc_LibXML_configure_xpathcontext(ctxt);
+        if ( ctxt->node == NULL ) {
+            croak("XPathContext: lost current node");
+        }
+        name = nodexpc_Sv2C(pname, ctxt->node);
+        if ( name == NULL ) {
+            croak("XPathContext: name required");
+        }
+        if ( ix == 1 && items > 2 && SvOK(ST(2)) ) {
+            nsURI = nodexpc_Sv2C(ST(2), ctxt->node);
+        }
+    PPCODE:
+        if ( ix == 1 )
+            nodelist = xpc_domGetDescendantsByTagNameNS( ctxt->node, nsURI, name );
+        else
+            nodelist = xpc_domGetDescendantsByTagName( ctxt->node, name );
+        xmlFree(name);
+        xmlFree(nsURI);
+        if ( nodelist != NULL ) {
+            EXTEND(SP, nodelist->nodeNr);
+            for ( i = 0; i < nodelist->nodeNr; i++ ) {
+                owner = xpc_LibXML_node_owner(nodelist->nodeTab[i]);
+                PUSHs( sv_2mortal(xpc_PmmNodeToSv(nodelist->nodeTab[i], owner)) );
+            }
+            xmlXPathFreeNodeSet(nodelist);
+        }
+
+void
+_find_many( pxpath_context, perl_xpath, pnodes )
+        SV * pxpath_context
+        SV * perl_xpath
+        SV * pnodes
+    PREINIT:
+        xmlXPathContextPtr ctxt = NULL;
+        XPathContextDataPtr data = NULL;
+        xmlXPathCompExprPtr comp = NULL;
+        xmlXPathObjectPtr * results = NULL;
+        xmlNodePtr * nodes = NULL;
+        xmlNodePtr top, last = NULL;
+        xmlChar * xpath = NULL;
+        SV ** pnode;
+        int count, i, failed = 0;
+    INIT:
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(pxpath_context));
+        if ( ctxt == NULL ) {
+            croak("XPathContext: missing xpath context");
+        }
+        data = XPathContextDATA(ctxt);
+        if ( !SvROK(pnodes) || SvTYPE(SvRV(pnodes)) != SVt_PVAV ) {
+            croak("XPathContext: 2nd argument is not an ARRAY reference");
+        }
+        count = av_len((AV*)SvRV(pnodes)) + 1;
+        xpc_LibXML_configure_xpathcontext(ctxt);
+    PPCODE:
+        /* returns nothing if the query has to run node by node: perl
+           callbacks cannot be called from other threads */
+        if ( count < 2 || data->queryThreads < 2 || data->varLookup != NULL
+             || (ctxt->funcLookupData != NULL
+                 && HvKEYS((HV*)SvRV((SV*)ctxt->funcLookupData)) > 0) ) {
+            XSRETURN_EMPTY;
+        }
+
+        New(0, nodes, count, xmlNodePtr);
+        for ( i = 0; i < count; i++ ) {
+            pnode = av_fetch((AV*)SvRV(pnodes), i, 0);
+            nodes[i] = pnode != NULL ? xpc_PmmSvNode(*pnode) : NULL;
+            if ( nodes[i] == NULL || nodes[i]->doc == NULL ) {
+                Safefree(nodes);
+                XSRETURN_EMPTY;
+            }
+        }
+
+        xpath = nodexpc_Sv2C(perl_xpath, nodes[0]);
+        if ( !(xpath && xmlStrlen(xpath)) ) {
+            if ( xpath ) 
+                xmlFree(xpath);
+            Safefree(nodes);
+            croak("XPathContext: empty XPath found");
+        }
+        /* document() and key() are only registered with this context
+           and may call back into Perl, so the threads cannot run them.
+           the test is deliberately conservative: element names such as
+           "documents" or "keys" make the query run node by node too */
+        if ( xmlStrstr(xpath, (const xmlChar *) "document") != NULL
+             || (data->keys != NULL
+                 && xmlStrstr(xpath, (const xmlChar *) "key") != NULL) ) {
+            xmlFree(xpath);
+            Safefree(nodes);
+            XSRETURN_EMPTY;
+        }
+
+        for ( i = 0; i < count; i++ ) {
+            for ( top = nodes[i]; top->parent != NULL; top = top->parent )
+                ;
+            if ( top != last ) {
+                last = top;
+                xpc_domNodeNormalizeOrder( top, &data->indexes );
+            }
+        }
+
+        xpc_LibXML_init_error(ctxt);
+
+        /* compiled here to report syntax errors; every thread
+           compiles it again for itself */
+        comp = xmlXPathCtxtCompile( ctxt, xpath );
+        if ( comp != NULL ) {
+            xmlXPathFreeCompExpr(comp);
+            New(0, results, count, xmlXPathObjectPtr);
+            PUTBACK;
+            xpc_domXPathEvalMany( ctxt, xpath, nodes, results, count,
+                                  data->queryThreads );
+            SPAGAIN;
+        }
+        xmlFree(xpath);
+        for ( i = 0, last = NULL; i < count; i++ ) {
+            for ( top = nodes[i]; top->parent != NULL; top = top->parent )
+                ;
+            if ( top != last ) {
+                last = top;
+                xpc_domNodeClearOrder( top );
+            }
+        }
+        Safefree(nodes);
+
+        xpc_LibXML_croak_error(ctxt);
+
+        if ( results == NULL ) {
+            XSRETURN_EMPTY;
+        }
+        for ( i = 0; i < count; i++ ) {
+            if ( results[i] == NULL )
+                failed = 1;
+        }
+        if ( !failed ) {
+            EXTEND(SP, count);
+            for ( i = 0; i < count; i++ ) {
+                PUSHs( sv_2mortal(xpc_LibXML_result_to_sv(aTHX_ results[i])) );
+            }
+        }
+        /* a failed query is run again node by node to report the error */
+        for ( i = 0; i < count; i++ ) {
+            xmlXPathFreeObject(results[i]);
+        }
+        Safefree(results);
+
+
+MODULE = XML::LibXML::XPathContext     PACKAGE = XML::LibXML::XPathContext::PushStream
+
+void
+feed( self, pchunk = NULL )
+        SV * self
+        SV * pchunk
+    ALIAS:
+        finish = 1
+    PREINIT:
+        xpc_LibXML_PushStream * push = NULL;
+        xmlXPathContextPtr ctxt = NULL;
+        const char * chunk = NULL;
+        STRLEN len = 0;
+        int ret;
+    INIT:
+        push = (xpc_LibXML_PushStream *)SvIV(SvRV(self));
+        if ( push == NULL || push->stream == NULL ) {
+            croak("XPathContext: missing push stream");
+        }
+        if ( push->finished ) {
+            croak("XPathContext: push stream already finished");
+        }
+        ctxt = (xmlXPathContextPtr)SvIV(SvRV(push->context));
+        if ( pchunk != NULL ) {
+            SvGETMAGIC(pchunk);
+            if ( SvOK(pchunk) )
+                chunk = SvPV_nomg(pchunk, len);
+        }
+    PPCODE:
+        xpc_LibXML_init_error(ctxt);
+
+        if ( ix == 1 )
+            push->finished = 1;
+        ret = xpc_domPushStreamFeed(push->stream, chunk, (int)len, ix == 1);
+        if ( ret != 0 ) {
+            push->finished = 1;
+            if ( SvTRUE(ERRSV) && SvCUR(XPathContextDATA(ctxt)->error) == 0 ) {
+                croak("XPathContext: error coming back from push stream callback. %s",
+                      SvPV_nolen(ERRSV));
+            }
+            if ( SvCUR(XPathContextDATA(ctxt)->error) == 0 ) {
+                sv_catpvf(XPathContextDATA(ctxt)->error,
+                          "XPathContext: error %d while parsing\n", ret);
+            }
+        }
+
+        xpc_LibXML_croak_error(ctxt);
+
+void
+DESTROY( self )
+        SV * self
+    PREINIT:
+        xpc_LibXML_PushStream * push = NULL;
+    CODE:
+        push = (xpc_LibXML_PushStream *)SvIV(SvRV(self));
+        if ( push != NULL ) {
+            xpc_domPushStreamFree(push->stream);
+            SvREFCNT_dec(push->context);
+            SvREFCNT_dec((SV *)push->callbacks);
+            Safefree(push);
         }
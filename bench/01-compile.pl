@@ -0,0 +1,24 @@
+# compiling statements against evaluating them compiled already
+use strict;
+use XPCBench;
+
+my @statements = (
+    simple  => '/r/section/group',
+    complex => '/r/section/group[@k > 4 and position() mod 2 = 1]'
+             . '/item[@n mod 7 = 0 or contains(., "7")]/@id',
+);
+# a tiny document, so compiling is most of the work
+my %doc = (size => 10, depth => 2, fanout => 3);
+
+while (my ($name, $xpath) = splice @statements, 0, 2) {
+    for my $cache (0, 256) {
+        bench "compile/$name/" . ($cache ? 'cached' : 'uncached'),
+            params => { %doc, xpath => $xpath, cache => $cache },
+            setup  => sub {
+                my $xc = XML::LibXML::XPathContext->new(parse_xml(%doc));
+                $xc->setCompiledCache($cache);
+                return $xc;
+            },
+            run    => sub { $_[0]->find($xpath) };
+    }
+}
@@ -0,0 +1,30 @@
+# findnodes(), find() and findvalue() on documents of growing size
+use strict;
+use XPCBench;
+
+for my $size ($XPCBench::OPT{quick} ? (1_000) : (1_000, 100_000)) {
+    my %doc = (size => $size, depth => 4, fanout => 20, ns => 0.2);
+    my $xc;
+    my $setup = sub {
+        $xc ||= XML::LibXML::XPathContext->new(parse_xml(%doc));
+        $xc->registerNs(a => 'urn:a');
+        return $xc;
+    };
+    my %queries = (
+        'findnodes/descendant'  => [ findnodes => '//item[@k = 3]' ],
+        'findnodes/namespace'   => [ findnodes => '//a:item' ],
+        'findnodes/path'        => [ findnodes => '/r/section[1]/group/item' ],
+        'find/count'            => [ find      => 'count(//item[@n > 500])' ],
+        'find/boolean'          => [ find      => 'boolean(//group[@k = 9])' ],
+        'findvalue/first'       => [ findvalue => '//item[@id = 500]' ],
+        'findvalue/sum'         => [ findvalue => 'sum(//item/@n)' ],
+    );
+    for my $name (sort keys %queries) {
+        my ($method, $xpath) = @{$queries{$name}};
+        bench "$name/$size",
+            params => { %doc, xpath => $xpath },
+            setup  => $setup,
+            run    => sub { my @r = $_[0]->$method($xpath) },
+            items  => $size;
+    }
+}
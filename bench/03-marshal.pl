@@ -0,0 +1,24 @@
+# turning results into Perl objects, from 1 to a million nodes
+use strict;
+use XPCBench;
+
+for my $count (node_counts()) {
+    my %doc = (size => $count, depth => 1, fanout => $count);
+    my $setup = sub { XML::LibXML::XPathContext->new(parse_xml(%doc)) };
+
+    bench "marshal/findnodes/list/$count",
+        params => { %doc, xpath => '/r/*' },
+        setup  => $setup,
+        run    => sub { my @nodes = $_[0]->findnodes('/r/*') },
+        items  => $count;
+    bench "marshal/findnodes/nodelist/$count",
+        params => { %doc, xpath => '/r/*' },
+        setup  => $setup,
+        run    => sub { my $list = $_[0]->findnodes('/r/*') },
+        items  => $count;
+    bench "marshal/attributes/$count",
+        params => { %doc, xpath => '/r/*/@id' },
+        setup  => $setup,
+        run    => sub { my @nodes = $_[0]->findnodes('/r/*/@id') },
+        items  => $count;
+}
@@ -0,0 +1,33 @@
+# XPath extension functions written in Perl
+use strict;
+use XPCBench;
+
+my $size = $XPCBench::OPT{quick} ? 1_000 : 10_000;
+my %doc = (size => $size, depth => 3, fanout => 25);
+my $setup = sub {
+    my $xc = XML::LibXML::XPathContext->new(parse_xml(%doc));
+    $xc->registerFunction(same  => sub { $_[0] });
+    $xc->registerFunction(twice => sub { 2 * $_[0] });
+    $xc->registerFunction(first => sub {
+        my @nodes = $_[0]->get_nodelist;
+        return XML::LibXML::NodeList->new(@nodes ? $nodes[0] : ());
+    });
+    $xc->registerFunctionNS(upper => 'urn:f', sub { uc $_[0] });
+    $xc->registerNs(f => 'urn:f');
+    return $xc;
+};
+
+my %calls = (
+    'functions/number'   => [ 'count(//item[twice(number(@n)) > 1000])', $size ],
+    'functions/string'   => [ 'count(//item[f:upper(string(@k)) = "3"])', $size ],
+    'functions/nodeset'  => [ 'count(//group[first(item)/@k = 1])', $size / 25 ],
+    'functions/once'     => [ 'same(42)', 1 ],
+);
+for my $name (sort keys %calls) {
+    my ($xpath, $items) = @{$calls{$name}};
+    bench $name,
+        params => { %doc, xpath => $xpath },
+        setup  => $setup,
+        run    => sub { $_[0]->find($xpath) },
+        items  => $items;
+}
@@ -0,0 +1,27 @@
+# variables looked up through a Perl function
+use strict;
+use XPCBench;
+
+my $size = $XPCBench::OPT{quick} ? 1_000 : 10_000;
+my %doc = (size => $size, depth => 3, fanout => 25);
+my %vars = (k => 3, n => 500, name => 'item');
+my $setup = sub {
+    my $xc = XML::LibXML::XPathContext->new(parse_xml(%doc));
+    $xc->registerVarLookupFunc(sub { $_[0]->{$_[1]} }, \%vars);
+    $vars{groups} = $xc->findnodes('//group');
+    return $xc;
+};
+
+my %lookups = (
+    'variables/once'     => [ '//item[@k = $k]', 1 ],
+    'variables/per-node' => [ 'count(//item[@k = $k and @n > $n])', 2 * $size ],
+    'variables/nodeset'  => [ 'count($groups/item)', 1 ],
+);
+for my $name (sort keys %lookups) {
+    my ($xpath, $items) = @{$lookups{$name}};
+    bench $name,
+        params => { %doc, xpath => $xpath },
+        setup  => $setup,
+        run    => sub { my @r = $_[0]->find($xpath) },
+        items  => $items;
+}
@@ -0,0 +1,34 @@
+# queries on nodes which belong to no document
+use strict;
+use XPCBench;
+
+my $size = $XPCBench::OPT{quick} ? 100 : 1_000;
+
+my $setup = sub {
+    my $root = XML::LibXML::Element->new('r');
+    for my $i (1 .. $size) {
+        my $item = XML::LibXML::Element->new('item');
+        $item->setAttribute(id => $i);
+        $item->setAttribute(k => $i % 10);
+        $item->appendChild(XML::LibXML::Element->new('name'));
+        $root->appendChild($item);
+    }
+    my $xc = XML::LibXML::XPathContext->new($root);
+    return [ $xc, ($xc->findnodes('item'))[$size / 2] ];
+};
+
+bench 'fragments/children',
+    params => { size => $size, xpath => 'item[@k = 3]' },
+    setup  => $setup,
+    run    => sub { my @r = $_[0][0]->findnodes('item[@k = 3]') },
+    items  => $size;
+bench 'fragments/descendant',
+    params => { size => $size, xpath => '//name' },
+    setup  => $setup,
+    run    => sub { my @r = $_[0][0]->findnodes('//name') },
+    items  => $size;
+bench 'fragments/ancestor',
+    params => { size => $size, xpath => 'ancestor::r/@*' },
+    setup  => $setup,
+    run    => sub { my @r = $_[0][0]->findnodes('ancestor::r/@*', $_[0][1]) },
+    items  => 1;
@@ -0,0 +1,41 @@
+# document(), from registered documents, strings and files
+use strict;
+use XPCBench;
+
+use File::Temp ();
+
+my %doc = (size => 1_000, depth => 3, fanout => 10);
+my $xml = XPCBench::generate_xml(%doc);
+
+my $file = File::Temp->new(SUFFIX => '.xml');
+print $file $xml;
+close $file;
+
+bench 'documents/registered',
+    params => { %doc, source => 'document' },
+    setup  => sub {
+        my $xc = XML::LibXML::XPathContext->new(parse_xml(size => 1));
+        $xc->registerDocument('other.xml', XML::LibXML->new->parse_string($xml));
+        return $xc;
+    },
+    run    => sub { $_[0]->find('count(document("other.xml")//item)') };
+bench 'documents/string',
+    params => { %doc, source => 'string' },
+    setup  => sub {
+        my $xc = XML::LibXML::XPathContext->new(parse_xml(size => 1));
+        $xc->registerDocument('other.xml', \$xml);
+        return $xc;
+    },
+    run    => sub { $_[0]->find('count(document("other.xml")//item)') };
+bench 'documents/file',
+    params => { %doc, source => 'file' },
+    setup  => sub { XML::LibXML::XPathContext->new(parse_xml(size => 1)) },
+    run    => sub { $_[0]->find(qq{count(document("$file")//item)}) };
+bench 'documents/nodeset',
+    params => { %doc, source => 'file', uris => 50 },
+    setup  => sub {
+        my $refs = '<refs>' . ("<ref href='$file'/>" x 50) . '</refs>';
+        XML::LibXML::XPathContext->new(XML::LibXML->new->parse_string($refs));
+    },
+    run    => sub { $_[0]->find('count(document(//ref/@href)//item)') },
+    items  => 50;
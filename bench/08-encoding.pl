@@ -0,0 +1,25 @@
+# statements and results crossing into documents not in UTF-8
+use strict;
+use XPCBench;
+
+my %doc = (size => 100, depth => 3, fanout => 5);
+
+for my $encoding ('UTF-8', 'ISO-8859-1', 'Shift_JIS') {
+    my $setup = sub {
+        my $xml = XPCBench::generate_xml(%doc, encoding => $encoding);
+        XML::LibXML::XPathContext->new(XML::LibXML->new->parse_string($xml));
+    };
+    bench "encoding/$encoding/ascii",
+        params => { %doc, encoding => $encoding },
+        setup  => $setup,
+        run    => sub { $_[0]->findvalue('string(//item[@id = 50]/@k)') };
+    bench "encoding/$encoding/text",
+        params => { %doc, encoding => $encoding },
+        setup  => $setup,
+        run    => sub { $_[0]->findvalue('//item[@id = 50]') };
+    bench "encoding/$encoding/tagname",
+        params => { %doc, encoding => $encoding },
+        setup  => $setup,
+        run    => sub { my @r = $_[0]->getElementsByTagName('item') },
+        items  => 70;
+}
@@ -0,0 +1,83 @@
+# indexes, tag names, serialization, export and streaming
+use strict;
+use XPCBench;
+
+use File::Temp ();
+
+my $size = $XPCBench::OPT{quick} ? 1_000 : 100_000;
+# wide enough for most elements to be items three levels down
+my %doc = (size => $size, depth => 3, fanout => int($size ** (1 / 3)) + 2);
+my $xc;
+my $setup = sub { $xc ||= XML::LibXML::XPathContext->new(parse_xml(%doc)) };
+
+bench "index/name/$size",
+    params => { %doc, xpath => '//item' },
+    setup  => sub { my $c = $setup->()->clone; $c->setNameIndex(1); $c },
+    run    => sub { my $list = $_[0]->findnodes('//item') },
+    items  => $size;
+bench "index/attribute/$size",
+    params => { %doc, xpath => '//item[@k = "3"]' },
+    setup  => sub { my $c = $setup->()->clone; $c->indexAttribute('item', 'k'); $c },
+    run    => sub { my $list = $_[0]->findnodes('//item[@k = "3"]') },
+    items  => $size;
+bench "index/numbers/$size",
+    params => { %doc, xpath => '//item[@n > 990]' },
+    setup  => sub { my $c = $setup->()->clone; $c->indexNumbers('item', 'n'); $c },
+    run    => sub { my $list = $_[0]->findnodes('//item[@n > 990]') },
+    items  => $size;
+bench "key/$size",
+    params => { %doc, xpath => 'count(key("k", "3"))' },
+    setup  => sub { my $c = $setup->()->clone; $c->registerKey('k', '//item', '@k'); $c },
+    run    => sub { $_[0]->find('count(key("k", "3"))') },
+    items  => $size;
+bench "tagname/$size",
+    params => \%doc,
+    setup  => $setup,
+    run    => sub { my $list = $_[0]->getElementsByTagName('item') },
+    items  => $size;
+bench "serialize/$size",
+    params => { %doc, xpath => '//group' },
+    setup  => $setup,
+    run    => sub { my $xml = $_[0]->findserialize('//group') },
+    items  => $size;
+bench "export/csv/$size",
+    params => { %doc, xpath => '//item', columns => 3 },
+    setup  => $setup,
+    run    => sub {
+        my $csv = $_[0]->findexport('//item', [ id => '@id', n => '@n', text => '.' ]);
+    },
+    items  => $size;
+
+my $file = File::Temp->new(SUFFIX => '.xml');
+print $file XPCBench::generate_xml(%doc);
+close $file;
+
+bench "stream/find/$size",
+    params => { %doc, pattern => '//item' },
+    setup  => $setup,
+    run    => sub { $_[0]->streamfind("$file", '//item', sub { }) },
+    items  => $size;
+bench "stream/export/$size",
+    params => { %doc, pattern => '//item', columns => 2 },
+    setup  => $setup,
+    run    => sub {
+        my $csv = $_[0]->findexport('//item', [ id => '@id', n => '@n' ], undef,
+                                    stream => "$file");
+    },
+    items  => $size;
+bench "stream/push/$size",
+    params => { %doc, pattern => '//item', chunk => 65536 },
+    setup  => sub {
+        open my $fh, '<', "$file" or die "cannot read $file: $!\n";
+        local $/;
+        return [ $setup->(), scalar <$fh> ];
+    },
+    run    => sub {
+        my ($c, $xml) = @{$_[0]};
+        my $stream = $c->newPushStream('//item' => sub { });
+        for (my $at = 0; $at < length $xml; $at += 65536) {
+            $stream->feed(substr $xml, $at, 65536);
+        }
+        $stream->finish;
+    },
+    items  => $size;
@@ -0,0 +1,192 @@
+package XPCBench;
+
+# helpers shared by the benchmarks in bench/: a generator of synthetic
+# documents, the registry of the benchmarks and the timing loop. see
+# bench/run.pl.
+
+use strict;
+use vars qw(@ISA @EXPORT %OPT);
+
+use Exporter;
+use Time::HiRes ();
+
+@ISA = qw(Exporter);
+@EXPORT = qw(bench generate_xml parse_xml node_counts);
+
+# set by bench/run.pl from the command line
+%OPT = (
+    quick     => 0,          # smaller documents, shorter runs
+    min_time  => 0.5,        # seconds to spend per sample at least
+    samples   => 5,
+    max_nodes => 1_000_000,  # the largest result marshaled
+);
+
+my @cases;
+
+# bench($name, params => \%params, setup => sub { ... }, run => sub { ... },
+#       items => $n)
+#
+# registers a benchmark. setup is called once and returns the state
+# passed to run, which is timed; items is the number of things one run
+# handles, for the rate reported.
+sub bench {
+    my ($name, %case) = @_;
+    die "benchmark $name has no run\n" unless ref $case{run} eq 'CODE';
+    push @cases, { name => $name, %case };
+}
+
+# (1, 10, ... ) up to the largest result to marshal
+sub node_counts {
+    my $max = $OPT{quick} ? 10_000 : $OPT{max_nodes};
+    my @counts;
+    for (my $n = 1; $n <= $max; $n *= 10) {
+        push @counts, $n;
+    }
+    return @counts;
+}
+
+# Park-Miller, exact in doubles, so documents are the same everywhere
+sub _random {
+    my ($seed) = @_;
+    $$seed = ($$seed * 16807) % 2147483647;
+    return $$seed / 2147483647;
+}
+
+# generate_xml(size => 1000, depth => 4, fanout => 8, ns => 0.25, ...)
+#
+# returns a document of size elements below the root, filled breadth
+# first at most depth levels deep with fanout children each. every
+# element has an id, a number n and a category k; leaves have text.
+# ns is the share of elements in one of three namespaces declared on
+# the root, bound to the prefixes a, b and c. with encoding the
+# document is declared and encoded in it, and text holds characters
+# outside ASCII. the same parameters always give the same document.
+sub generate_xml {
+    my %p = (size => 1000, depth => 4, fanout => 8, ns => 0, seed => 1,
+             encoding => undef, @_);
+    my $seed = $p{seed};
+    my @names = qw(r section group item);
+    my (@depth, @kids);
+
+    $depth[0] = 0;
+    my $next = 1;
+    for (my $i = 0; $i < @depth && $next <= $p{size}; $i++) {
+        next if $depth[$i] >= $p{depth};
+        for (1 .. $p{fanout}) {
+            last if $next > $p{size};
+            $depth[$next] = $depth[$i] + 1;
+            push @{$kids[$i]}, $next++;
+        }
+    }
+
+    my $text = defined $p{encoding} ? "\x{e9}t\x{e9} \x{65e5}" : 'text';
+    my $xml = '';
+    my $element;
+    $element = sub {
+        my ($i) = @_;
+        my $name = $names[$depth[$i] > 3 ? 3 : $depth[$i]];
+        $name = ('a', 'b', 'c')[$i % 3] . ":$name"
+            if $i > 0 && _random(\$seed) < $p{ns};
+        $xml .= "<$name id=\"$i\" n=\"" . int(_random(\$seed) * 1000)
+              . '" k="' . int(_random(\$seed) * 10) . '"';
+        $xml .= ' xmlns:a="urn:a" xmlns:b="urn:b" xmlns:c="urn:c"' if $i == 0;
+        if ($kids[$i]) {
+            $xml .= '>';
+            $element->($_) for @{$kids[$i]};
+            $xml .= "</$name>";
+        }
+        else {
+            $xml .= ">$text $i</$name>";
+        }
+    };
+    $element->(0);
+    undef $element;
+
+    return qq{<?xml version="1.0"?>\n$xml} unless defined $p{encoding};
+
+    require Encode;
+    my $encoding = $p{encoding};
+    return Encode::encode($encoding,
+                          qq{<?xml version="1.0" encoding="$encoding"?>\n$xml},
+                          sub { sprintf '&#%d;', shift });
+}
+
+sub parse_xml {
+    require XML::LibXML;
+    return XML::LibXML->new->parse_string(generate_xml(@_));
+}
+
+sub _time {
+    my ($case, $state, $iterations) = @_;
+    my $start = Time::HiRes::time();
+    $case->{run}->($state) for 1 .. $iterations;
+    return (Time::HiRes::time() - $start) / $iterations;
+}
+
+# runs the benchmarks whose names match $only and returns their results
+sub run {
+    my ($only, $report) = @_;
+    my @results;
+
+    for my $case (@cases) {
+        next if defined $only && $case->{name} !~ $only;
+        my $state = $case->{setup} ? $case->{setup}->() : undef;
+
+        # as many runs per sample as fill min_time
+        my $once = _time($case, $state, 1);
+        my $iterations = $once > 0 ? int($OPT{min_time} / $once) : 1000;
+        $iterations = 1 if $iterations < 1;
+
+        my @samples = sort { $a <=> $b }
+                      map { _time($case, $state, $iterations) } 1 .. $OPT{samples};
+        my $median = $samples[$#samples / 2];
+        my $items = $case->{items} || 1;
+        my $result = {
+            name       => $case->{name},
+            params     => $case->{params} || {},
+            iterations => $iterations,
+            samples    => scalar @samples,
+            median_s   => $median,
+            min_s      => $samples[0],
+            max_s      => $samples[-1],
+            items      => $items,
+            items_per_s => $median > 0 ? $items / $median : 0,
+        };
+        $report->($result) if $report;
+        push @results, $result;
+    }
+    return @results;
+}
+
+# a small JSON writer, so the suite runs on any perl; keys are sorted
+# to keep files of different runs comparable with diff
+sub to_json {
+    my ($value, $indent) = @_;
+    $indent = '' unless defined $indent;
+    my $inner = "$indent  ";
+
+    if (ref $value eq 'HASH') {
+        return '{}' unless %$value;
+        return "{\n" . join(",\n", map {
+            $inner . _json_string($_) . ': ' . to_json($value->{$_}, $inner)
+        } sort keys %$value) . "\n$indent}";
+    }
+    if (ref $value eq 'ARRAY') {
+        return '[]' unless @$value;
+        return "[\n" . join(",\n", map {
+            $inner . to_json($_, $inner)
+        } @$value) . "\n$indent]";
+    }
+    return 'null' unless defined $value;
+    return $value if $value =~ /^-?(?:0|[1-9]\d*)(?:\.\d+)?(?:[eE][-+]?\d+)?$/;
+    return _json_string($value);
+}
+
+sub _json_string {
+    my ($string) = @_;
+    $string =~ s/(["\\])/\\$1/g;
+    $string =~ s/([\x00-\x1f])/sprintf '\\u%04x', ord $1/ge;
+    return qq{"$string"};
+}
+
+1;
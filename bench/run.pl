@@ -0,0 +1,68 @@
+#!/usr/bin/perl
+#
+# runs the benchmarks of bench/*.pl and writes their results as JSON:
+#
+#   perl -Mblib bench/run.pl [--quick] [--only REGEX] [--out FILE]
+#                            [--min-time SECONDS] [--samples N]
+#                            [--max-nodes N]
+#
+# the results name the versions of the module, libxml2 and perl, and
+# for every benchmark its parameters and the median, minimum and
+# maximum time of one run over the samples taken, so files of two
+# releases can be compared benchmark by benchmark.
+
+use strict;
+
+use FindBin;
+use lib $FindBin::Bin;
+use Getopt::Long;
+
+use XML::LibXML;
+use XML::LibXML::XPathContext;
+use XPCBench;
+
+my ($only, $out);
+GetOptions(
+    'quick'      => \$XPCBench::OPT{quick},
+    'only=s'     => \$only,
+    'out=s'      => \$out,
+    'min-time=f' => \$XPCBench::OPT{min_time},
+    'samples=i'  => \$XPCBench::OPT{samples},
+    'max-nodes=i' => \$XPCBench::OPT{max_nodes},
+) or die "usage: $0 [--quick] [--only REGEX] [--out FILE] [--min-time S]"
+        . " [--samples N] [--max-nodes N]\n";
+if ($XPCBench::OPT{quick}) {
+    $XPCBench::OPT{min_time} = 0.1;
+    $XPCBench::OPT{samples}  = 3;
+}
+
+for my $file (sort glob("$FindBin::Bin/[0-9]*.pl")) {
+    do $file;
+    die "$file: $@" if $@;
+}
+
+my @results = XPCBench::run(defined $only ? qr/$only/ : undef, sub {
+    my $r = shift;
+    printf STDERR "%-40s %12.3f us %14.0f items/s\n",
+                  $r->{name}, $r->{median_s} * 1e6, $r->{items_per_s};
+});
+
+my $json = XPCBench::to_json({
+    module  => { name => 'XML::LibXML::XPathContext',
+                 version => $XML::LibXML::XPathContext::VERSION },
+    libxml2 => defined &XML::LibXML::LIBXML_DOTTED_VERSION
+               ? XML::LibXML::LIBXML_DOTTED_VERSION() : undef,
+    perl    => sprintf('%vd', $^V),
+    time    => time,
+    options => { %XPCBench::OPT },
+    results => \@results,
+}) . "\n";
+
+if (defined $out) {
+    open my $fh, '>', $out or die "cannot write $out: $!\n";
+    print $fh $json;
+    close $fh;
+}
+else {
+    print $json;
+}
@@ -806,6 +806,129 @@ xpc_domGetElementsByTagNameNS( xmlNodePtr n, xmlChar* nsURI, xmlChar* name ){
     return rv;
 }
 
+/* whether name equals the string want, which is interned if the
+ * document's dictionary holds it: names from the parser are compared by
+ * pointer, others by their characters */
+static int
+xpc_domNameIs( const xmlChar * name, const xmlChar * want,
+               const xmlChar * interned )
+{
+    if ( name == interned )
+        return 1;
+    return name != NULL && name[0] == want[0] && xmlStrEqual( name, want );
+}
+
+/* the descendants of n matching as described for the two functions
+ * below, with ns being the namespace prefix if byPrefix is set and the
+ * namespace URI otherwise; NULL stands for none, "*" for any */
+static xmlNodeSetPtr
+xpc_domGetDescendants( xmlNodePtr n, const xmlChar * name,
+                       int byPrefix, const xmlChar * ns )
+{
+    xmlNodeSetPtr rv = NULL;
+    xmlNodePtr cld = NULL;
+    xmlNodePtr * tab = NULL;
+    xmlNsPtr lastNs = NULL;
+    const xmlChar * interned = NULL;
+    int anyName, anyNs, haveLast = 0, lastMatch = 0, nodeNr = 0, nodeMax = 0;
+
+    if ( n == NULL || name == NULL )
+        return NULL;
+    if ( n->type == XML_DOCUMENT_NODE || n->type == XML_HTML_DOCUMENT_NODE
+         || n->type == XML_DOCUMENT_FRAG_NODE || n->type == XML_ELEMENT_NODE )
+        cld = n->children;
+
+    anyName = xmlStrEqual( name, (const xmlChar *) "*" );
+    anyNs   = xmlStrEqual( ns, (const xmlChar *) "*" );
+    if ( !anyName && n->doc != NULL && n->doc->dict != NULL )
+        interned = xmlDictExists( n->doc->dict, name, -1 );
+
+    while ( cld != NULL ) {
+        if ( cld->type == XML_ELEMENT_NODE ) {
+            int match = anyName || xpc_domNameIs( cld->name, name, interned );
+
+            if ( match && !anyNs ) {
+                /* elements mostly share few namespace declarations */
+                if ( !haveLast || cld->ns != lastNs ) {
+                    haveLast = 1;
+                    lastNs = cld->ns;
+                    if ( cld->ns == NULL )
+                        lastMatch = ns == NULL;
+                    else if ( byPrefix )
+                        lastMatch = xmlStrEqual( cld->ns->prefix, ns );
+                    else
+                        lastMatch = xmlStrEqual( cld->ns->href, ns );
+                }
+                match = lastMatch;
+            }
+            if ( match ) {
+                if ( nodeNr == nodeMax ) {
+                    int max = nodeMax > 0 ? 2 * nodeMax : 16;
+                    xmlNodePtr * grown = (xmlNodePtr *)
+                        xmlRealloc( tab, max * sizeof(xmlNodePtr) );
+                    if ( grown == NULL ) {
+                        xmlFree( tab );
+                        return NULL;
+                    }
+                    tab = grown;
+                    nodeMax = max;
+                }
+                tab[nodeNr++] = cld;
+            }
+            if ( cld->children != NULL ) {
+                cld = cld->children;
+                continue;
+            }
+        }
+        while ( cld != NULL && cld->next == NULL ) {
+            cld = cld->parent;
+            if ( cld == n )
+                cld = NULL;
+        }
+        if ( cld != NULL )
+            cld = cld->next;
+    }
+
+    rv = xmlXPathNodeSetCreate( NULL );
+    if ( rv == NULL ) {
+        xmlFree( tab );
+        return NULL;
+    }
+    rv->nodeTab = tab;
+    rv->nodeNr  = nodeNr;
+    rv->nodeMax = nodeMax;
+    return rv;
+}
+
+xmlNodeSetPtr
+xpc_domGetDescendantsByTagName( xmlNodePtr n, const xmlChar * name )
+{
+    const xmlChar * local;
+    xmlNodeSetPtr rv;
+    xmlChar * prefix;
+
+    if ( name == NULL )
+        return NULL;
+    if ( xmlStrEqual( name, (const xmlChar *) "*" ) )
+        return xpc_domGetDescendants( n, name, 1, name );
+    local = xmlStrchr( name, ':' );
+    if ( local == NULL )
+        return xpc_domGetDescendants( n, name, 1, NULL );
+    prefix = xmlStrndup( name, local - name );
+    rv = xpc_domGetDescendants( n, local + 1, 1, prefix );
+    xmlFree( prefix );
+    return rv;
+}
+
+xmlNodeSetPtr
+xpc_domGetDescendantsByTagNameNS( xmlNodePtr n, const xmlChar * nsURI,
+                                  const xmlChar * name )
+{
+    if ( nsURI != NULL && *nsURI == 0 )
+        nsURI = NULL;
+    return xpc_domGetDescendants( n, name, 0, nsURI );
+}
+
 xmlNsPtr
 xpc_domNewNs ( xmlNodePtr elem , xmlChar *prefix, xmlChar *href ) {
     xmlNsPtr ns = NULL;
@@ -231,6 +231,23 @@ xpc_domGetElementsByTagName( xmlNodePtr self, xmlChar* name );
 xmlNodeSetPtr
 xpc_domGetElementsByTagNameNS( xmlNodePtr self, xmlChar* nsURI, xmlChar* name );
 
+/**
+ * the element descendants of self in document order whose qualified
+ * name is name, "*" for all of them. unlike the two functions above
+ * these search the whole subtree, without recursion, and compare names
+ * by pointer where the document dictionary holds them.
+ **/
+xmlNodeSetPtr
+xpc_domGetDescendantsByTagName( xmlNodePtr self, const xmlChar* name );
+
+/**
+ * the same by local name and namespace URI, "*" matching any; a NULL or
+ * empty nsURI matches elements in no namespace.
+ **/
+xmlNodeSetPtr
+xpc_domGetDescendantsByTagNameNS( xmlNodePtr self, const xmlChar* nsURI,
+                                  const xmlChar* name );
+
 xmlNsPtr
 xpc_domNewNs ( xmlNodePtr elem , xmlChar *prefix, xmlChar *href );
 
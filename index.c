@@ -0,0 +1,765 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <libxml/tree.h>
+#include <libxml/hash.h>
+#include <libxml/xpath.h>
+#include <libxml/xpathInternals.h>
+
+#include "index.h"
+
+/* the elements of one name, in document order */
+typedef struct _xpc_NodeArray {
+    int nodeNr;
+    int nodeMax;
+    xmlNodePtr * nodeTab;
+} xpc_NodeArray;
+
+/* the numeric values of an attribute, sorted, with the positions of
+ * their elements in the array of the elements of that name */
+typedef struct _xpc_NumberEntry {
+    double value;
+    int ordinal;
+} xpc_NumberEntry;
+
+typedef struct _xpc_NumberIndex {
+    int count;
+    xpc_NumberEntry * tab;
+} xpc_NumberIndex;
+
+struct _xpc_DocIndex {
+    xmlDocPtr doc;
+    xmlHashTablePtr names;   /* (local name, namespace) -> xpc_NodeArray */
+    xmlHashTablePtr attrs;   /* element and attribute -> value -> xpc_NodeArray */
+    xmlHashTablePtr numbers; /* element and attribute -> xpc_NumberIndex */
+    size_t memory;
+    int count;               /* the elements of doc when it was built */
+    unsigned long signature; /* and their xpc_domIndexSign() */
+    xpc_DocIndex * next;
+};
+
+static void
+xpc_domIndexFreeArray( void * payload, const xmlChar * name )
+{
+    xpc_NodeArray * arr = (xpc_NodeArray *) payload;
+
+    xmlFree( arr->nodeTab );
+    xmlFree( arr );
+}
+
+static void
+xpc_domIndexFreeValues( void * payload, const xmlChar * name )
+{
+    xmlHashFree( (xmlHashTablePtr) payload, xpc_domIndexFreeArray );
+}
+
+static void
+xpc_domIndexFreeNumbers( void * payload, const xmlChar * name )
+{
+    xpc_NumberIndex * numbers = (xpc_NumberIndex *) payload;
+
+    xmlFree( numbers->tab );
+    xmlFree( numbers );
+}
+
+static void
+xpc_domIndexFree( xpc_DocIndex * idx )
+{
+    if ( idx->names != NULL )
+        xmlHashFree( idx->names, xpc_domIndexFreeArray );
+    if ( idx->attrs != NULL )
+        xmlHashFree( idx->attrs, xpc_domIndexFreeValues );
+    if ( idx->numbers != NULL )
+        xmlHashFree( idx->numbers, xpc_domIndexFreeNumbers );
+    xmlFree( idx );
+}
+
+/* unlinks the index of doc from the list and returns it */
+static xpc_DocIndex *
+xpc_domIndexUnlink( xpc_DocIndex ** indexes, xmlDocPtr doc )
+{
+    xpc_DocIndex ** prev;
+    xpc_DocIndex * idx;
+
+    for ( prev = indexes; *prev != NULL; prev = &(*prev)->next ) {
+        if ( (*prev)->doc == doc ) {
+            idx = *prev;
+            *prev = idx->next;
+            return idx;
+        }
+    }
+    return NULL;
+}
+
+void
+xpc_domIndexDrop( xpc_DocIndex ** indexes, xmlDocPtr doc )
+{
+    xpc_DocIndex * idx = xpc_domIndexUnlink( indexes, doc );
+
+    if ( idx != NULL )
+        xpc_domIndexFree( idx );
+}
+
+void
+xpc_domIndexDropAll( xpc_DocIndex ** indexes )
+{
+    xpc_DocIndex * idx;
+
+    while ( *indexes != NULL ) {
+        idx = *indexes;
+        *indexes = idx->next;
+        xpc_domIndexFree( idx );
+    }
+}
+
+int
+xpc_domIndexHas( xpc_DocIndex * indexes, xmlDocPtr doc )
+{
+    for ( ; indexes != NULL; indexes = indexes->next ) {
+        if ( indexes->doc == doc )
+            return 1;
+    }
+    return 0;
+}
+
+#define XPC_SIGN(sig, value) \
+    ( ((sig) ^ (unsigned long)(value)) * 1099511628211UL )
+
+unsigned long
+xpc_domIndexSign( unsigned long sig, xmlNodePtr elem )
+{
+    xmlAttrPtr attr;
+    xmlNodePtr text;
+    const xmlChar * c;
+
+    sig = XPC_SIGN( sig, (size_t) elem );
+    for ( c = elem->name; c != NULL && *c != 0; c++ )
+        sig = XPC_SIGN( sig, *c );
+    sig = XPC_SIGN( sig, 0 );
+    if ( elem->ns != NULL ) {
+        for ( c = elem->ns->href; c != NULL && *c != 0; c++ )
+            sig = XPC_SIGN( sig, *c );
+    }
+    sig = XPC_SIGN( sig, 0 );
+    for ( attr = elem->properties; attr != NULL; attr = attr->next ) {
+        sig = XPC_SIGN( sig, (size_t) attr->name );
+        for ( text = attr->children; text != NULL; text = text->next ) {
+            for ( c = text->content; c != NULL && *c != 0; c++ )
+                sig = XPC_SIGN( sig, *c );
+        }
+        sig = XPC_SIGN( sig, 0 );
+    }
+    return sig;
+}
+
+void
+xpc_domIndexCheck( xpc_DocIndex ** indexes, xmlDocPtr doc, int count,
+                   unsigned long signature )
+{
+    xpc_DocIndex * idx;
+
+    for ( idx = *indexes; idx != NULL; idx = idx->next ) {
+        if ( idx->doc == doc ) {
+            if ( idx->count != count || idx->signature != signature )
+                xpc_domIndexDrop( indexes, doc );
+            return;
+        }
+    }
+}
+
+/* calls visit for every element of doc in document order */
+static int
+xpc_domIndexWalk( xmlDocPtr doc, int (*visit)( xmlNodePtr node, void * data ),
+                  void * data )
+{
+    xmlNodePtr cur = doc->children;
+
+    while ( cur != NULL ) {
+        if ( cur->type == XML_ELEMENT_NODE && visit( cur, data ) != 0 )
+            return -1;
+        if ( cur->type != XML_DTD_NODE && cur->children != NULL
+             && cur->children->type != XML_ENTITY_DECL ) {
+            cur = cur->children;
+            continue;
+        }
+        while ( cur != NULL && cur->next == NULL ) {
+            cur = cur->parent;
+            if ( cur == (xmlNodePtr) doc )
+                cur = NULL;
+        }
+        if ( cur != NULL )
+            cur = cur->next;
+    }
+    return 0;
+}
+
+static int
+xpc_domIndexSignOne( xmlNodePtr node, void * data )
+{
+    xpc_DocIndex * idx = (xpc_DocIndex *) data;
+
+    idx->count++;
+    idx->signature = xpc_domIndexSign( idx->signature, node );
+    return 0;
+}
+
+void
+xpc_domIndexRevalidate( xpc_DocIndex ** indexes, xmlDocPtr doc )
+{
+    xpc_DocIndex now;
+
+    if ( !xpc_domIndexHas( *indexes, doc ) )
+        return;
+    now.count     = 0;
+    now.signature = 0;
+    xpc_domIndexWalk( doc, xpc_domIndexSignOne, &now );
+    xpc_domIndexCheck( indexes, doc, now.count, now.signature );
+}
+
+static int
+xpc_domIndexPush( xpc_DocIndex * idx, xpc_NodeArray * arr, xmlNodePtr node )
+{
+    xmlNodePtr * tab;
+
+    if ( arr->nodeNr == arr->nodeMax ) {
+        int max = arr->nodeMax > 0 ? 2 * arr->nodeMax : 4;
+        tab = (xmlNodePtr *) xmlRealloc( arr->nodeTab, max * sizeof(xmlNodePtr) );
+        if ( tab == NULL )
+            return -1;
+        idx->memory += (max - arr->nodeMax) * sizeof(xmlNodePtr);
+        arr->nodeTab = tab;
+        arr->nodeMax = max;
+    }
+    arr->nodeTab[arr->nodeNr++] = node;
+    return 0;
+}
+
+static int
+xpc_domIndexAdd( xpc_DocIndex * idx, xmlNodePtr node )
+{
+    const xmlChar * href = node->ns != NULL ? node->ns->href : NULL;
+    xpc_NodeArray * arr;
+
+    arr = (xpc_NodeArray *) xmlHashLookup2( idx->names, node->name, href );
+    if ( arr == NULL ) {
+        arr = (xpc_NodeArray *) xmlMalloc( sizeof(xpc_NodeArray) );
+        if ( arr == NULL )
+            return -1;
+        arr->nodeNr  = 0;
+        arr->nodeMax = 0;
+        arr->nodeTab = NULL;
+        if ( xmlHashAddEntry2( idx->names, node->name, href, arr ) != 0 ) {
+            xmlFree( arr );
+            return -1;
+        }
+        /* the entry and its keys */
+        idx->memory += sizeof(xpc_NodeArray) + 4 * sizeof(void *)
+                       + xmlStrlen( node->name ) + xmlStrlen( href ) + 2;
+    }
+    return xpc_domIndexPush( idx, arr, node );
+}
+
+static int
+xpc_domIndexAddOne( xmlNodePtr node, void * data )
+{
+    xpc_DocIndex * idx = (xpc_DocIndex *) data;
+
+    xpc_domIndexSignOne( node, idx );
+    return xpc_domIndexAdd( idx, node );
+}
+
+/* one pass over the nodes the descendant axis of the document visits */
+static xpc_DocIndex *
+xpc_domIndexBuild( xmlDocPtr doc )
+{
+    xpc_DocIndex * idx;
+
+    idx = (xpc_DocIndex *) xmlMalloc( sizeof(xpc_DocIndex) );
+    if ( idx == NULL )
+        return NULL;
+    idx->doc    = doc;
+    idx->memory = sizeof(xpc_DocIndex);
+    idx->next   = NULL;
+    idx->attrs  = NULL;
+    idx->numbers = NULL;
+    idx->count  = 0;
+    idx->signature = 0;
+    idx->names  = xmlHashCreate( 64 );
+    if ( idx->names == NULL ) {
+        xmlFree( idx );
+        return NULL;
+    }
+    if ( xpc_domIndexWalk( doc, xpc_domIndexAddOne, idx ) != 0 ) {
+        xpc_domIndexFree( idx );
+        return NULL;
+    }
+    return idx;
+}
+
+/* whether node still is an element of that name within doc */
+static int
+xpc_domIndexValid( xmlDocPtr doc, xmlNodePtr node, const xmlChar * name,
+                   const xmlChar * href )
+{
+    if ( node->type != XML_ELEMENT_NODE || node->doc != doc
+         || !xmlStrEqual( node->name, name )
+         || !xmlStrEqual( node->ns != NULL ? node->ns->href : NULL, href ) )
+        return 0;
+    while ( node->parent != NULL )
+        node = node->parent;
+    return node == (xmlNodePtr) doc;
+}
+
+/* the index of doc, built if there is none */
+static xpc_DocIndex *
+xpc_domIndexGet( xpc_DocIndex ** indexes, xmlDocPtr doc )
+{
+    xpc_DocIndex * idx;
+
+    for ( idx = *indexes; idx != NULL; idx = idx->next ) {
+        if ( idx->doc == doc )
+            return idx;
+    }
+    idx = xpc_domIndexBuild( doc );
+    if ( idx != NULL ) {
+        idx->next = *indexes;
+        *indexes  = idx;
+    }
+    return idx;
+}
+
+/* a copy of nodes which are all still valid for the index, NULL if
+ * one of them is not */
+static xmlNodeSetPtr
+xpc_domIndexCopy( const xpc_NodeArray * arr, int (*valid)( xmlNodePtr node,
+                                                           void * data ),
+                  void * data )
+{
+    xmlNodeSetPtr ret;
+    int i;
+
+    for ( i = 0; arr != NULL && i < arr->nodeNr; i++ ) {
+        if ( !valid( arr->nodeTab[i], data ) )
+            return NULL;
+    }
+    ret = xmlXPathNodeSetCreate( NULL );
+    if ( ret == NULL || arr == NULL || arr->nodeNr == 0 )
+        return ret;
+    ret->nodeTab = (xmlNodePtr *) xmlMalloc( arr->nodeNr * sizeof(xmlNodePtr) );
+    if ( ret->nodeTab == NULL ) {
+        xmlXPathFreeNodeSet( ret );
+        return NULL;
+    }
+    memcpy( ret->nodeTab, arr->nodeTab, arr->nodeNr * sizeof(xmlNodePtr) );
+    ret->nodeNr  = arr->nodeNr;
+    ret->nodeMax = arr->nodeNr;
+    return ret;
+}
+
+/* what the nodes of an index have to be */
+typedef struct _xpc_IndexKey {
+    xmlDocPtr doc;
+    const xmlChar * name;
+    const xmlChar * href;
+    const xmlChar * attr;
+    const xmlChar * attrHref;
+    const xmlChar * value;
+    double low, high;       /* a range of numbers */
+    int lowIncluded, highIncluded;
+    xpc_NodeArray found;    /* the nodes in that range */
+} xpc_IndexKey;
+
+static int
+xpc_domIndexValidElement( xmlNodePtr node, void * data )
+{
+    xpc_IndexKey * key = (xpc_IndexKey *) data;
+
+    return xpc_domIndexValid( key->doc, node, key->name, key->href );
+}
+
+/* the attribute of node with that name, not one defaulted by the DTD */
+static xmlAttrPtr
+xpc_domIndexAttr( xmlNodePtr node, const xmlChar * name, const xmlChar * href )
+{
+    xmlAttrPtr attr;
+
+    for ( attr = node->properties; attr != NULL; attr = attr->next ) {
+        if ( xmlStrEqual( attr->name, name )
+             && xmlStrEqual( attr->ns != NULL ? attr->ns->href : NULL, href ) )
+            return attr;
+    }
+    return NULL;
+}
+
+static int
+xpc_domIndexValidAttribute( xmlNodePtr node, void * data )
+{
+    xpc_IndexKey * key = (xpc_IndexKey *) data;
+    xmlAttrPtr attr;
+    xmlChar * value;
+    int same;
+
+    if ( !xpc_domIndexValid( key->doc, node, key->name, key->href ) )
+        return 0;
+    attr = xpc_domIndexAttr( node, key->attr, key->attrHref );
+    if ( attr == NULL )
+        return 0;
+    value = xmlNodeGetContent( (xmlNodePtr) attr );
+    same = xmlStrEqual( value, key->value );
+    xmlFree( value );
+    return same;
+}
+
+/* runs lookup on the index of doc and copies what it finds, building
+ * the index again once if a node found has changed since */
+static xmlNodeSetPtr
+xpc_domIndexFind( xpc_DocIndex ** indexes, xpc_IndexKey * key,
+                  const xpc_NodeArray * (*lookup)( xpc_DocIndex * idx,
+                                                   xpc_IndexKey * key ),
+                  int (*valid)( xmlNodePtr node, void * data ) )
+{
+    xpc_DocIndex * idx;
+    xmlNodeSetPtr ret;
+    int attempt;
+
+    for ( attempt = 0; attempt < 2; attempt++ ) {
+        idx = xpc_domIndexGet( indexes, key->doc );
+        if ( idx == NULL )
+            return NULL;
+        ret = xpc_domIndexCopy( lookup( idx, key ), valid, key );
+        if ( ret != NULL )
+            return ret;
+        /* renamed, unlinked or changed since */
+        xpc_domIndexDrop( indexes, key->doc );
+    }
+    return NULL;
+}
+
+static const xpc_NodeArray *
+xpc_domIndexLookupElements( xpc_DocIndex * idx, xpc_IndexKey * key )
+{
+    return (const xpc_NodeArray *) xmlHashLookup2( idx->names, key->name,
+                                                   key->href );
+}
+
+xmlNodeSetPtr
+xpc_domIndexElements( xpc_DocIndex ** indexes, xmlDocPtr doc,
+                      const xmlChar * name, const xmlChar * href )
+{
+    xpc_IndexKey key;
+
+    if ( doc == NULL || name == NULL )
+        return NULL;
+    key.doc  = doc;
+    key.name = name;
+    key.href = href;
+    return xpc_domIndexFind( indexes, &key, xpc_domIndexLookupElements,
+                             xpc_domIndexValidElement );
+}
+
+/* the values of one attribute of the elements of one name */
+static xmlHashTablePtr
+xpc_domIndexBuildValues( xpc_DocIndex * idx, xpc_IndexKey * key )
+{
+    xpc_NodeArray * elems, * arr;
+    xmlHashTablePtr values;
+    xmlAttrPtr attr;
+    xmlChar * value;
+    int i;
+
+    values = xmlHashCreate( 64 );
+    if ( values == NULL )
+        return NULL;
+    idx->memory += 8 * sizeof(void *);
+    elems = (xpc_NodeArray *) xmlHashLookup2( idx->names, key->name, key->href );
+    for ( i = 0; elems != NULL && i < elems->nodeNr; i++ ) {
+        attr = xpc_domIndexAttr( elems->nodeTab[i], key->attr, key->attrHref );
+        if ( attr == NULL )
+            continue;
+        value = xmlNodeGetContent( (xmlNodePtr) attr );
+        if ( value == NULL )
+            continue;
+        arr = (xpc_NodeArray *) xmlHashLookup( values, value );
+        if ( arr == NULL ) {
+            arr = (xpc_NodeArray *) xmlMalloc( sizeof(xpc_NodeArray) );
+            if ( arr != NULL ) {
+                arr->nodeNr  = 0;
+                arr->nodeMax = 0;
+                arr->nodeTab = NULL;
+                if ( xmlHashAddEntry( values, value, arr ) != 0 ) {
+                    xmlFree( arr );
+                    arr = NULL;
+                }
+                else {
+                    idx->memory += sizeof(xpc_NodeArray) + 4 * sizeof(void *)
+                                   + xmlStrlen( value ) + 1;
+                }
+            }
+        }
+        xmlFree( value );
+        if ( arr == NULL || xpc_domIndexPush( idx, arr, elems->nodeTab[i] ) != 0 ) {
+            xmlHashFree( values, xpc_domIndexFreeArray );
+            return NULL;
+        }
+    }
+    return values;
+}
+
+/* the attribute value indexes are keyed by both names and namespaces */
+static xmlChar *
+xpc_domIndexValuesKey( xpc_IndexKey * key )
+{
+    xmlChar * ret = xmlStrdup( key->href != NULL ? key->href : BAD_CAST "" );
+
+    ret = xmlStrcat( ret, BAD_CAST "\x1f" );
+    ret = xmlStrcat( ret, key->name );
+    ret = xmlStrcat( ret, BAD_CAST "\x1f" );
+    ret = xmlStrcat( ret, key->attrHref != NULL ? key->attrHref : BAD_CAST "" );
+    ret = xmlStrcat( ret, BAD_CAST "\x1f" );
+    return xmlStrcat( ret, key->attr );
+}
+
+static const xpc_NodeArray *
+xpc_domIndexLookupValue( xpc_DocIndex * idx, xpc_IndexKey * key )
+{
+    xmlHashTablePtr values;
+    xmlChar * pair = xpc_domIndexValuesKey( key );
+
+    if ( pair == NULL )
+        return NULL;
+    if ( idx->attrs == NULL )
+        idx->attrs = xmlHashCreate( 8 );
+    values = idx->attrs != NULL
+        ? (xmlHashTablePtr) xmlHashLookup( idx->attrs, pair ) : NULL;
+    if ( values == NULL && idx->attrs != NULL ) {
+        values = xpc_domIndexBuildValues( idx, key );
+        if ( values != NULL
+             && xmlHashAddEntry( idx->attrs, pair, values ) != 0 ) {
+            xmlHashFree( values, xpc_domIndexFreeArray );
+            values = NULL;
+        }
+    }
+    xmlFree( pair );
+    if ( values == NULL )
+        return NULL;
+    return (const xpc_NodeArray *) xmlHashLookup( values, key->value );
+}
+
+xmlNodeSetPtr
+xpc_domIndexAttributes( xpc_DocIndex ** indexes, xmlDocPtr doc,
+                        const xmlChar * name, const xmlChar * href,
+                        const xmlChar * attr, const xmlChar * attrHref,
+                        const xmlChar * value )
+{
+    xpc_IndexKey key;
+
+    if ( doc == NULL || name == NULL || attr == NULL || value == NULL )
+        return NULL;
+    key.doc      = doc;
+    key.name     = name;
+    key.href     = href;
+    key.attr     = attr;
+    key.attrHref = attrHref;
+    key.value    = value;
+    return xpc_domIndexFind( indexes, &key, xpc_domIndexLookupValue,
+                             xpc_domIndexValidAttribute );
+}
+
+static int
+xpc_domIndexInRange( xpc_IndexKey * key, double value )
+{
+    if ( xmlXPathIsNaN( value ) )
+        return 0;
+    if ( key->lowIncluded ? value < key->low : value <= key->low )
+        return 0;
+    if ( key->highIncluded ? value > key->high : value >= key->high )
+        return 0;
+    return 1;
+}
+
+static int
+xpc_domIndexValidNumber( xmlNodePtr node, void * data )
+{
+    xpc_IndexKey * key = (xpc_IndexKey *) data;
+    xmlAttrPtr attr;
+    xmlChar * value;
+    int valid;
+
+    if ( !xpc_domIndexValid( key->doc, node, key->name, key->href ) )
+        return 0;
+    attr = xpc_domIndexAttr( node, key->attr, key->attrHref );
+    if ( attr == NULL )
+        return 0;
+    value = xmlNodeGetContent( (xmlNodePtr) attr );
+    valid = xpc_domIndexInRange( key, xmlXPathStringEvalNumber( value ) );
+    xmlFree( value );
+    return valid;
+}
+
+static int
+xpc_domIndexCompareNumbers( const void * a, const void * b )
+{
+    const xpc_NumberEntry * x = (const xpc_NumberEntry *) a;
+    const xpc_NumberEntry * y = (const xpc_NumberEntry *) b;
+
+    if ( x->value != y->value )
+        return x->value < y->value ? -1 : 1;
+    return x->ordinal - y->ordinal;
+}
+
+static int
+xpc_domIndexCompareOrdinals( const void * a, const void * b )
+{
+    return *(const int *) a - *(const int *) b;
+}
+
+static xpc_NumberIndex *
+xpc_domIndexBuildNumbers( xpc_DocIndex * idx, xpc_IndexKey * key )
+{
+    xpc_NodeArray * elems;
+    xpc_NumberIndex * numbers;
+    xmlAttrPtr attr;
+    xmlChar * value;
+    double number;
+    int i;
+
+    numbers = (xpc_NumberIndex *) xmlMalloc( sizeof(xpc_NumberIndex) );
+    if ( numbers == NULL )
+        return NULL;
+    numbers->count = 0;
+    numbers->tab   = NULL;
+    elems = (xpc_NodeArray *) xmlHashLookup2( idx->names, key->name, key->href );
+    if ( elems != NULL && elems->nodeNr > 0 ) {
+        numbers->tab = (xpc_NumberEntry *)
+            xmlMalloc( elems->nodeNr * sizeof(xpc_NumberEntry) );
+        if ( numbers->tab == NULL ) {
+            xmlFree( numbers );
+            return NULL;
+        }
+    }
+    for ( i = 0; elems != NULL && i < elems->nodeNr; i++ ) {
+        attr = xpc_domIndexAttr( elems->nodeTab[i], key->attr, key->attrHref );
+        if ( attr == NULL )
+            continue;
+        value  = xmlNodeGetContent( (xmlNodePtr) attr );
+        number = xmlXPathStringEvalNumber( value );
+        xmlFree( value );
+        if ( xmlXPathIsNaN( number ) )
+            continue;
+        numbers->tab[numbers->count].value   = number;
+        numbers->tab[numbers->count].ordinal = i;
+        numbers->count++;
+    }
+    if ( numbers->count > 1 )
+        qsort( numbers->tab, numbers->count, sizeof(xpc_NumberEntry),
+               xpc_domIndexCompareNumbers );
+    idx->memory += sizeof(xpc_NumberIndex) + 4 * sizeof(void *)
+                   + (elems != NULL ? elems->nodeNr : 0) * sizeof(xpc_NumberEntry);
+    return numbers;
+}
+
+/* the elements whose numbers are in the range of key, in document
+ * order; they are collected in key->found */
+static const xpc_NodeArray *
+xpc_domIndexLookupRange( xpc_DocIndex * idx, xpc_IndexKey * key )
+{
+    xpc_NodeArray * elems;
+    xpc_NumberIndex * numbers = NULL;
+    xmlChar * pair = xpc_domIndexValuesKey( key );
+    int * ordinals;
+    int lo, hi, mid, i, n;
+
+    xmlFree( key->found.nodeTab );
+    key->found.nodeTab = NULL;
+    key->found.nodeNr  = 0;
+    if ( pair == NULL )
+        return NULL;
+    if ( idx->numbers == NULL )
+        idx->numbers = xmlHashCreate( 8 );
+    if ( idx->numbers != NULL )
+        numbers = (xpc_NumberIndex *) xmlHashLookup( idx->numbers, pair );
+    if ( numbers == NULL && idx->numbers != NULL ) {
+        numbers = xpc_domIndexBuildNumbers( idx, key );
+        if ( numbers != NULL
+             && xmlHashAddEntry( idx->numbers, pair, numbers ) != 0 ) {
+            xpc_domIndexFreeNumbers( numbers, NULL );
+            numbers = NULL;
+        }
+    }
+    xmlFree( pair );
+    elems = (xpc_NodeArray *) xmlHashLookup2( idx->names, key->name, key->href );
+    if ( numbers == NULL || elems == NULL )
+        return NULL;
+
+    /* the first entry not below the range */
+    lo = 0;
+    hi = numbers->count;
+    while ( lo < hi ) {
+        mid = (lo + hi) / 2;
+        if ( key->lowIncluded ? numbers->tab[mid].value < key->low
+                              : numbers->tab[mid].value <= key->low )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for ( n = 0; lo + n < numbers->count
+                 && xpc_domIndexInRange( key, numbers->tab[lo + n].value ); n++ )
+        ;
+    if ( n == 0 )
+        return &key->found;
+
+    ordinals = (int *) xmlMalloc( n * sizeof(int) );
+    key->found.nodeTab = (xmlNodePtr *) xmlMalloc( n * sizeof(xmlNodePtr) );
+    if ( ordinals == NULL || key->found.nodeTab == NULL ) {
+        xmlFree( ordinals );
+        return NULL;
+    }
+    for ( i = 0; i < n; i++ )
+        ordinals[i] = numbers->tab[lo + i].ordinal;
+    qsort( ordinals, n, sizeof(int), xpc_domIndexCompareOrdinals );
+    for ( i = 0; i < n; i++ )
+        key->found.nodeTab[i] = elems->nodeTab[ordinals[i]];
+    key->found.nodeNr  = n;
+    key->found.nodeMax = n;
+    xmlFree( ordinals );
+    return &key->found;
+}
+
+xmlNodeSetPtr
+xpc_domIndexRange( xpc_DocIndex ** indexes, xmlDocPtr doc,
+                   const xmlChar * name, const xmlChar * href,
+                   const xmlChar * attr, const xmlChar * attrHref,
+                   double low, int lowIncluded, double high, int highIncluded )
+{
+    xpc_IndexKey key;
+    xmlNodeSetPtr ret;
+
+    if ( doc == NULL || name == NULL || attr == NULL )
+        return NULL;
+    key.doc          = doc;
+    key.name         = name;
+    key.href         = href;
+    key.attr         = attr;
+    key.attrHref     = attrHref;
+    key.low          = low;
+    key.lowIncluded  = lowIncluded;
+    key.high         = high;
+    key.highIncluded = highIncluded;
+    key.found.nodeNr  = 0;
+    key.found.nodeMax = 0;
+    key.found.nodeTab = NULL;
+    ret = xpc_domIndexFind( indexes, &key, xpc_domIndexLookupRange,
+                            xpc_domIndexValidNumber );
+    xmlFree( key.found.nodeTab );
+    return ret;
+}
+
+size_t
+xpc_domIndexMemory( xpc_DocIndex * indexes, xmlDocPtr doc )
+{
+    for ( ; indexes != NULL; indexes = indexes->next ) {
+        if ( indexes->doc == doc )
+            return indexes->memory;
+    }
+    return 0;
+}
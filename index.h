@@ -0,0 +1,79 @@
+#ifndef __LIBXML_INDEX_H__
+#define __LIBXML_INDEX_H__
+
+#include <libxml/tree.h>
+#include <libxml/xpath.h>
+
+/**
+ * indexes over the elements of a document by name, attribute value
+ * and attribute number, built on first use and kept in a list owned by
+ * an XPath context. before every query the elements of the document
+ * are walked anyway to number them (see xpc_domNodeNormalizeOrder());
+ * that walk signs them with xpc_domIndexSign() and xpc_domIndexCheck()
+ * drops the index of the document if an element was inserted, moved,
+ * removed, renamed or put in another namespace, or an attribute
+ * changed, since it was built. the nodes found are checked once more
+ * for being renamed or unlinked.
+ *
+ * the list refers to documents without keeping them alive; the index
+ * of a freed document is only ever dropped, or replaced by the check if
+ * another document takes its place.
+ **/
+typedef struct _xpc_DocIndex xpc_DocIndex;
+
+/* the elements of doc with the local name name in the namespace href
+ * (NULL for none) in document order, building the element name index
+ * of doc if needed. returns NULL if the index cannot be built. */
+xmlNodeSetPtr
+xpc_domIndexElements( xpc_DocIndex ** indexes, xmlDocPtr doc,
+                      const xmlChar * name, const xmlChar * href );
+
+/* the elements as for xpc_domIndexElements() which have the attribute
+ * attr in the namespace attrHref with the string value value, building
+ * an index of the values of that attribute if needed */
+xmlNodeSetPtr
+xpc_domIndexAttributes( xpc_DocIndex ** indexes, xmlDocPtr doc,
+                        const xmlChar * name, const xmlChar * href,
+                        const xmlChar * attr, const xmlChar * attrHref,
+                        const xmlChar * value );
+
+/* the elements as for xpc_domIndexElements() the number value of whose
+ * attribute attr is between low and high, building an index of the
+ * numbers of that attribute sorted by value if needed */
+xmlNodeSetPtr
+xpc_domIndexRange( xpc_DocIndex ** indexes, xmlDocPtr doc,
+                   const xmlChar * name, const xmlChar * href,
+                   const xmlChar * attr, const xmlChar * attrHref,
+                   double low, int lowIncluded, double high, int highIncluded );
+
+/* whether there are indexes of doc */
+int
+xpc_domIndexHas( xpc_DocIndex * indexes, xmlDocPtr doc );
+
+/* adds an element, the next one in document order, with its name,
+ * namespace and attributes to the signature sig of a document, which
+ * starts out as 0 */
+unsigned long
+xpc_domIndexSign( unsigned long sig, xmlNodePtr elem );
+
+/* drops the indexes of doc unless its count elements signed as
+ * signature are the ones they were built from */
+void
+xpc_domIndexCheck( xpc_DocIndex ** indexes, xmlDocPtr doc, int count,
+                   unsigned long signature );
+
+/* the same, walking doc for its signature */
+void
+xpc_domIndexRevalidate( xpc_DocIndex ** indexes, xmlDocPtr doc );
+
+void
+xpc_domIndexDrop( xpc_DocIndex ** indexes, xmlDocPtr doc );
+
+void
+xpc_domIndexDropAll( xpc_DocIndex ** indexes );
+
+/* the approximate number of bytes the indexes of doc take */
+size_t
+xpc_domIndexMemory( xpc_DocIndex * indexes, xmlDocPtr doc );
+
+#endif
@@ -14,6 +14,7 @@ extern "C" {
 
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "EXTERN.h"
 #include "perl.h"
@@ -585,46 +586,291 @@ xpc_PmmFixOwnerNode( xmlNodePtr node, xpc_ProxyNodePtr parent )
     }
 } 
 
+/**
+ * the encoding handlers, with their conversion buffers, are kept for
+ * the next string in the same encoding instead of being looked up and
+ * set up again for every string crossing between perl and libxml2. a
+ * coder is taken out of the cache while it converts, so threads never
+ * share one; one which failed is closed rather than put back, since its
+ * state is unknown, and so are the coders of the encodings with shift
+ * states, which would carry a state over to the next string.
+ **/
+#define XPC_CODER_CACHE 4
+
+typedef struct _xpc_PmmCoder {
+    int charset;
+    xmlChar * encoding;  /* the name the coder was looked up by */
+    int ascii;           /* whether ASCII converts to itself */
+    xmlCharEncodingHandlerPtr handler;
+    xmlBufferPtr in;
+    xmlBufferPtr out;
+} xpc_PmmCoder;
+
+/* the charset for xpc_PmmCoderGet() to parse from the name if the
+   coder is not cached */
+#define XPC_CODER_LOOKUP (-2)
+
+static xpc_PmmCoder * xpc_PmmCoders[XPC_CODER_CACHE];
+
+#if defined(HAVE_PTHREAD) && defined(LIBXML_THREAD_ENABLED)
+#include <pthread.h>
+static pthread_mutex_t xpc_PmmCoderLock = PTHREAD_MUTEX_INITIALIZER;
+#define XPC_CODER_LOCK()   pthread_mutex_lock( &xpc_PmmCoderLock )
+#define XPC_CODER_UNLOCK() pthread_mutex_unlock( &xpc_PmmCoderLock )
+#else
+#define XPC_CODER_LOCK()
+#define XPC_CODER_UNLOCK()
+#endif
+
+/* buffers grown beyond this by a long string are not kept, nor are
+   coders left with input they could not convert */
+#define XPC_CODER_KEEP 65536
+
+/* whether the meaning of a byte depends on escapes before it */
+static int
+xpc_PmmCoderStateful( int charset, const xmlChar * encoding )
+{
+    static const char * prefixes[] = { "ISO-2022", "ISO2022", "CSISO2022",
+                                       "UTF-7", "UTF7", "HZ", NULL };
+    int i;
+
+    if ( charset == XML_CHAR_ENCODING_2022_JP )
+        return 1;
+    if ( charset != XML_CHAR_ENCODING_ERROR || encoding == NULL )
+        return 0;
+    for ( i = 0; prefixes[i] != NULL; i++ ) {
+        if ( xmlStrncasecmp( encoding, (const xmlChar *) prefixes[i],
+                             xmlStrlen( (const xmlChar *) prefixes[i] ) ) == 0 )
+            return 1;
+    }
+    return 0;
+}
+
+static void
+xpc_PmmCoderFree( xpc_PmmCoder * coder )
+{
+    xmlCharEncCloseFunc( coder->handler );
+    xmlBufferFree( coder->in );
+    xmlBufferFree( coder->out );
+    xmlFree( coder->encoding );
+    xmlFree( coder );
+}
+
+static xpc_PmmCoder *
+xpc_PmmCoderGet( int charset, const xmlChar * encoding )
+{
+    xpc_PmmCoder * coder = NULL;
+    xmlCharEncodingHandlerPtr handler = NULL;
+    int i;
+
+    XPC_CODER_LOCK();
+    for ( i = 0; i < XPC_CODER_CACHE; i++ ) {
+        coder = xpc_PmmCoders[i];
+        if ( coder != NULL
+             && ( encoding != NULL
+                  ? xmlStrcasecmp( coder->encoding, encoding ) == 0
+                  : coder->charset == charset ) ) {
+            xpc_PmmCoders[i] = NULL;
+            break;
+        }
+        coder = NULL;
+    }
+    XPC_CODER_UNLOCK();
+    if ( coder != NULL )
+        return coder;
+
+    if ( charset == XPC_CODER_LOOKUP )
+        charset = xmlParseCharEncoding( (const char *)encoding );
+    if ( charset == XML_CHAR_ENCODING_ERROR ){
+        /* warn("no standard encoding %s\n", encoding); */
+        handler = xmlFindCharEncodingHandler( (const char *)encoding );
+    }
+    else if ( charset == XML_CHAR_ENCODING_NONE ){
+        xs_warn("no encoding found \n");
+    } else {
+        /* warn( "use document encoding %s (%d)", encoding, charset ); */
+        handler = xmlGetCharEncodingHandler( charset );
+    }
+    if ( handler == NULL )
+        return NULL;
+
+    xs_warn("coding machine found \n");
+    coder = (xpc_PmmCoder *) xmlMalloc( sizeof(xpc_PmmCoder) );
+    if ( coder == NULL ) {
+        xmlCharEncCloseFunc( handler );
+        return NULL;
+    }
+    coder->charset  = charset;
+    coder->encoding = xmlStrdup( encoding );
+    coder->ascii    = 0;
+    coder->handler  = handler;
+    coder->in       = xmlBufferCreate();
+    coder->out      = xmlBufferCreate();
+    if ( coder->in == NULL || coder->out == NULL ) {
+        xpc_PmmCoderFree( coder );
+        return NULL;
+    }
+
+    if ( !xpc_PmmCoderStateful( charset, encoding ) ) {
+        /* not so for Shift_JIS, EBCDIC or UTF-16, to name a few */
+        char probe[128];
+        for ( i = 1; i < 128; i++ )
+            probe[i - 1] = (char) i;
+        xmlBufferAdd( coder->in, (const xmlChar *) probe, 127 );
+        coder->ascii = xmlCharEncInFunc( handler, coder->out, coder->in ) >= 0
+                       && xmlBufferLength( coder->out ) == 127
+                       && memcmp( xmlBufferContent( coder->out ), probe, 127 ) == 0;
+        xmlBufferEmpty( coder->in );
+        xmlBufferEmpty( coder->out );
+    }
+    return coder;
+}
+
+static void
+xpc_PmmCoderPut( xpc_PmmCoder * coder, int failed )
+{
+    int i;
+
+    if ( !failed
+         && !xpc_PmmCoderStateful( coder->charset, coder->encoding )
+         && xmlBufferLength( coder->in ) == 0
+         && xmlBufferLength( coder->out ) < XPC_CODER_KEEP ) {
+        xmlBufferEmpty( coder->in );
+        xmlBufferEmpty( coder->out );
+        XPC_CODER_LOCK();
+        for ( i = 0; i < XPC_CODER_CACHE; i++ ) {
+            if ( xpc_PmmCoders[i] == NULL ) {
+                xpc_PmmCoders[i] = coder;
+                coder = NULL;
+                break;
+            }
+        }
+        XPC_CODER_UNLOCK();
+    }
+    if ( coder != NULL )
+        xpc_PmmCoderFree( coder );
+}
+
+/* converts len bytes of string from the encoding into UTF-8 (encode)
+ * or back (decode), leaving the result in coder->out. returns the
+ * coder, to be handed back with xpc_PmmCoderPut(), or NULL */
+static xpc_PmmCoder *
+xpc_PmmCoderConvert( int charset, const xmlChar * encoding,
+                     const xmlChar * string, int len, int decode )
+{
+    xpc_PmmCoder * coder = xpc_PmmCoderGet( charset, encoding );
+    int ret;
+
+    if ( coder == NULL )
+        return NULL;
+    xmlBufferAdd( coder->in, string, len );
+    if ( decode )
+        ret = xmlCharEncOutFunc( coder->handler, coder->out, coder->in );
+    else
+        ret = xmlCharEncInFunc( coder->handler, coder->out, coder->in );
+    if ( ret < 0 ) {
+        xs_warn( decode ? "decoding error \n" : "encoding error \n" );
+        xpc_PmmCoderPut( coder, 1 );
+        return NULL;
+    }
+    return coder;
+}
+
+/* whether the len bytes at string are all ASCII, looking at a word of
+   them at a time */
+static int
+xpc_PmmIsAscii( const char * string, STRLEN len )
+{
+    const unsigned long high = ~0UL / 0xFF * 0x80;
+    unsigned long words[4];
+    const char * end = string + len;
+
+    while ( end - string >= (long) sizeof(words) ) {
+        memcpy( words, string, sizeof(words) );
+        if ( ( words[0] | words[1] | words[2] | words[3] ) & high )
+            return 0;
+        string += sizeof(words);
+    }
+    while ( end - string >= (long) sizeof(words[0]) ) {
+        memcpy( words, string, sizeof(words[0]) );
+        if ( words[0] & high )
+            return 0;
+        string += sizeof(words[0]);
+    }
+    while ( string < end ) {
+        if ( *string++ & 0x80 )
+            return 0;
+    }
+    return 1;
+}
+
+static int
+xpc_PmmIsUTF8( const xmlChar * encoding )
+{
+    return encoding == NULL
+        || xmlStrcasecmp( encoding, (const xmlChar *) "UTF-8" ) == 0
+        || xmlStrcasecmp( encoding, (const xmlChar *) "UTF8" ) == 0;
+}
+
+/* the answers of xpc_PmmAsciiSafe(), asked for every string. entries
+   are only ever added, under the lock, and read without it: a reader
+   seeing an entry half written misses it or takes it for not safe,
+   which only costs a conversion */
+#define XPC_ASCII_NAMES 8
+
+static struct {
+    xmlChar * encoding;
+    int ascii;
+} xpc_PmmAsciiNames[XPC_ASCII_NAMES];
+static int xpc_PmmAsciiCount = 0;
+
+/* whether a string of ASCII needs no conversion from or to encoding */
+static int
+xpc_PmmAsciiSafe( const xmlChar * encoding )
+{
+    xpc_PmmCoder * coder;
+    int ascii, i;
+
+    if ( xpc_PmmIsUTF8( encoding ) )
+        return 1;
+    for ( i = 0; i < xpc_PmmAsciiCount; i++ ) {
+        if ( xmlStrcasecmp( xpc_PmmAsciiNames[i].encoding, encoding ) == 0 )
+            return xpc_PmmAsciiNames[i].ascii;
+    }
+    coder = xpc_PmmCoderGet( XPC_CODER_LOOKUP, encoding );
+    if ( coder == NULL )
+        return 0;
+    ascii = coder->ascii;
+    XPC_CODER_LOCK();
+    if ( xpc_PmmAsciiCount < XPC_ASCII_NAMES ) {
+        xpc_PmmAsciiNames[xpc_PmmAsciiCount].ascii = ascii;
+        xpc_PmmAsciiNames[xpc_PmmAsciiCount].encoding = xmlStrdup( encoding );
+        xpc_PmmAsciiCount++;
+    }
+    XPC_CODER_UNLOCK();
+    xpc_PmmCoderPut( coder, 0 );
+    return ascii;
+}
+
 xmlChar*
 xpc_PmmFastEncodeString( int charset,
                      const xmlChar *string,
                      const xmlChar *encoding ) 
 {
-    xmlCharEncodingHandlerPtr coder = NULL;
+    xpc_PmmCoder * coder;
     xmlChar *retval = NULL;
-    xmlBufferPtr in = NULL, out = NULL;
 
     if ( charset == XML_CHAR_ENCODING_UTF8 ) {
         /* warn("use UTF8 for encoding ... %s ", string); */
 	return xmlStrdup( string );
     } 
-    else if ( charset == XML_CHAR_ENCODING_ERROR ){
-        /* warn("no standard encoding %s\n", encoding); */
-        coder =xmlFindCharEncodingHandler( (const char *)encoding );
-    }
-    else if ( charset == XML_CHAR_ENCODING_NONE ){
-        xs_warn("no encoding found \n");
-    } else {
-        /* warn( "use document encoding %s (%d)", encoding, charset ); */
-        coder= xmlGetCharEncodingHandler( charset );
-    }
 
+    coder = xpc_PmmCoderConvert( charset, encoding, string,
+                                 xmlStrlen( string ), 0 );
     if ( coder != NULL ) {
-        xs_warn("coding machine found \n");
-        in    = xmlBufferCreate();
-        out   = xmlBufferCreate();
-        xmlBufferCCat( in, (const char *) string );
-        if ( xmlCharEncInFunc( coder, out, in ) >= 0 ) {
-            retval = xmlStrdup( out->content );
-            /* warn( "encoded string is %s" , retval); */
-        }
-        else {
-            /* warn( "b0rked encoiding!\n"); */
-        }
-        
-        xmlBufferFree( in );
-        xmlBufferFree( out );
-        xmlCharEncCloseFunc( coder );
+        retval = xmlStrndup( xmlBufferContent( coder->out ),
+                             xmlBufferLength( coder->out ) );
+        xpc_PmmCoderPut( coder, 0 );
     }
     return retval;
 }
@@ -634,38 +880,19 @@ xpc_PmmFastDecodeString( int charset,
                      const xmlChar *string,
                      const xmlChar *encoding) 
 {
-    xmlCharEncodingHandlerPtr coder = NULL;
+    xpc_PmmCoder * coder;
     xmlChar *retval = NULL;
-    xmlBufferPtr in = NULL, out = NULL;
 
     if ( charset == XML_CHAR_ENCODING_UTF8 ) {
 	return xmlStrdup( string );
     } 
-    else if ( charset == XML_CHAR_ENCODING_ERROR ){
-        coder =xmlFindCharEncodingHandler( (const char *)encoding );
-    }
-    else if ( charset == XML_CHAR_ENCODING_NONE ){
-        xs_warn("no encoding found \n");
-    } else {
-        coder= xmlGetCharEncodingHandler( charset );
-    }
 
+    coder = xpc_PmmCoderConvert( charset, encoding, string,
+                                 xmlStrlen( string ), 1 );
     if ( coder != NULL ) {
-        /* warn( "do encoding %s", string ); */
-        in  = xmlBufferCreate();
-        out = xmlBufferCreate();
-        
-        xmlBufferCat( in, string );        
-        if ( xmlCharEncOutFunc( coder, out, in ) >= 0 ) {
-            retval = xmlCharStrndup(xmlBufferContent(out), xmlBufferLength(out));
-        }
-        else {
-            xs_warn("decoding error \n");
-        }
-        
-        xmlBufferFree( in );
-        xmlBufferFree( out );
-        xmlCharEncCloseFunc( coder );
+        retval = xmlStrndup( xmlBufferContent( coder->out ),
+                             xmlBufferLength( coder->out ) );
+        xpc_PmmCoderPut( coder, 0 );
     }
     return retval;
 }
@@ -676,15 +903,20 @@ xpc_PmmFastDecodeString( int charset,
  **/ 
 xmlChar*
 xpc_PmmEncodeString( const char *encoding, const xmlChar *string ){
-    xmlCharEncoding enc;
     xmlChar *ret = NULL;
-    xmlCharEncodingHandlerPtr coder = NULL;
+    xpc_PmmCoder * coder;
     
     if ( string != NULL ) {
-        if( encoding != NULL ) {
+        if( !xpc_PmmIsUTF8( (const xmlChar *)encoding ) ) {
             xs_warn( encoding );
-            enc = xmlParseCharEncoding( encoding );
-            ret = xpc_PmmFastEncodeString( enc, string, (const xmlChar *)encoding );
+            coder = xpc_PmmCoderConvert( XPC_CODER_LOOKUP,
+                                         (const xmlChar *)encoding, string,
+                                         xmlStrlen( string ), 0 );
+            if ( coder != NULL ) {
+                ret = xmlStrndup( xmlBufferContent( coder->out ),
+                                  xmlBufferLength( coder->out ) );
+                xpc_PmmCoderPut( coder, 0 );
+            }
         }
         else {
             /* if utf-8 is requested we do nothing */
@@ -702,14 +934,19 @@ xpc_PmmEncodeString( const char *encoding, const xmlChar *string ){
 char*
 xpc_PmmDecodeString( const char *encoding, const xmlChar *string){
     char *ret=NULL;
-    xmlCharEncoding enc;
-    xmlCharEncodingHandlerPtr coder = NULL;
+    xpc_PmmCoder * coder;
 
     if ( string != NULL ) {
         xs_warn( "xpc_PmmDecodeString called" );
-        if( encoding != NULL ) {
-            enc = xmlParseCharEncoding( encoding );
-            ret = (char*)xpc_PmmFastDecodeString( enc, string, (const xmlChar*)encoding );
+        if( !xpc_PmmIsUTF8( (const xmlChar *)encoding ) ) {
+            coder = xpc_PmmCoderConvert( XPC_CODER_LOOKUP,
+                                         (const xmlChar *)encoding, string,
+                                         xmlStrlen( string ), 1 );
+            if ( coder != NULL ) {
+                ret = (char*)xmlStrndup( xmlBufferContent( coder->out ),
+                                         xmlBufferLength( coder->out ) );
+                xpc_PmmCoderPut( coder, 0 );
+            }
             xs_warn( "xpc_PmmDecodeString done" );
         }
         else {
@@ -724,39 +961,25 @@ SV*
 xpc_C2Sv( const xmlChar *string, const xmlChar *encoding )
 {
     SV *retval = &PL_sv_undef;
-    xmlCharEncoding enc;
+    xmlCharEncoding enc = XML_CHAR_ENCODING_UTF8;
+
     if ( string != NULL ) {
-        if ( encoding != NULL ) {
+        if ( !xpc_PmmIsUTF8( encoding ) ) {
             enc = xmlParseCharEncoding( (const char*)encoding );
-        }
-        else {
-            enc = 0;
-        }
-        if ( enc == 0 ) {
-            /* this happens if the encoding is "" or NULL */
-            enc = XML_CHAR_ENCODING_UTF8;
+            if ( enc == 0 ) {
+                /* this happens if the encoding is "" */
+                enc = XML_CHAR_ENCODING_UTF8;
+            }
         }
 
+        retval = newSVpvn( (const char *)string, xmlStrlen( string ) );
         if ( enc == XML_CHAR_ENCODING_UTF8 ) {
-            /* create an UTF8 string. */       
-            STRLEN len = 0;
-            xs_warn("set UTF8 string");
-            len = xmlStrlen( string );
-            /* create the SV */
-            /* string[len] = 0; */
-
-            retval = NEWSV(0, len+1); 
-            sv_setpvn(retval, (const char*) string, len );
+            /* an UTF8 string. */       
 #ifdef HAVE_UTF8
             xs_warn("set UTF8-SV-flag");
             SvUTF8_on(retval);
 #endif            
         }
-        else {
-            /* just create an ordinary string. */
-            xs_warn("set ordinary string");
-            retval = newSVpvn( (const char *)string, xmlStrlen( string ) );
-        }
     }
 
     return retval;
@@ -771,29 +994,19 @@ xpc_Sv2C( SV* scalar, const xmlChar *encoding )
     if ( scalar != NULL && scalar != &PL_sv_undef ) {
         STRLEN len = 0;
         char * t_pv =SvPV(scalar, len);
-        xmlChar* ts = NULL;
-        xmlChar* string = xmlStrdup((xmlChar*)t_pv);
-        if ( xmlStrlen(string) > 0 ) {
-            xs_warn( "no undefs" );
 #ifdef HAVE_UTF8
-            xs_warn( "use UTF8" );
-            if( !DO_UTF8(scalar) && encoding != NULL ) {
+        if( *t_pv != 0 && !DO_UTF8(scalar) && encoding != NULL
 #else
-            if ( encoding != NULL ) {        
+        if ( *t_pv != 0 && encoding != NULL
 #endif
-                xs_warn( "xpc_domEncodeString!" );
-                ts= xpc_PmmEncodeString( (const char *)encoding, string );
-                xs_warn( "done!" );
-                if ( string != NULL ) {
-                    xmlFree(string);
-                }
-                string=ts;
-            }
+             && !( xpc_PmmIsAscii( t_pv, len ) && xpc_PmmAsciiSafe( encoding ) ) ) {
+            xs_warn( "xpc_domEncodeString!" );
+            retval = xpc_PmmEncodeString( (const char *)encoding,
+                                          (const xmlChar *)t_pv );
         }
-             
-        retval = xmlStrdup(string);
-        if (string != NULL ) {
-            xmlFree(string);
+        else {
+            /* the one copy of a string which needs no conversion */
+            retval = xmlStrndup( (const xmlChar *)t_pv, len );
         }
     }
     xs_warn("sv2c end!");
@@ -806,118 +1019,105 @@ nodexpc_C2Sv( const xmlChar * string,  xmlNodePtr refnode )
     /* this is a little helper function to avoid to much redundand
        code in LibXML.xs */
     SV* retval = &PL_sv_undef;
-    STRLEN len = 0;
+    xpc_PmmCoder * coder;
+    STRLEN len = xmlStrlen( string );
 
     if ( refnode != NULL ) {
         xmlDocPtr real_doc = refnode->doc;
         if ( real_doc != NULL && real_doc->encoding != NULL ) {
-
-            xmlChar * decoded = xpc_PmmDecodeString( (const xmlChar*)real_doc->encoding,
-						 (const xmlChar *)string );
-            len = xmlStrlen( decoded );
-
-            if ( xpc_PmmDocEncoding(real_doc) == XML_CHAR_ENCODING_UTF8 
-		 /* most probably true, since libxml2 always 
-                  * sets doc->charset to UTF8, see tree.c:
-                  *
-		  * The in memory encoding is always UTF8
-		  * This field will never change and would
-		  * be obsolete if not for binary compatibility.
-		  */
-
-		 && (real_doc->encoding == NULL ||
-		     xmlParseCharEncoding(real_doc->encoding)==XML_CHAR_ENCODING_UTF8 )) {
-                /* create an UTF8 string. */       
-                xs_warn("set UTF8 string");
-                /* create the SV */
-                /* warn( "string is %s\n", string ); */
-
-                retval = newSVpvn( (const char *)decoded, len );
+            if ( string == NULL ) {
+                retval = newSVpvn( "", 0 );
+            }
+            else if ( xpc_PmmIsUTF8( real_doc->encoding ) ) {
+                retval = newSVpvn( (const char *)string, len );
 #ifdef HAVE_UTF8
-                xs_warn("set UTF8-SV-flag");
-                SvUTF8_on(retval);
+                if ( xpc_PmmDocEncoding(real_doc) == XML_CHAR_ENCODING_UTF8 ) {
+                    /* most probably true, since libxml2 always 
+                     * sets doc->charset to UTF8, see tree.c:
+                     *
+                     * The in memory encoding is always UTF8
+                     * This field will never change and would
+                     * be obsolete if not for binary compatibility.
+                     */
+                    xs_warn("set UTF8-SV-flag");
+                    SvUTF8_on(retval);
+                }
 #endif            
             }
+            else if ( xpc_PmmIsAscii( (const char *)string, len )
+                      && xpc_PmmAsciiSafe( real_doc->encoding ) ) {
+                /* the same in the document's encoding */
+                retval = newSVpvn( (const char *)string, len );
+            }
             else {
-                /* just create an ordinary string. */
+                /* just create an ordinary string, straight from the
+                   conversion buffer */
                 xs_warn("set ordinary string");
-                retval = newSVpvn( (const char *)decoded, len );
+                coder = xpc_PmmCoderConvert( XPC_CODER_LOOKUP, real_doc->encoding,
+                                             string, len, 1 );
+                if ( coder != NULL ) {
+                    retval = newSVpvn( (const char *)xmlBufferContent( coder->out ),
+                                       xmlBufferLength( coder->out ) );
+                    xpc_PmmCoderPut( coder, 0 );
+                }
+                else {
+                    retval = newSVpvn( "", 0 );
+                }
             }
-
-            /* retval = xpc_C2Sv( decoded, real_doc->encoding ); */
-            xmlFree( decoded );
         }
         else {
-            retval = newSVpvn( (const char *)string, xmlStrlen(string) );
+            retval = newSVpvn( (const char *)string, len );
         }
     }
     else {
-        retval = newSVpvn( (const char *)string, xmlStrlen(string) );
+        retval = newSVpvn( (const char *)string, len );
     }
 
     return retval;
 }
 
-xmlChar *
-nodexpc_Sv2C( SV * scalar, xmlNodePtr refnode )
+const xmlChar *
+nodexpc_Sv2CBorrow( SV * scalar, xmlNodePtr refnode, int * owned )
 {
     /* this function requires conditionized compiling, because we
        request a function, that does not exists in earlier versions of
        perl. in this cases the library assumes, all strings are in
        UTF8. if a programmer likes to have the intelligent code, he
        needs to upgrade perl */
+    xmlDocPtr real_dom = refnode != NULL ? refnode->doc : NULL;
+    STRLEN len = 0;
+    char * t_pv;
 
-    if ( refnode != NULL ) {
-        xmlDocPtr real_dom = refnode->doc;
-        xs_warn("have node!");
-        if (real_dom != NULL && real_dom->encoding != NULL ) {
-            xs_warn("encode string!");
-            /*  speed things a bit up.... */
-            if ( scalar != NULL && scalar != &PL_sv_undef ) {
-                STRLEN len = 0;
-                char * t_pv =SvPV(scalar, len);
-                xmlChar* ts = NULL;
-                xmlChar* string = xmlStrdup((xmlChar*)t_pv);
-                if ( xmlStrlen(string) > 0 ) {
-                    xs_warn( "no undefs" );
+    *owned = 0;
+    if ( scalar == NULL || scalar == &PL_sv_undef ) {
+        xs_warn( "return NULL" );
+        return NULL;
+    }
+    t_pv = SvPV(scalar, len);
+    if ( real_dom != NULL && real_dom->encoding != NULL && *t_pv != 0
 #ifdef HAVE_UTF8
-                    xs_warn( "use UTF8" );
-                    if( !DO_UTF8(scalar) && real_dom != NULL && real_dom->encoding != NULL ) {
-                        xs_warn( "string is not UTF8\n" );
-#else
-                    if ( real_dom != NULL && real_dom->encoding != NULL ) {        
+         && !DO_UTF8(scalar)
 #endif
-                        xs_warn( "xpc_domEncodeString!" );
-                      /*  if ( string == NULL || *string == 0 ) warn("string is empty" ); */
-                       
-                        ts= xpc_PmmEncodeString( (const xmlChar*)real_dom->encoding,
-					     string );
-
-                        xs_warn( "done!" );
-                        if ( string != NULL ) {
-                            xmlFree(string);
-                        }
-                        string=ts;
-                    }
-                    else {
-                        xs_warn( "no encoding set, use UTF8!\n" );
-                    }
-                }
-                /* if ( string == NULL ) warn( "string is NULL\n" ); */
-                return string;
-            }
-            else {
-                xs_warn( "return NULL" );
-                return NULL;
-            }
-        }
-        else {
-            xs_warn( "document has no encoding defined! use simple SV extraction\n" );
-        }
+         && !( xpc_PmmIsAscii( t_pv, len )
+               && xpc_PmmAsciiSafe( real_dom->encoding ) ) ) {
+        xs_warn( "string is not UTF8\n" );
+        *owned = 1;
+        return xpc_PmmEncodeString( (const char *)real_dom->encoding,
+                                    (const xmlChar *)t_pv );
     }
-    xs_warn("no encoding !!");
+    xs_warn( "no conversion needed, use the scalar's string\n" );
+    return (const xmlChar *)t_pv;
+}
+
+xmlChar *
+nodexpc_Sv2C( SV * scalar, xmlNodePtr refnode )
+{
+    int owned = 0;
+    const xmlChar * string = nodexpc_Sv2CBorrow( scalar, refnode, &owned );
 
-    return  xpc_Sv2C( scalar, NULL ); 
+    if ( owned || string == NULL )
+        return (xmlChar *)string;
+    return xmlStrdup( string );
 }
 
 SV * 
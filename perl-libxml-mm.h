@@ -229,4 +229,19 @@ nodexpc_C2Sv( const xmlChar * string,  xmlNodePtr refnode );
 xmlChar *
 nodexpc_Sv2C( SV * scalar, xmlNodePtr refnode );
 
+/*
+ * NAME nodexpc_Sv2CBorrow
+ * TYPE function
+ * SYNOPSIS
+ * const xmlChar *string = nodexpc_Sv2CBorrow( my_sv, refnode, &owned );
+ *
+ * like nodexpc_Sv2C(), but where the string needs no conversion the
+ * SV's own buffer is returned and owned is set to 0; it is only valid
+ * as long as the SV is neither changed nor freed. otherwise owned is
+ * set to 1 and the string has to be freed.
+ *
+ */
+const xmlChar *
+nodexpc_Sv2CBorrow( SV * scalar, xmlNodePtr refnode, int * owned );
+
 #endif
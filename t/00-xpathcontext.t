@@ -1,5 +1,5 @@
 use Test;
-BEGIN { plan tests => 54 };
+BEGIN { plan tests => 72 };
 
 use XML::LibXML;
 use XML::LibXML::XPathContext;
@@ -142,3 +142,47 @@ eval { $xc4->findvalue('last()') };
 ok($@);
 
 
+
+# nodes which do not belong to a document
+my $frag = XML::LibXML::Element->new('frag');
+$frag->appendChild(XML::LibXML::Element->new('item')) for 1..3;
+my $xc5 = XML::LibXML::XPathContext->new($frag);
+ok($xc5->findvalue('count(item)') == 3);
+ok($xc5->findvalue('count(item)') == 3);
+my ($item) = $xc5->findnodes('item[2]');
+ok($item->nodeName eq 'item');
+ok(XML::LibXML::XPathContext->new($item)->findvalue('count(../item)') == 3);
+# the document the fragment is hung below is not handed out ...
+ok(!grep { $_->nodeType == XML::LibXML::XML_DOCUMENT_NODE }
+       XML::LibXML::XPathContext->new($item)->findnodes('ancestor::node()'));
+# ... and not left behind
+ok($frag->parentNode->nodeType == XML::LibXML::XML_DOCUMENT_FRAG_NODE);
+ok(!defined $frag->parentNode->parentNode);
+# document() from a node without a document
+my $docfile = "t/00-xpathcontext.tmp.xml";
+open(my $docfh, '>', $docfile) or die "cannot write $docfile: $!";
+print $docfh '<r><a/></r>';
+close($docfh);
+ok($xc5->findvalue(qq{count(document("$docfile")/r/a)}) == 1);
+unlink $docfile;
+
+# clones share the registrations until they change them
+my $proto = XML::LibXML::XPathContext->new($doc1);
+$proto->registerNs('f', 'http://example.com/foobar');
+$proto->registerFunction('twice', sub { 2 * shift });
+ok($proto->findvalue('twice(count(//f:bar))') == 2);
+my $c1 = $proto->clone;
+my $c2 = $proto->clone($doc1->documentElement);
+ok($c1->getContextNode->isSameNode($doc1));
+ok($c2->findnodes('f:bar')->pop->nodeName eq 'bar');
+ok($c1->findvalue('twice(count(//f:bar))') == 2);
+$c1->registerNs('f', 'urn:other');
+$c1->registerFunction('twice', sub { 3 * shift });
+ok($c1->findvalue('count(//f:bar)') == 0);
+ok($c1->findvalue('twice(1)') == 3);
+ok($proto->findvalue('count(//f:bar)') == 1);
+ok($c2->findvalue('twice(1)') == 2);
+undef $proto;
+ok($c2->lookupNs('f') eq 'http://example.com/foobar');
+$c2->setCompiledCache(0);
+ok($c2->findvalue('twice(count(//f:bar))') == 2);
@@ -1,6 +1,6 @@
 # -*- cperl -*-
 use Test;
-BEGIN { plan tests => 32 };
+BEGIN { plan tests => 36 };
 
 use XML::LibXML;
 use XML::LibXML::XPathContext;
@@ -113,3 +113,16 @@ ok($xc->find('$a[name()="b"]')->size()==3000);
 my @pass1=$xc->findnodes('pass1()');
 ok(@pass1==3001);
 ok($xc->find('pass2(//*)')->size()==3001);
+
+# a function dying in a query on a fragment leaves the fragment alone
+my $top = XML::LibXML::Element->new('top');
+my $inner = $top->appendChild(XML::LibXML::Element->new('e'));
+my $fc = XML::LibXML::XPathContext->new($inner);
+$fc->registerFunction('fail', sub { die "failed\n" });
+my $ancestors = $fc->findnodes('ancestor::node()')->size;
+ok(!eval { $fc->findnodes('fail()'); 1 } && $@ =~ /failed/);
+ok($inner->parentNode->isSameNode($top)
+   && (!defined $top->parentNode || $top->parentNode->nodeType == 11));
+ok($fc->findnodes('ancestor::node()')->size == $ancestors);
+undef $fc;
+ok($top->toString eq '<top><e/></top>');
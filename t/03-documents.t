@@ -0,0 +1,125 @@
+# -*- cperl -*-
+use Test;
+BEGIN { plan tests => 26 };
+
+use XML::LibXML;
+use XML::LibXML::XPathContext;
+
+my $doc = XML::LibXML->new->parse_string(<<'XML');
+<foo><ref href="codes.xml"/><ref href="inline.xml"/></foo>
+XML
+
+my $codes = XML::LibXML->new->parse_string(<<'XML');
+<codes><code id="a">Alpha</code><code id="b">Beta</code></codes>
+XML
+
+my $xc = XML::LibXML::XPathContext->new($doc);
+
+# registered document object
+$xc->registerDocument('codes.xml', $codes);
+ok($xc->findvalue('document("codes.xml")/codes/code[@id="b"]') eq 'Beta');
+ok($xc->findnodes('document("codes.xml")')->pop->isSameNode($codes));
+
+# in-memory string, parsed once
+my $inline = '<inline><x>1</x><x>2</x></inline>';
+$xc->registerDocument('inline.xml', \$inline);
+ok($xc->findvalue('count(document("inline.xml")//x)') == 2);
+my ($d1) = $xc->findnodes('document("inline.xml")');
+my ($d2) = $xc->findnodes('document("inline.xml")');
+ok($d1->isSameNode($d2));
+
+# nodeset argument uses the href attributes
+ok($xc->findvalue('count(document(//ref/@href)/*)') == 2);
+
+# local file
+my $file = "t/03-documents.tmp.xml";
+open(my $fh, '>', $file) or die "cannot write $file: $!";
+print $fh '<file><y/></file>';
+close($fh);
+$xc->registerDocument('local.xml', $file);
+ok($xc->findvalue('name(document("local.xml")/*)') eq 'file');
+
+# loader function
+my @seen;
+$xc->registerDocumentLoader(sub {
+    my ($data, $uri, $href) = @_;
+    push @seen, $href;
+    return \$data->{$href} if exists $data->{$href};
+    return $codes if $href eq 'http://example.com/codes.xml';
+    return undef;
+}, { 'http://example.com/a.xml' => '<remote>A</remote>' });
+ok($xc->findvalue('document("http://example.com/a.xml")/remote') eq 'A');
+ok($xc->findnodes('document("http://example.com/codes.xml")')->pop->isSameNode($codes));
+ok(@seen == 2);
+
+# catalog entries win over the loader
+ok($xc->findvalue('document("codes.xml")//code[1]') eq 'Alpha');
+ok(@seen == 2);
+
+# undef from the loader falls back to the file system
+ok($xc->findvalue('name(document("t/03-documents.tmp.xml")/*)') eq 'file');
+
+# loader errors are reported
+$xc->registerDocumentLoader(sub { die "no network\n" }, undef);
+eval { $xc->findnodes('document("http://example.com/b.xml")') };
+ok($@ =~ /no network/);
+
+$xc->unregisterDocumentLoader();
+$xc->unregisterDocument('codes.xml');
+eval { $xc->findnodes('document("codes.xml")') };
+ok($@ =~ /codes\.xml/);
+
+# parse options apply to documents loaded by document()
+my $spaced = "<s>\n  <t/>\n  <t/>\n</s>";
+$xc->registerDocument('spaced.xml', \$spaced);
+ok($xc->findvalue('count(document("spaced.xml")/s/text())') == 3);
+$xc->setDocumentParseOptions(noblanks => 1, huge => 1);
+$xc->registerDocument('spaced2.xml', \$spaced);
+ok($xc->findvalue('count(document("spaced2.xml")/s/text())') == 0);
+eval { $xc->setDocumentParseOptions(bogus => 1) };
+ok($@);
+
+# file: URIs and compressed files
+require Cwd;
+ok($xc->findvalue('name(document("file://'.Cwd::cwd().'/'.$file.'")/*)') eq 'file');
+my $gzfile = "t/03-documents.tmp.xml.gz";
+if (eval { require IO::Compress::Gzip; 1 }) {
+    IO::Compress::Gzip::gzip(\'<packed><z/></packed>' => $gzfile);
+    ok($xc->findvalue('name(document("'.$gzfile.'")/*)') eq 'packed');
+    unlink $gzfile;
+}
+else {
+    skip("IO::Compress::Gzip not available", 1);
+}
+
+# nodeset arguments: distinct URIs are loaded once, possibly in parallel
+$xc->setDocumentParseOptions();
+$xc->setDocumentPrefetchThreads(4);
+my @parts = map { "t/03-documents.part$_.tmp.xml" } 1..6;
+for my $i (0..$#parts) {
+    open(my $pfh, '>', $parts[$i]) or die "cannot write $parts[$i]: $!";
+    print $pfh "<part n='$i'/>";
+    close($pfh);
+}
+my $index = XML::LibXML->new->parse_string(
+    '<index>'.join('', map { "<ref href='$_'/>" } @parts, @parts[0,1]).'</index>');
+my $xci = XML::LibXML::XPathContext->new($index);
+$xci->setDocumentPrefetchThreads(4);
+ok($xci->findvalue('count(document(//ref/@href))') == 6);
+ok($xci->findvalue('sum(document(//ref/@href)/part/@n)') == 15);
+ok($xci->findvalue('count(document(//ref/@href) | document(//ref[1]/@href))') == 6);
+
+# a shared dictionary for the documents and the compiled expressions
+$xci->setSharedDictionary(1);
+ok($xci->findvalue('count(document(//ref[position() < 9]/@href)/part)') == 6);
+ok($xci->findvalue('name(document(//ref[1]/@href)/*)') eq 'part');
+$xci->setSharedDictionary(0);
+ok($xci->findvalue('count(document(//ref[position() < 9]/@href))') == 6);
+
+# a missing file is still reported
+$index->documentElement->appendChild($index->createElement('ref'))
+    ->setAttribute('href', 't/03-documents.missing.xml');
+eval { $xci->findnodes('document(//ref/@href)') };
+ok($@ =~ /missing/);
+
+unlink $file, @parts;
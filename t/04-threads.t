@@ -0,0 +1,39 @@
+use Test;
+use Config;
+BEGIN {
+    if ($Config{useithreads}) {
+        plan tests => 5;
+    }
+    else {
+        plan tests => 0;
+        print "# this perl does not support ithreads\n";
+        exit 0;
+    }
+}
+
+use threads;
+use XML::LibXML;
+use XML::LibXML::XPathContext;
+
+# contexts are not copied into new threads
+my $xc = XML::LibXML::XPathContext->new;
+ok(threads->create(sub { ref($xc) eq 'XML::LibXML::XPathContext' ? 0 : 1 })->join);
+ok(ref($xc) eq 'XML::LibXML::XPathContext');
+undef $xc;
+
+# every thread sees its own errors only
+my @threads = map {
+    my $n = $_;
+    threads->create(sub {
+        my $doc = XML::LibXML->new->parse_string("<t$n><i/><i/></t$n>");
+        my $xc = XML::LibXML::XPathContext->new($doc);
+        my $ok = 1;
+        for (1..50) {
+            eval { $xc->find("/t$n\[") };
+            $ok = 0 unless $@ =~ /Invalid expression/ && $@ =~ m{/t$n\[};
+            $ok = 0 unless $xc->findvalue("count(/t$n/i)") == 2;
+        }
+        $ok;
+    });
+} 1..3;
+ok($_->join) for @threads;
@@ -0,0 +1,69 @@
+use Test;
+BEGIN { plan tests => 19 };
+
+use XML::LibXML;
+use XML::LibXML::XPathContext;
+
+my @docs = map {
+    XML::LibXML->new->parse_string(
+        "<r xmlns='urn:r'><n>$_</n>".('<i/>' x $_)."</r>")
+} 1..6;
+
+my $xc = XML::LibXML::XPathContext->new;
+$xc->registerNs('r', 'urn:r');
+$xc->setQueryThreads(4);
+
+# one result per node, in order
+my @lists = $xc->findnodes_many('/r:r/r:i', \@docs);
+ok(@lists == 6);
+ok(join(',', map { $_->size } @lists) eq '1,2,3,4,5,6');
+ok($lists[2]->get_node(1)->ownerDocument->isSameNode($docs[2]));
+ok(join(',', $xc->findvalue_many('r:r/r:n', \@docs)) eq '1,2,3,4,5,6');
+ok(join(',', $xc->findvalue_many('count(//r:i) > 3', \@docs))
+   eq 'false,false,false,true,true,true');
+ok(join(',', $xc->findvalue_many('string(r:r/r:n) * 2', \@docs)) eq '2,4,6,8,10,12');
+
+# elements as context nodes, with in-scope namespaces
+my @roots = map { $_->documentElement } @docs;
+ok(join(',', map { $_->size } $xc->findnodes_many('r:i[2]', \@roots))
+   eq '0,1,1,1,1,1');
+ok(join(',', $xc->findvalue_many('count(r:i)', [ @roots[0,5,0] ])) eq '1,6,1');
+
+# the same, one node after the other
+$xc->setQueryThreads(1);
+ok(join(',', map { $_->size } $xc->findnodes_many('/r:r/r:i', \@docs))
+   eq '1,2,3,4,5,6');
+$xc->setQueryThreads(4);
+$xc->registerFunction('twice', sub { 2 * shift });
+ok(join(',', $xc->findvalue_many('twice(string(r:r/r:n))', \@docs)) eq '2,4,6,8,10,12');
+$xc->unregisterFunction('twice');
+
+# errors
+eval { $xc->findnodes_many('/r:r[', \@docs) };
+ok($@ =~ /Invalid expression/);
+eval { $xc->findnodes_many('/x:r', \@docs) };
+ok($@ =~ /namespace prefix/);
+eval { $xc->findnodes_many('/r:r', [ $docs[0], 'foo' ]) };
+ok($@);
+ok(!$xc->findnodes_many('/r:r', []));
+
+# descendant scans split over several threads
+my $big = XML::LibXML->new->parse_string(
+    '<db>'.join('', map { "<rec k='".($_ % 3)."'><v>$_</v>".
+                          ($_ % 4 ? '' : "<rec k='0'><v>-$_</v></rec>").
+                          '</rec>' } 1..200).'</db>');
+my $xs = XML::LibXML::XPathContext->new($big);
+my $xp = XML::LibXML::XPathContext->new($big->documentElement);
+$xp->setQueryThreads(4);
+$xp->setParallelScan(1);
+sub same_nodes {
+    my ($a, $b) = @_;
+    return 0 unless @$a == @$b;
+    for (0..$#$a) { return 0 unless $a->[$_]->isSameNode($b->[$_]) }
+    return 1;
+}
+for my $expr ('//rec[@k=0]/v', '//v', '//rec[v > 150 or @k=1]', '//rec[@k=2]/..') {
+    ok(same_nodes([ $xs->findnodes($expr) ], [ $xp->findnodes($expr) ]));
+}
+$xp->registerFunction('neg', sub { $_[0] < 0 });
+ok(scalar(() = $xp->findnodes('//rec[neg(string(v))]')) == 50);
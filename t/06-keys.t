@@ -0,0 +1,57 @@
+use Test;
+BEGIN { plan tests => 14 };
+
+use XML::LibXML;
+use XML::LibXML::XPathContext;
+
+my $doc = XML::LibXML->new->parse_string(<<'XML');
+<parts xmlns:p="urn:p">
+  <part id="a" group="x"><name>bolt</name></part>
+  <part id="b" group="y"><name>nut</name></part>
+  <part id="c" group="x"><name>washer</name></part>
+  <use ref="c"/>
+  <use ref="a"/>
+  <p:part id="d"/>
+</parts>
+XML
+
+my $xc = XML::LibXML::XPathContext->new($doc);
+$xc->registerKey('part', '//part', '@id');
+$xc->registerKey('group', '//part', '@group');
+
+ok($xc->findvalue('key("part", "b")/name') eq 'nut');
+ok($xc->findnodes('key("part", "z")')->size == 0);
+ok(join(',', map { $_->getAttribute('id') } $xc->findnodes('key("group", "x")'))
+   eq 'a,c');
+
+# a nodeset value looks up each of its string values, in document order
+ok(join(',', map { $_->getAttribute('id') } $xc->findnodes('key("part", //use/@ref)'))
+   eq 'a,c');
+ok($xc->findvalue('count(//use[key("part", @ref)])') == 2);
+ok(join(',', map { $xc->findvalue('key("part", @ref)/name', $_) }
+              $xc->findnodes('//use'))
+   eq 'washer,bolt');
+
+# the index follows changes to the document between queries
+$xc->findnodes(q{//part[@id = "a"]})->pop->setAttribute('id', 'e');
+ok($xc->findnodes('key("part", "a")')->size == 0);
+ok($xc->findnodes('key("part", "e")')->size == 1);
+
+# use expressions may yield several values; namespaces are resolved
+$xc->registerNs('p', 'urn:p');
+$xc->registerKey('any', '//part | //p:part', '@id | name');
+ok($xc->findnodes('key("any", "d")')->size == 1);
+ok($xc->findnodes('key("any", "nut")')->size == 1);
+
+# unknown keys are errors
+eval { $xc->findnodes('key("nope", "a")') };
+ok($@ =~ /unknown key 'nope'/);
+$xc->registerKey('group', undef, undef);
+eval { $xc->findnodes('key("group", "x")') };
+ok($@ =~ /unknown key/);
+
+# clones take the keys over
+my $clone = $xc->clone;
+ok($clone->findvalue('key("part", "c")/name') eq 'washer');
+$clone->registerKey('part', '//part', 'name');
+ok($xc->findvalue('key("part", "c")/name') eq 'washer');
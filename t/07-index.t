@@ -0,0 +1,97 @@
+use Test;
+BEGIN { plan tests => 35 };
+
+use XML::LibXML;
+use XML::LibXML::XPathContext;
+
+my $doc = XML::LibXML->new->parse_string(<<'XML');
+<r xmlns:p="urn:p">
+  <a n="1"><b n="2"/><a n="3"><b n="4"/></a></a>
+  <p:a n="5"/>
+  <c><a n="6"><b n="7"/></a></c>
+</r>
+XML
+
+my $xc = XML::LibXML::XPathContext->new($doc);
+$xc->registerNs('p', 'urn:p');
+ok($xc->getIndexMemory($doc) == 0);
+$xc->setNameIndex(1);
+
+sub ns { join ',', map { $_->getAttribute('n') } @_ }
+
+ok(ns($xc->findnodes('//a')) eq '1,3,6');
+ok($xc->getIndexMemory($doc) > 0);
+ok(ns($xc->findnodes('//p:a')) eq '5');
+ok($xc->findnodes('//nothing')->size == 0);
+ok(ns($xc->findnodes('//a[b]')) eq '1,3,6');
+ok(ns($xc->findnodes('//a[@n > 2]/b')) eq '4,7');
+ok(ns($xc->findnodes('//a/b | //p:a')) eq '2,4,5,7');
+ok($xc->findvalue('count(//b)') == 3);
+
+# changes to the document are seen
+my $c = $xc->findnodes('//c')->pop;
+my $e = $c->appendChild($doc->createElement('a'));
+$e->setAttribute('n', 8);
+ok(ns($xc->findnodes('//a')) eq '1,3,6,8');
+$e->unbindNode;
+ok(ns($xc->findnodes('//a')) eq '1,3,6');
+my ($first) = $xc->findnodes('//a');
+$doc->documentElement->appendChild($first);
+ok(ns($xc->findnodes('//a')) eq '6,1,3');
+$doc->documentElement->appendChild($xc->findnodes('//c')->pop);
+ok(ns($xc->findnodes('//a')) eq '1,3,6');
+$c->setAttribute('n', 9);
+ok(ns($xc->findnodes('//a')) eq '1,3,6');
+$c->setNodeName('a');
+ok(ns($xc->findnodes('//a')) eq '1,3,9,6');
+$c->setNodeName('c');
+
+$xc->dropIndexes($doc);
+ok($xc->getIndexMemory($doc) == 0);
+$xc->setNameIndex(0);
+ok(ns($xc->findnodes('//a[b]')) eq '1,3,6');
+
+# attribute values
+my $big = XML::LibXML->new->parse_string(
+    '<r xmlns:q="urn:q">'
+    . join('', map { "<item id='$_' q:k='" . ($_ % 3) . "'><v>$_</v></item>" } 1..30)
+    . '<other id="7"/></r>');
+my $ac = XML::LibXML::XPathContext->new($big);
+$ac->registerNs('q', 'urn:q');
+$ac->indexAttribute('item', 'id');
+ok($ac->findvalue('//item[@id = "7"]/v') eq '7');
+ok($ac->getIndexMemory($big) > 0);
+ok($ac->findnodes(q{//item[ '12'=@id ]})->size == 1);
+ok($ac->findnodes('//item[@id = "99"]')->size == 0);
+ok($ac->findvalue('sum(//item[@id = "3"][v > 2]/v)') == 3);
+ok($ac->findnodes('//item[@id = "3"][v > 3]')->size == 0);
+
+# hot after repeated queries
+$ac->dropIndexes($big);
+$ac->setAttributeIndexThreshold(2);
+ok($ac->findnodes('//item[@q:k = "1"]')->size == 10);
+ok($ac->getIndexMemory($big) == 0);
+ok(join(',', map { $_->getAttribute('id') } $ac->findnodes('//item[@q:k = "2"]'))
+   eq '2,5,8,11,14,17,20,23,26,29');
+ok($ac->getIndexMemory($big) > 0);
+
+# changed values are seen
+$ac->findnodes('//item[@id = "4"]')->pop->setAttribute('id', 'x');
+ok($ac->findnodes('//item[@id = "4"]')->size == 0
+   && $ac->findnodes('//item[@id = "x"]')->size == 1);
+
+# number ranges
+my $nums = XML::LibXML->new->parse_string(
+    '<r>' . join('', map { "<item id='" . (31 - $_) . "'/>" } 1..30)
+    . '<item id="n/a"/><item id="-2.5"/></r>');
+my $nc = XML::LibXML::XPathContext->new($nums);
+$nc->indexNumbers('item', 'id');
+sub ids { join ',', map { $_->getAttribute('id') } @_ }
+ok(ids($nc->findnodes('//item[@id > 10 and @id <= 13]')) eq '13,12,11');
+ok($nc->getIndexMemory($nums) > 0);
+ok(ids($nc->findnodes('//item[3 >= @id]')) eq '3,2,1,-2.5');
+ok(ids($nc->findnodes('//item[@id < -1]')) eq '-2.5');
+ok(ids($nc->findnodes('//item[@id = 30]')) eq '30');
+ok($nc->findnodes('//item[@id > 5 and @id < 5]')->size == 0);
+$nc->findnodes('//item[@id = 12]')->pop->setAttribute('id', 40);
+ok(ids($nc->findnodes('//item[@id >= 11 and @id < 13]')) eq '11');
@@ -0,0 +1,50 @@
+use Test;
+BEGIN { plan tests => 8 };
+
+use XML::LibXML;
+use XML::LibXML::XPathContext;
+
+sub ns { join ',', map { $_->getAttribute('n') } @_ }
+
+my $doc = XML::LibXML->new->parse_string(
+    '<r><a n="1"><b n="2"/></a><a n="3"><b n="4"/></a><c n="5"/></r>');
+my $xc = XML::LibXML::XPathContext->new($doc);
+ok(ns($xc->findnodes('//c | //b | //a')) eq '1,2,3,4,5');
+
+# moved nodes are renumbered
+my ($first) = $xc->findnodes('//a[@n = 1]');
+$doc->documentElement->appendChild($first);
+ok(ns($xc->findnodes('//c | //b | //a')) eq '3,4,5,1,2');
+my $e = $doc->createElement('b');
+$e->setAttribute('n', 6);
+$xc->findnodes('//c')->pop->appendChild($e);
+ok(ns($xc->findnodes('//b | //c')) eq '4,5,6,2');
+
+# nodes of a fragment
+my $frag = $doc->createDocumentFragment;
+$frag->appendChild($first);
+$frag->appendChild($xc->findnodes('//c')->pop);
+$xc->setContextNode($frag);
+ok(ns($xc->findnodes('.//b | .//a | .//c')) eq '1,2,5,6');
+$xc->setContextNode($doc);
+
+# large results sorted by number
+my $big = XML::LibXML->new->parse_string(
+    '<r>' . join('', map { "<a n='$_'><b n='$_'/><c n='$_'/></a>" } 1..2000) . '</r>');
+my $bc = XML::LibXML::XPathContext->new($big);
+$bc->setNameIndex(1);
+my $plain = ns(XML::LibXML::XPathContext->new($big)->findnodes('//a/*'));
+ok(ns($bc->findnodes('//a/*')) eq $plain);
+$big->documentElement->appendChild($bc->findnodes('//a[@n = 7]')->pop);
+$plain = ns(XML::LibXML::XPathContext->new($big)->findnodes('//a/*'));
+ok(ns($bc->findnodes('//a/*')) eq $plain && $plain =~ /,7,7$/);
+
+# the numbers are removed even if the query dies, so that XML::LibXML's
+# own queries do not sort by them
+my $kept = XML::LibXML->new->parse_string('<r><a n="1"/><b n="2"/><c n="3"/></r>');
+my $kc = XML::LibXML::XPathContext->new($kept);
+$kc->registerFunction('fail', sub { die "failed\n" });
+ok(!eval { $kc->findnodes('//*[fail()]'); 1 } && $@ =~ /failed/);
+my ($moved) = $kept->documentElement->childNodes;
+$kept->documentElement->appendChild($moved);
+ok(ns($kept->findnodes('//c | //b | //a')) eq '2,3,1');
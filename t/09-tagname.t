@@ -0,0 +1,32 @@
+use Test;
+BEGIN { plan tests => 10 };
+
+use XML::LibXML;
+use XML::LibXML::XPathContext;
+
+my $doc = XML::LibXML->new->parse_string(<<'XML');
+<r xmlns:p="urn:p">
+  <a n="1"><b n="2"/><a n="3"><b n="4"/></a></a>
+  <p:a n="5"><p:b n="6"/></p:a>
+  <c xmlns="urn:d"><a n="7"/></c>
+</r>
+XML
+
+sub ns { join ',', map { $_->getAttribute('n') } @_ }
+
+my $xc = XML::LibXML::XPathContext->new($doc);
+ok(ns($xc->getElementsByTagName('a')) eq '1,3,7');
+ok(ns($xc->getElementsByTagName('p:a')) eq '5');
+ok($xc->getElementsByTagName('*')->size == 9);
+ok($xc->getElementsByTagName('nothing')->size == 0);
+ok(ns($xc->getElementsByTagNameNS('urn:d', 'a')) eq '7');
+ok(ns($xc->getElementsByTagNameNS(undef, 'a')) eq '1,3');
+ok(ns($xc->getElementsByTagNameNS('*', 'a')) eq '1,3,5,7');
+ok(ns($xc->getElementsByTagNameNS('urn:p', '*')) eq '5,6');
+
+# below a given node, with nodes not made by the parser
+my $first = $xc->findnodes('/r/a')->pop;
+my $e = $first->appendChild($doc->createElement('b'));
+$e->setAttribute('n', 8);
+ok(ns($xc->getElementsByTagName('b', $first)) eq '2,4,8');
+ok($xc->getContextNode->isSameNode($doc));
@@ -0,0 +1,66 @@
+use Test;
+BEGIN { plan tests => 14 };
+
+use XML::LibXML;
+use XML::LibXML::XPathContext;
+
+my $file = "t/stream-$$.xml";
+open my $out, '>', $file or die "cannot write $file: $!";
+print $out '<feed xmlns:p="urn:p">';
+print $out "<item id='$_'><title>t$_</title><item id='$_.1'/></item>" for 1..50;
+print $out '<p:item id="p"/></feed>';
+close $out;
+
+my $xc = XML::LibXML::XPathContext->new;
+my @ids;
+ok($xc->streamfind($file, '/feed/item', sub { push @ids, $_[0]->getAttribute('id') }) == 50);
+ok(join(',', @ids[0..2]) eq '1,2,3');
+
+# nodes handed to the callback may be kept
+my @kept;
+ok($xc->streamfind($file, '//item', sub { push @kept, $_[0] }) == 100);
+ok($kept[0]->getAttribute('id') eq '1' && $kept[1]->getAttribute('id') eq '1.1');
+ok($kept[0]->toString =~ m{<title>t1</title>});
+
+$xc->registerNs('q', 'urn:p');
+my $n = 0;
+ok($xc->streamfind($file, '//q:item', sub { $n++ }) == 1 && $n == 1);
+
+open my $in, '<', $file or die "cannot read $file: $!";
+ok($xc->streamfind($in, '/feed/item/title', sub { }) == 50);
+close $in;
+
+eval { $xc->streamfind($file, '/feed/item', sub { die "stop\n" }) };
+ok($@ =~ /stop/);
+eval { $xc->streamfind($file, '//item[1]', sub { }) };
+ok($@ =~ /not a streamable pattern/);
+eval { $xc->streamfind("t/missing-$$.xml", '//item', sub { }) };
+ok($@);
+
+
+# full expressions per record
+open $out, '>', $file or die "cannot write $file: $!";
+print $out '<export xmlns="urn:e">';
+print $out "<customer id='$_'><name>c$_</name><order total='$_'/><order total='1'/></customer>" for 1..20;
+print $out '</export>';
+close $out;
+
+$xc->registerNs('e', 'urn:e');
+$xc->registerFunction('double', sub { 2 * shift });
+$xc->registerVarLookupFunc(sub { $_[1] eq 'min' ? 5 : undef }, undef);
+my (@names, @totals, $records);
+ok($xc->streamrecords($file, '/e:export/e:customer',
+       [ 'string(e:name)', 'double(sum(e:order/@total))', 'e:order[@total > $min]' ],
+       sub {
+           my ($record, $name, $total, $big) = @_;
+           $records++ if $record->nodeName eq 'customer';
+           push @names, $name->value;
+           push @totals, $total->value;
+           push @totals, $big->size;
+       }) == 20);
+ok($records == 20 && $names[0] eq 'c1' && $names[19] eq 'c20');
+ok(join(',', @totals[0..1, 10..11]) eq '4,0,14,1');
+eval { $xc->streamrecords($file, '//e:customer', [ 'e:name[' ], sub { }) };
+ok($@);
+
+unlink $file;
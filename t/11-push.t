@@ -0,0 +1,39 @@
+use Test;
+BEGIN { plan tests => 9 };
+
+use XML::LibXML;
+use XML::LibXML::XPathContext;
+
+my $xc = XML::LibXML::XPathContext->new;
+$xc->registerNs('p', 'urn:p');
+
+my (@items, @alerts);
+my $stream = $xc->newPushStream(
+    '/feed/item' => sub { push @items, $_[0] },
+    '//p:alert'  => sub { push @alerts, $_[0]->getAttribute('level') });
+ok($stream);
+
+my $xml = '<feed xmlns:p="urn:p"><item id="1"><p:alert level="a"/></item>'
+        . '<item id="2">two</item><other/><item id="3"/></feed>';
+# matches are reported as soon as they close
+$stream->feed(substr($xml, 0, 57));
+ok(@items == 0 && @alerts == 1 && $alerts[0] eq 'a');
+$stream->feed(substr($xml, 57, 28));
+ok(@items == 2 && $items[0]->getAttribute('id') eq '1');
+ok($items[0]->toString =~ /alert/ && $items[1]->textContent eq 'two');
+$stream->feed($_) for split //, substr($xml, 85);
+$stream->finish;
+ok(join(',', map { $_->getAttribute('id') } @items) eq '1,2,3');
+eval { $stream->feed('<more/>') };
+ok($@ =~ /finished/);
+
+my $bad = $xc->newPushStream('//item' => sub { });
+eval { $bad->feed('<feed><item></feed>'); $bad->finish };
+ok($@);
+
+my $dies = $xc->newPushStream('//item' => sub { die "enough\n" });
+eval { $dies->feed('<feed><item/><item/></feed>') };
+ok($@ =~ /enough/);
+
+eval { $xc->newPushStream('//item[2]' => sub { }) };
+ok($@ =~ /not a streamable pattern/);
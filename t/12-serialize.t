@@ -0,0 +1,38 @@
+use Test;
+BEGIN { plan tests => 9 };
+
+use XML::LibXML;
+use XML::LibXML::XPathContext;
+
+my $doc = XML::LibXML->new->parse_string(<<'XML');
+<r xmlns:p="urn:p"><a n="1"><!-- c --><b/></a><p:a  z="2" y="1">t&amp;</p:a></r>
+XML
+my $xc = XML::LibXML::XPathContext->new($doc);
+$xc->registerNs('p', 'urn:p');
+
+ok($xc->findserialize('//a | //p:a') eq
+   '<a n="1"><!-- c --><b/></a><p:a z="2" y="1">t&amp;</p:a>');
+ok($xc->findserialize('//b | //a/@n', undef, separator => "\n") eq qq{ n="1"\n<b/>});
+ok($xc->findserialize('//nothing') eq '');
+ok($xc->findserialize('count(//a)') eq '1');
+
+# canonical
+ok($xc->findserialize('//p:a', undef, c14n => 1) eq
+   '<p:a xmlns:p="urn:p" y="1" z="2">t&amp;</p:a>');
+ok($xc->findserialize('//a', undef, c14n => 1) eq
+   '<a xmlns:p="urn:p" n="1"><b></b></a>');
+ok($xc->findserialize('//a', undef, c14n => 'exclusive', comments => 1)
+   eq '<a n="1"><!-- c --><b></b></a>');
+
+# to a filehandle, with a context node
+my $file = "t/serialize-$$.xml";
+open my $fh, '>', $file or die "cannot write $file: $!";
+my $count = $xc->findserialize('*', $fh, separator => '|',
+                               node => $xc->findnodes('/r')->pop);
+close $fh;
+open $fh, '<', $file or die "cannot read $file: $!";
+my $written = <$fh>;
+close $fh;
+unlink $file;
+ok($count == 2);
+ok($written eq '<a n="1"><!-- c --><b/></a>|<p:a z="2" y="1">t&amp;</p:a>');
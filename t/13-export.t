@@ -0,0 +1,57 @@
+use Test;
+BEGIN { plan tests => 11 };
+
+use XML::LibXML;
+use XML::LibXML::XPathContext;
+
+my $xml = <<'XML';
+<r xmlns:p="urn:p">
+  <item id="1" p:ok="yes"><name>plain</name><price>2.5</price></item>
+  <item id="2"><name>comma, "quote"</name><price>x</price></item>
+  <item id="3"><name>tab	back\slash
+line</name></item>
+</r>
+XML
+my $doc = XML::LibXML->new->parse_string($xml);
+my $xc = XML::LibXML::XPathContext->new($doc);
+$xc->registerNs('p', 'urn:p');
+my @columns = (id => '@id', name => 'name', price => 'number(price)');
+
+ok($xc->findexport('//item', \@columns) eq
+   qq{id,name,price\n1,plain,2.5\n2,"comma, ""quote""",NaN\n3,"tab\tback\\slash\nline",NaN\n});
+ok($xc->findexport('//item', [ id => '@id' ], undef, header => 0) eq "1\n2\n3\n");
+ok($xc->findexport('//item', \@columns, undef, format => 'tsv') eq
+   qq{id\tname\tprice\n1\tplain\t2.5\n2\tcomma, "quote"\tNaN\n3\ttab\\tback\\\\slash\\nline\tNaN\n});
+ok($xc->findexport('//item[@id < 3]',
+                   [ @columns, ok => '@p:ok', big => 'price > 1' ], undef,
+                   format => 'ndjson') eq
+   qq{{"id":"1","name":"plain","price":2.5,"ok":"yes","big":true}\n}
+   . qq{{"id":"2","name":"comma, \\"quote\\"","price":null,"ok":null,"big":false}\n});
+ok($xc->findexport('//nothing', \@columns) eq "id,name,price\n");
+
+eval { $xc->findexport('count(//item)', \@columns) };
+ok($@ =~ /have to be nodes/);
+eval { $xc->findexport('//item', [ 'id' ]) };
+ok($@ =~ /names and expressions/);
+eval { $xc->findexport('//item', [ id => '@@' ]) };
+ok($@);
+
+# to a filehandle, reading the rows as a stream
+my $in = "t/export-$$.xml";
+my $out = "t/export-$$.csv";
+open my $fh, '>', $in or die "cannot write $in: $!";
+print $fh $xml;
+close $fh;
+open $fh, '>', $out or die "cannot write $out: $!";
+my $count = $xc->findexport('/r/item', [ id => '@id', n => 'string-length(name)' ],
+                            $fh, stream => $in, format => 'tsv', header => 0);
+close $fh;
+open $fh, '<', $out or die "cannot read $out: $!";
+my $written = join '', <$fh>;
+close $fh;
+unlink $in, $out;
+ok($count == 3);
+ok($written eq "1\t5\n2\t14\n3\t19\n");
+
+eval { $xc->findexport('//item[1]', \@columns, undef, stream => $in) };
+ok($@ =~ /streamable/);
@@ -0,0 +1,31 @@
+use Test;
+BEGIN { plan tests => 8 };
+
+use XML::LibXML;
+use XML::LibXML::XPathContext;
+
+# statements given as byte strings are in the document's encoding
+sub doc {
+    my ($encoding, $text) = @_;
+    my $xc = XML::LibXML::XPathContext->new(XML::LibXML->new->parse_string(
+        qq{<?xml version="1.0" encoding="$encoding"?>\n<r><a>$text</a><a>x</a></r>}));
+    return $xc;
+}
+
+my $latin = doc('ISO-8859-1', "\xe9t\xe9");
+ok($latin->findnodes("//a[. = '\xe9t\xe9']")->size == 1);
+ok(!grep { $latin->findnodes("//a[. = '\xe9t\xe9']")->size != 1 } 1..100);
+
+my $sjis = doc('Shift_JIS', "\x93\xfa\x96\x7b");
+ok($sjis->findnodes("//a[. = '\x93\xfa\x96\x7b']")->size == 1);
+ok($sjis->findnodes("//a[. = 'x']")->size == 1);
+
+# ASCII bytes are not taken as they are where they mean something else
+my $yen = doc('Shift_JIS', "1\x5c");
+ok($yen->findnodes("//a[. = '1\x5c']")->size == 1);
+ok($yen->findvalue("string-length(//a[1])") == 2);
+
+# encodings with shift states, statement after statement
+my $jis = doc('ISO-2022-JP', "\e\$BF|\e(B");
+ok($jis->findnodes("//a[. = '\e\$BF|\e(B']")->size == 1);
+ok($jis->findnodes("//a[. = 'x']")->size == 1);
@@ -0,0 +1,48 @@
+use Test;
+BEGIN { plan tests => 17 };
+
+use XML::LibXML;
+use XML::LibXML::XPathContext;
+
+my $doc = XML::LibXML->new->parse_string(
+    '<r>' . join('', map { "<a n='$_'/>" } 1..5) . '</r>');
+my $xc = XML::LibXML::XPathContext->new($doc);
+
+# off by default
+$xc->findnodes('//a');
+my $s = $xc->stats;
+ok(!$s->{enabled} && $s->{queries} == 0);
+
+$xc->setStats(1);
+ok($xc->findnodes('//a')->size == 5);
+ok($xc->findvalue('count(//a)') == 5);
+$s = $xc->stats;
+ok($s->{enabled});
+ok($s->{queries} == 2);
+ok($s->{nodes} == 5);
+# //a was compiled before
+ok($s->{compile_cache_misses} == 1 && $s->{compile_cache_hits} == 1);
+ok($s->{phases}{eval}{count} == 2 && $s->{phases}{eval}{seconds} > 0);
+ok($s->{phases}{compile}{count} == 2 && $s->{phases}{convert}{count} == 2);
+
+$xc->findnodes('//a');
+ok($xc->stats->{compile_cache_hits} == 2);
+
+# callbacks and the nodes they return
+$xc->registerFunction('same', sub { $_[0] });
+ok($xc->findnodes('same(//a[1])')->size == 1);
+$s = $xc->stats;
+ok($s->{phases}{callback}{count} == 1);
+ok($s->{pool_nodes} == 1 && $s->{pool_peak} == 1);
+
+my $text = $xc->stats_openmetrics('t');
+ok($text =~ /^t_queries_total 4$/m);
+ok($text =~ /^t_phase_calls_total\{phase="callback"\} 1$/m
+   && $text =~ /# EOF\n\z/);
+
+$xc->reset_stats;
+ok($xc->stats->{queries} == 0 && $xc->stats->{enabled});
+
+$xc->setStats(0);
+$xc->findnodes('//a');
+ok(!$xc->stats->{enabled} && $xc->stats->{queries} == 0);
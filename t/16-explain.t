@@ -0,0 +1,52 @@
+use Test;
+use XML::LibXML;
+use XML::LibXML::XPathContext;
+BEGIN {
+    eval { XML::LibXML::XPathContext->new->explain('/a') };
+    if ($@ =~ /built without debugging support/) {
+        plan tests => 0;
+        print "# libxml2 was built without debugging support\n";
+        exit 0;
+    }
+    plan tests => 16;
+}
+
+my $xc = XML::LibXML::XPathContext->new;
+
+my $plan = $xc->explain('/r/a');
+ok($plan->{expression} eq '/r/a' && $plan->{steps} > 0);
+my $step = $plan->{tree}{children}[0];
+ok($step->{op} eq 'COLLECT' && $step->{axis} eq 'child' && $step->{test} eq 'a');
+ok($step->{input}{test} eq 'r' && $step->{input}{input}{op} eq 'ROOT');
+ok(!@{$plan->{scans}} && !@{$plan->{optimizations}});
+
+# // without predicates becomes the descendant axis
+$plan = $xc->explain('//a');
+$step = $plan->{tree}{children}[0];
+ok($step->{axis} eq 'descendant' && $step->{rewritten});
+ok($step->{scan} eq 'document');
+ok(join(',', @{$plan->{scans}}) eq 'descendant::a');
+
+# with predicates it stays a scan of every node
+$plan = $xc->explain('//a[@id = "x"]');
+$step = $plan->{tree}{children}[0];
+ok($step->{axis} eq 'child' && $step->{input}{axis} eq 'descendant-or-self');
+ok(join(',', @{$plan->{scans}}) eq 'descendant-or-self::node()');
+my $pred = $step->{predicates}[0];
+ok($pred->{op} eq 'EQUAL' && $pred->{operands}[0]{axis} eq 'attribute'
+   && $pred->{operands}[1]{value} eq 'x');
+
+# relative descendants and literals
+$plan = $xc->explain('a[.//b]/c');
+ok(!@{$plan->{scans}});
+ok(!@{$xc->explain('"//x"')->{scans}});
+
+# positions
+$plan = $xc->explain('b[@x][2]');
+$step = $plan->{tree}{children}[0];
+ok($step->{position_limit} == 2 && @{$step->{predicates}} == 2);
+ok($xc->explain('(//a)[1]')->{tree}{children}[0]{shortcut} eq 'first');
+ok($xc->explain('(//a)[last()]')->{tree}{children}[0]{shortcut} eq 'last');
+
+eval { $xc->explain('//a[') };
+ok($@);
@@ -2,13 +2,218 @@
 #include <libxml/xpath.h>
 #include <libxml/xpathInternals.h>
 #include <libxml/uri.h>
+#include <libxml/parser.h>
+#include <libxml/chvalid.h>
+#include <libxml/c14n.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_MMAP
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "EXTERN.h"
 
 #include "dom.h"
+#include "xpath.h"
+#include "index.h"
+
+#if defined(HAVE_PTHREAD) && defined(LIBXML_THREAD_ENABLED)
+#define XPC_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/**
+ * runs job->run() for every index below job->count. with nthreads > 1
+ * the indices are handed out one by one to up to nthreads threads (the
+ * calling thread being one of them), so slow items do not hold up the
+ * rest. every thread gets its own state slot, which is passed to
+ * job->finish() when the thread runs out of work.
+ **/
+struct _xpc_ParallelQueue {
+    xpc_ParallelJob * job;
+    int next;
+#ifdef XPC_THREADS
+    pthread_mutex_t lock;
+#endif
+};
+
+static void *
+xpc_domParallelWorker( void * arg )
+{
+    struct _xpc_ParallelQueue * queue = (struct _xpc_ParallelQueue *)arg;
+    void * state = NULL;
+    int index;
+
+    for (;;) {
+#ifdef XPC_THREADS
+        pthread_mutex_lock( &queue->lock );
+#endif
+        index = queue->next++;
+#ifdef XPC_THREADS
+        pthread_mutex_unlock( &queue->lock );
+#endif
+        if ( index >= queue->job->count )
+            break;
+        queue->job->run( queue->job, index, &state );
+    }
+    if ( queue->job->finish != NULL )
+        queue->job->finish( queue->job, state );
+    return NULL;
+}
+
+void
+xpc_domRunParallel( xpc_ParallelJob * job, int nthreads )
+{
+    struct _xpc_ParallelQueue queue;
+#ifdef XPC_THREADS
+    pthread_t * threads = NULL;
+    int started = 0;
+    int i;
+#endif
+
+    queue.job  = job;
+    queue.next = 0;
+
+#ifdef XPC_THREADS
+    if ( nthreads > job->count )
+        nthreads = job->count;
+    if ( nthreads > 1 ) {
+        /* make sure libxml2's globals are set up before anybody uses them */
+        xmlInitParser();
+        pthread_mutex_init( &queue.lock, NULL );
+        threads = (pthread_t *)xmlMalloc( sizeof(pthread_t) * (nthreads - 1) );
+        if ( threads != NULL ) {
+            for ( i = 0; i < nthreads - 1; i++ ) {
+                if ( pthread_create( &threads[started], NULL,
+                                     xpc_domParallelWorker, &queue ) != 0 )
+                    break;
+                started++;
+            }
+        }
+        xpc_domParallelWorker( &queue );
+        for ( i = 0; i < started; i++ ) {
+            pthread_join( threads[i], NULL );
+        }
+        if ( threads != NULL )
+            xmlFree( threads );
+        pthread_mutex_destroy( &queue.lock );
+        return;
+    }
+#endif
+    xpc_domParallelWorker( &queue );
+}
+
+int
+xpc_domHaveThreads( void )
+{
+#ifdef XPC_THREADS
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+int
+xpc_domDefaultThreads( void )
+{
+#if defined(XPC_THREADS) && defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf( _SC_NPROCESSORS_ONLN );
+    if ( n > 1 )
+        return n > 64 ? 64 : (int)n;
+#endif
+    return 1;
+}
 
 void
 xpc_perlDocumentFunction(xmlXPathParserContextPtr ctxt, int nargs){
+    xpc_domDocumentFunction(ctxt, nargs, NULL);
+}
+
+/**
+ * collects the distinct URIs a nodeset argument of document() refers
+ * to and hands them to the loader's prefetch function in one go, so
+ * that it can load them all before they are asked for one by one.
+ **/
+static void
+xpc_domPrefetchDocuments(xmlXPathParserContextPtr ctxt, xmlNodeSetPtr nodes,
+                         xmlXPathObjectPtr obj2, const xpc_DocumentLoader * loader)
+{
+    xmlHashTablePtr seen;
+    xmlChar ** URIs;
+    xmlChar ** hrefs;
+    xmlChar *href, *base, *URI;
+    xmlNodePtr target;
+    int i, count = 0;
+
+    seen  = xmlHashCreate( nodes->nodeNr );
+    URIs  = (xmlChar **)xmlMalloc( sizeof(xmlChar *) * nodes->nodeNr );
+    hrefs = (xmlChar **)xmlMalloc( sizeof(xmlChar *) * nodes->nodeNr );
+    if ( seen == NULL || URIs == NULL || hrefs == NULL )
+        goto done;
+
+    for ( i = 0; i < nodes->nodeNr; i++ ) {
+        href = xmlXPathCastNodeToString( nodes->nodeTab[i] );
+        if ( href == NULL )
+            continue;
+        if ( (obj2 != NULL) && (obj2->nodesetval != NULL) &&
+             (obj2->nodesetval->nodeNr > 0) ) {
+            target = obj2->nodesetval->nodeTab[0];
+        } else {
+            target = nodes->nodeTab[i];
+        }
+        if ( target->type == XML_ATTRIBUTE_NODE ) {
+            target = ((xmlAttrPtr) target)->parent;
+        }
+        base = ( target != NULL ) ? xmlNodeGetBase( target->doc, target ) : NULL;
+        URI = xmlBuildURI( href, base );
+        if ( base != NULL )
+            xmlFree( base );
+        if ( URI == NULL
+             || ( ctxt->context->doc != NULL
+                  && xmlStrEqual( ctxt->context->doc->URL, URI ) )
+             || xmlHashAddEntry( seen, URI, URI ) != 0 ) {
+            if ( URI != NULL )
+                xmlFree( URI );
+            xmlFree( href );
+            continue;
+        }
+        URIs[count]  = URI;
+        hrefs[count] = href;
+        count++;
+    }
+
+    if ( count > 0 )
+        loader->prefetch( ctxt->context, (const xmlChar **)URIs,
+                          (const xmlChar **)hrefs, count );
+
+    for ( i = 0; i < count; i++ ) {
+        xmlFree( URIs[i] );
+        xmlFree( hrefs[i] );
+    }
+done:
+    if ( seen != NULL )
+        xmlHashFree( seen, NULL );
+    if ( URIs != NULL )
+        xmlFree( URIs );
+    if ( hrefs != NULL )
+        xmlFree( hrefs );
+}
+
+/**
+ * the XSLT document() function. if a loader is given, it is asked for
+ * every URI that does not point to the context document; otherwise
+ * the URI is parsed with xmlParseFile().
+ **/
+void
+xpc_domDocumentFunction(xmlXPathParserContextPtr ctxt, int nargs,
+                        const xpc_DocumentLoader * loader){
     xmlXPathObjectPtr obj = NULL, obj2 = NULL;
     xmlChar *base = NULL, *URI = NULL;
 
@@ -37,6 +242,11 @@ xpc_perlDocumentFunction(xmlXPathParserContextPtr ctxt, int nargs){
         obj = valuePop(ctxt);
         ret = xmlXPathNewNodeSet(NULL);
 
+        if (obj->nodesetval && obj->nodesetval->nodeNr > 1 &&
+            loader != NULL && loader->prefetch != NULL) {
+            xpc_domPrefetchDocuments(ctxt, obj->nodesetval, obj2, loader);
+        }
+
         if (obj->nodesetval) {
             for (i = 0; i < obj->nodesetval->nodeNr; i++) {
                 valuePush(ctxt,
@@ -48,7 +258,7 @@ xpc_perlDocumentFunction(xmlXPathParserContextPtr ctxt, int nargs){
                     valuePush(ctxt,
                               xmlXPathNewNodeSet(obj->nodesetval->nodeTab[i]));
                 }
-                xpc_perlDocumentFunction(ctxt, 2);
+                xpc_domDocumentFunction(ctxt, 2, loader);
                 newobj = valuePop(ctxt);
                 ret->nodesetval = xmlXPathNodeSetMerge(ret->nodesetval,
                                                        newobj->nodesetval);
@@ -86,7 +296,9 @@ xpc_perlDocumentFunction(xmlXPathParserContextPtr ctxt, int nargs){
             }
             base = xmlNodeGetBase(target->doc, target);
         } else {
-            base = xmlNodeGetBase(ctxt->context->node->doc, ctxt->context->node);
+            /* the context document, not node->doc, which is NULL for
+               nodes of a fragment hung below the shadow document */
+            base = xmlNodeGetBase(ctxt->context->doc, ctxt->context->node);
         }
         URI = xmlBuildURI(obj->stringval, base);
         if (base != NULL)
@@ -94,18 +306,22 @@ xpc_perlDocumentFunction(xmlXPathParserContextPtr ctxt, int nargs){
         if (URI == NULL) {
             valuePush(ctxt, xmlXPathNewNodeSet(NULL));
         } else {
-            if (xmlStrEqual(ctxt->context->node->doc->URL, URI)) {
-                valuePush(ctxt, xmlXPathNewNodeSet((xmlNodePtr)ctxt->context->node->doc));
+            if (ctxt->context->doc != NULL &&
+                xmlStrEqual(ctxt->context->doc->URL, URI)) {
+                valuePush(ctxt, xmlXPathNewNodeSet((xmlNodePtr)ctxt->context->doc));
             }
             else {
-                xmlDocPtr doc;
-                doc = xmlParseFile((const char *)URI);
+                xmlNodePtr doc;
+                if (loader != NULL)
+                    doc = loader->load(ctxt->context, URI, obj->stringval);
+                else
+                    doc = (xmlNodePtr) xmlParseFile((const char *)URI);
                 if (doc == NULL)
                     valuePush(ctxt, xmlXPathNewNodeSet(NULL));
                 else {
                     /* TODO: use XPointer of HTML location for fragment ID */
                     /* pbm #xxx can lead to location sets, not nodesets :-) */
-                    valuePush(ctxt, xmlXPathNewNodeSet((xmlNodePtr) doc));
+                    valuePush(ctxt, xmlXPathNewNodeSet(doc));
                 }
             }
             xmlFree(URI);
@@ -116,74 +332,265 @@ xpc_perlDocumentFunction(xmlXPathParserContextPtr ctxt, int nargs){
         xmlXPathFreeObject(obj2);
 }
 
+/**
+ * parses a document for document(). local files are mapped into
+ * memory and parsed in place, so the document is never copied into an
+ * intermediate buffer. compressed files and remote URIs are left to
+ * libxml2's I/O layer, which decompresses and reads them in chunks.
+ * reusing pctxt shares its dictionary between all documents parsed
+ * with it.
+ **/
+xmlDocPtr
+xpc_domReadDocument( xmlParserCtxtPtr pctxt, const char * URI, int options )
+{
+    xmlDocPtr doc = NULL;
+#ifdef HAVE_MMAP
+    char * filename = NULL;
+    const unsigned char * map;
+    struct stat st;
+    int fd;
+
+    if ( xmlStrncasecmp( (const xmlChar *)URI, (const xmlChar *)"file://", 7 ) == 0 ) {
+        filename = xmlURIUnescapeString( URI + 7, 0, NULL );
+        /* file://localhost/path */
+        if ( filename != NULL && filename[0] != '/' ) {
+            char * path = strchr( filename, '/' );
+            if ( path != NULL ) {
+                memmove( filename, path, strlen(path) + 1 );
+            }
+        }
+    }
+    else if ( strstr( URI, "://" ) == NULL ) {
+        filename = (char *)xmlStrdup( (const xmlChar *)URI );
+    }
+
+    if ( filename != NULL ) {
+        fd = open( filename, O_RDONLY );
+        if ( fd >= 0 ) {
+            if ( fstat( fd, &st ) == 0 && S_ISREG(st.st_mode) && st.st_size > 2
+                 && st.st_size <= INT_MAX ) {
+                map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+                if ( map != MAP_FAILED ) {
+                    /* gzip magic: let libxml2 decompress it as a stream */
+                    if ( !( map[0] == 0x1f && map[1] == 0x8b ) ) {
+#ifdef MADV_SEQUENTIAL
+                        madvise( (void *)map, st.st_size, MADV_SEQUENTIAL );
+#endif
+                        doc = xmlCtxtReadMemory( pctxt, (const char *)map,
+                                                 (int)st.st_size, URI,
+                                                 NULL, options );
+                        munmap( (void *)map, st.st_size );
+                        close( fd );
+                        xmlFree( filename );
+                        return doc;
+                    }
+                    munmap( (void *)map, st.st_size );
+                }
+            }
+            close( fd );
+        }
+        xmlFree( filename );
+    }
+#endif
+    return xmlCtxtReadFile( pctxt, URI, NULL, options );
+}
+
+/**
+ * parses count documents, using up to nthreads threads. every thread
+ * has a parser of its own. if dict is given, every thread's parser
+ * gets a sub-dictionary of it: names already in dict are shared, new
+ * ones are added to the thread's own dictionary, so that dict itself
+ * is only read while the threads run.
+ * documents that fail to parse are left NULL and errors are not
+ * reported, the caller is expected to retry them in its own thread.
+ **/
+struct _xpc_ReadJob {
+    const xmlChar ** URIs;
+    xmlDocPtr * docs;
+    int options;
+    xmlDictPtr dict;
+};
+
+static void
+xpc_domReadOne( xpc_ParallelJob * job, int index, void ** state )
+{
+    struct _xpc_ReadJob * read = (struct _xpc_ReadJob *)job->data;
+
+    if ( *state == NULL ) {
+        xmlParserCtxtPtr pctxt = xmlNewParserCtxt();
+        if ( pctxt == NULL )
+            return;
+        if ( read->dict != NULL ) {
+            xmlDictPtr sub = xmlDictCreateSub( read->dict );
+            if ( sub != NULL ) {
+                xmlDictFree( pctxt->dict );
+                pctxt->dict = sub;
+            }
+        }
+        *state = pctxt;
+    }
+    read->docs[index] = xpc_domReadDocument( (xmlParserCtxtPtr)*state,
+                                             (const char *)read->URIs[index],
+                                             read->options );
+}
+
+static void
+xpc_domReadDone( xpc_ParallelJob * job, void * state )
+{
+    if ( state != NULL )
+        xmlFreeParserCtxt( (xmlParserCtxtPtr)state );
+}
+
+void
+xpc_domReadDocuments( const xmlChar ** URIs, xmlDocPtr * docs, int count,
+                      int options, xmlDictPtr dict, int nthreads )
+{
+    struct _xpc_ReadJob read;
+    xpc_ParallelJob job;
+    int i;
+
+    for ( i = 0; i < count; i++ )
+        docs[i] = NULL;
+
+    read.URIs    = URIs;
+    read.docs    = docs;
+    read.options = options | XML_PARSE_NOERROR | XML_PARSE_NOWARNING;
+    read.dict    = dict;
+
+    job.count  = count;
+    job.run    = xpc_domReadOne;
+    job.finish = xpc_domReadDone;
+    job.data   = &read;
+
+    xpc_domRunParallel( &job, nthreads );
+}
+
 /**
  * Most of the code is stolen from testXPath. 
  * The almost only thing I added, is the storeing of the data, so
  * we can access the data easily - or say more easiely than through
  * libxml2.
+ *
+ * if the context node belongs to a fragment, the fragment's root is
+ * hung below a shadow document for the time of the query. the shadow
+ * is kept in *shadow and reused by later queries; it is only linked
+ * to the root node and the root node to it, so that attaching and
+ * detaching a fragment does not depend on its size. shadow may be
+ * NULL, in which case a temporary document is used.
  **/
 
 xmlXPathObjectPtr
-xpc_domXPathFind( xmlXPathContextPtr ctxt, xmlChar * path ) {
+xpc_domXPathFind( xmlXPathContextPtr ctxt, xmlChar * path, xmlDocPtr * shadow ) {
     xmlXPathObjectPtr res = NULL;
   
     if ( ctxt->node != NULL && path != NULL ) {
         xmlXPathCompExprPtr comp;
 
-        xmlDocPtr tdoc = NULL;
-        xmlNodePtr froot = ctxt->node;
-
-        comp = xmlXPathCompile( path );
+        /* compiling against the context's dictionary lets name tests
+           compare interned names by pointer */
+        comp = xmlXPathCtxtCompile( ctxt, path );
         if ( comp == NULL ) {
             return NULL;
         }
-        
+        res = xpc_domXPathFindCompiled( ctxt, comp, shadow );
+        xmlXPathFreeCompExpr(comp);
+    }
+    return res;
+}
+
+void
+xpc_domXPathUnshadow( xmlDocPtr doc, xmlDocPtr * shadow )
+{
+    if ( doc->children != NULL )
+        doc->children->parent = NULL;
+    doc->children = NULL;
+    doc->last     = NULL;
+
+    if ( shadow == NULL || doc != *shadow ) {
+        xmlFreeDoc( doc );
+    }
+}
+
+/**
+ * the same for an expression compiled already, which is left alone.
+ * if the evaluation croaks, the caller has to unlink a fragment with
+ * xpc_domXPathUnshadow().
+ **/
+xmlXPathObjectPtr
+xpc_domXPathFindCompiled( xmlXPathContextPtr ctxt, xmlXPathCompExprPtr comp,
+                          xmlDocPtr * shadow ) {
+    xmlXPathObjectPtr res = NULL;
+  
+    if ( ctxt->node != NULL && comp != NULL ) {
+        xmlDocPtr tdoc = NULL;
+        xmlDocPtr sdoc = NULL;
+        xmlNodePtr froot = ctxt->node;
+
         if ( ctxt->node->doc == NULL ) {
             /* if one XPaths a node from a fragment, libxml2 will
                refuse the lookup. this is not very usefull for XML
                scripters. thus we need to create a temporary document
                to make libxml2 do it's job correctly.
              */
-            tdoc = xmlNewDoc( NULL );
 
             /* find refnode's root node */
-            while ( froot != NULL ) {
-                if ( froot->parent == NULL ) {
-                    break;
-                }
+            while ( froot->parent != NULL ) {
                 froot = froot->parent;
             }
-            xmlAddChild((xmlNodePtr)tdoc, froot);
 
-            ctxt->node->doc = tdoc;
+            if ( froot->type == XML_DOCUMENT_NODE ) {
+                /* linked already by a query this one is nested in */
+                sdoc = (xmlDocPtr) froot;
+            }
+            else {
+                if ( shadow != NULL && *shadow == NULL ) {
+                    *shadow = xmlNewDoc( NULL );
+                }
+                if ( shadow != NULL && *shadow != NULL
+                     && (*shadow)->children == NULL ) {
+                    tdoc = *shadow;
+                }
+                else {
+                    /* no shadow, or it is in use by an outer query */
+                    tdoc = xmlNewDoc( NULL );
+                }
+                if ( tdoc != NULL ) {
+                    tdoc->children = froot;
+                    tdoc->last     = froot;
+                    froot->parent  = (xmlNodePtr) tdoc;
+                }
+                sdoc = tdoc;
+            }
+            /* the ancestor axes stop at the context document */
+            ctxt->doc = sdoc;
         }
        
         res = xmlXPathCompiledEval(comp, ctxt);
 
-        xmlXPathFreeCompExpr(comp);
+        if ( sdoc != NULL ) {
+            /* the shadow document must not be handed out */
+            if ( res != NULL && res->type == XPATH_NODESET
+                 && res->nodesetval != NULL ) {
+                xmlXPathNodeSetDel( res->nodesetval, (xmlNodePtr) sdoc );
+            }
+            ctxt->doc = NULL;
+        }
 
         if ( tdoc != NULL ) {
             /* after looking through a fragment, we need to drop the
                fake document again */
-	    xmlSetTreeDoc(froot,NULL);
-            froot->doc = NULL;
-            tdoc->children = NULL;
-            tdoc->last     = NULL;
-            froot->parent  = NULL;
-            ctxt->node->doc = NULL;
-
-            xmlFreeDoc( tdoc );
+            xpc_domXPathUnshadow( tdoc, shadow );
         }
     }
     return res;
 }
 
 xmlNodeSetPtr
-xpc_domXPathSelect( xmlXPathContextPtr ctxt, xmlChar * path ) {
+xpc_domXPathSelect( xmlXPathContextPtr ctxt, xmlChar * path, xmlDocPtr * shadow ) {
     xmlNodeSetPtr rv = NULL;
     xmlXPathObjectPtr res = NULL;
   
-    res = xpc_domXPathFind( ctxt, path );
+    res = xpc_domXPathFind( ctxt, path, shadow );
     
     if (res != NULL) {
             /* here we have to transfer the result from the internal
@@ -199,3 +606,1941 @@ xpc_domXPathSelect( xmlXPathContextPtr ctxt, xmlChar * path ) {
 
     return rv;
 }
+
+/* the operations libxml2 compiled an expression to, one per line as
+ * written by xmlXPathDebugDumpCompExpr() and indented by their depth.
+ * NULL if libxml2 was built without debugging support. */
+xmlChar *
+xpc_domXPathDump( xmlXPathCompExprPtr comp )
+{
+#ifdef LIBXML_DEBUG_ENABLED
+    xmlChar * dump = NULL;
+    FILE * out;
+    long size;
+
+    out = tmpfile();
+    if ( out == NULL )
+        return NULL;
+    xmlXPathDebugDumpCompExpr( out, comp, 0 );
+    size = ftell( out );
+    if ( size >= 0 )
+        dump = (xmlChar *)xmlMalloc( size + 1 );
+    if ( dump != NULL ) {
+        rewind( out );
+        size = (long)fread( dump, 1, size, out );
+        dump[size] = 0;
+    }
+    fclose( out );
+    return dump;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * evaluates expr once for every node of nodes, using up to nthreads
+ * threads. every thread compiles expr for a context of its own, which
+ * has the namespaces registered with proto, proto's context size and
+ * position and the in-scope namespaces of the node it evaluates for;
+ * proto itself is only read. results[i] is NULL if the evaluation for
+ * nodes[i] failed. the nodes must belong to documents, which must not
+ * change while this runs.
+ **/
+struct _xpc_EvalJob {
+    xmlXPathContextPtr proto;
+    const xmlChar * expr;
+    xmlNodePtr * nodes;
+    xmlXPathObjectPtr * results;
+};
+
+static void
+xpc_domCopyNs( void * payload, void * data, const xmlChar * name )
+{
+    xmlXPathRegisterNs( (xmlXPathContextPtr)data, name,
+                        (const xmlChar *)payload );
+}
+
+static void
+xpc_domIgnoreError( void * data, const xmlError * error )
+{
+    /* the caller evaluates a failed expression again to report it */
+}
+
+/* what a thread evaluating an expression works with: a context and the
+ * expression compiled for it alone, as libxml2 caches things such as
+ * the functions called in the compiled operations when first evaluated */
+typedef struct _xpc_XPathWorker {
+    xmlXPathContextPtr ctxt;
+    xmlXPathCompExprPtr comp;
+} xpc_XPathWorker;
+
+static xpc_XPathWorker *
+xpc_domNewWorker( xmlXPathContextPtr proto, const xmlChar * expr )
+{
+    xpc_XPathWorker * worker;
+
+    worker = (xpc_XPathWorker *) xmlMalloc( sizeof(xpc_XPathWorker) );
+    if ( worker == NULL )
+        return NULL;
+    worker->comp = NULL;
+    worker->ctxt = xmlXPathNewContext( NULL );
+    if ( worker->ctxt == NULL ) {
+        xmlFree( worker );
+        return NULL;
+    }
+    if ( proto->nsHash != NULL )
+        xmlHashScan( proto->nsHash, xpc_domCopyNs, worker->ctxt );
+    worker->ctxt->error = (xmlStructuredErrorFunc)xpc_domIgnoreError;
+    worker->comp = xmlXPathCtxtCompile( worker->ctxt, expr );
+    return worker;
+}
+
+static void
+xpc_domFreeWorker( xpc_XPathWorker * worker )
+{
+    xmlXPathFreeCompExpr( worker->comp );
+    xmlXPathFreeContext( worker->ctxt );
+    xmlFree( worker );
+}
+
+static void
+xpc_domEvalOne( xpc_ParallelJob * job, int index, void ** state )
+{
+    struct _xpc_EvalJob * eval = (struct _xpc_EvalJob *)job->data;
+    xpc_XPathWorker * worker = (xpc_XPathWorker *)*state;
+    xmlXPathContextPtr ctxt;
+    xmlNodePtr node = eval->nodes[index];
+
+    if ( worker == NULL ) {
+        worker = xpc_domNewWorker( eval->proto, eval->expr );
+        if ( worker == NULL )
+            return;
+        worker->ctxt->contextSize       = eval->proto->contextSize;
+        worker->ctxt->proximityPosition = eval->proto->proximityPosition;
+        *state = worker;
+    }
+    if ( worker->comp == NULL )
+        return;
+    ctxt = worker->ctxt;
+
+    ctxt->node = node;
+    ctxt->doc  = node->doc;
+    if ( node->type == XML_DOCUMENT_NODE ) {
+        ctxt->namespaces = xmlGetNsList( node->doc,
+                                         xmlDocGetRootElement( node->doc ) );
+    } else {
+        ctxt->namespaces = xmlGetNsList( node->doc, node );
+    }
+    ctxt->nsNr = 0;
+    if ( ctxt->namespaces != NULL ) {
+        while ( ctxt->namespaces[ctxt->nsNr] != NULL )
+            ctxt->nsNr++;
+    }
+
+    eval->results[index] = xmlXPathCompiledEval( worker->comp, ctxt );
+
+    if ( ctxt->namespaces != NULL )
+        xmlFree( ctxt->namespaces );
+    ctxt->namespaces = NULL;
+    ctxt->nsNr = 0;
+}
+
+static void
+xpc_domEvalDone( xpc_ParallelJob * job, void * state )
+{
+    if ( state != NULL )
+        xpc_domFreeWorker( (xpc_XPathWorker *)state );
+}
+
+void
+xpc_domXPathEvalMany( xmlXPathContextPtr proto, const xmlChar * expr,
+                      xmlNodePtr * nodes, xmlXPathObjectPtr * results,
+                      int count, int nthreads )
+{
+    struct _xpc_EvalJob eval;
+    xpc_ParallelJob job;
+    int i;
+
+    for ( i = 0; i < count; i++ )
+        results[i] = NULL;
+
+    eval.proto   = proto;
+    eval.expr    = expr;
+    eval.nodes   = nodes;
+    eval.results = results;
+
+    job.count  = count;
+    job.run    = xpc_domEvalOne;
+    job.finish = xpc_domEvalDone;
+    job.data   = &eval;
+
+    xpc_domRunParallel( &job, nthreads );
+}
+
+/**
+ * evaluates an expression of the form //name[pred]... on several
+ * threads, by splitting the document below the context node's document
+ * into subtrees. it only takes expressions where this gives the same
+ * result as a single evaluation: the first step must be a name test
+ * whose predicates do not depend on the position, and neither
+ * variables nor functions other than XPath's own may be used. for
+ * those *handled is set; otherwise nothing is done and the caller has
+ * to evaluate the expression itself.
+ *
+ * with the first step's predicates not depending on the position,
+ * //name[pred]/rest selects the same as the union of
+ * descendant-or-self::name[pred]/rest over any set of subtrees which
+ * covers the document, plus self::name[pred]/rest for the nodes above
+ * these subtrees.
+ **/
+#define XPC_SCAN_CHUNKS     8   /* chunks per thread */
+#define XPC_SCAN_PARTITIONS 32  /* subtrees per thread */
+#define XPC_SCAN_DEPTH      16  /* levels searched for enough subtrees */
+
+static const char * xpc_domCoreFunctions[] = {
+    "last", "position", "count", "id", "local-name", "namespace-uri",
+    "name", "string", "concat", "starts-with", "contains",
+    "substring-before", "substring-after", "substring", "string-length",
+    "normalize-space", "translate", "boolean", "not", "true", "false",
+    "lang", "number", "sum", "floor", "ceiling", "round",
+    "node", "text", "comment", "processing-instruction", NULL
+};
+
+static int
+xpc_domIsNameChar( xmlChar c )
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+        || (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.'
+        || c >= 0x80;
+}
+
+/* skips a string literal or a bracketed part, returns NULL if it
+   does not end */
+static const xmlChar *
+xpc_domSkipGroup( const xmlChar * cur )
+{
+    xmlChar open = *cur, close;
+    int depth = 0;
+
+    if ( open == '"' || open == '\'' ) {
+        cur = xmlStrchr( cur + 1, open );
+        return cur != NULL ? cur + 1 : NULL;
+    }
+    close = open == '[' ? ']' : ')';
+    for ( ; *cur != 0; cur++ ) {
+        if ( *cur == '"' || *cur == '\'' ) {
+            cur = xpc_domSkipGroup( cur );
+            if ( cur == NULL )
+                return NULL;
+            cur--;
+        }
+        else if ( *cur == open ) {
+            depth++;
+        }
+        else if ( *cur == close && --depth == 0 ) {
+            return cur + 1;
+        }
+    }
+    return NULL;
+}
+
+/* checks that only XPath's own functions and no variables are used */
+static int
+xpc_domScanSafe( const xmlChar * cur )
+{
+    const xmlChar * name;
+    int i, len;
+
+    while ( *cur != 0 ) {
+        if ( *cur == '"' || *cur == '\'' ) {
+            cur = xpc_domSkipGroup( cur );
+            if ( cur == NULL )
+                return 0;
+            continue;
+        }
+        if ( *cur == '$' )
+            return 0;
+        if ( !xpc_domIsNameChar( *cur ) && *cur != ':' ) {
+            cur++;
+            continue;
+        }
+        name = cur;
+        while ( xpc_domIsNameChar( *cur ) || *cur == ':' )
+            cur++;
+        len = cur - name;
+        while ( xmlIsBlank_ch( *cur ) )
+            cur++;
+        if ( *cur != '(' )
+            continue;
+        for ( i = 0; xpc_domCoreFunctions[i] != NULL; i++ ) {
+            if ( xmlStrlen( (const xmlChar *)xpc_domCoreFunctions[i] ) == len
+                 && xmlStrncmp( name, (const xmlChar *)xpc_domCoreFunctions[i],
+                                len ) == 0 )
+                break;
+        }
+        if ( xpc_domCoreFunctions[i] == NULL )
+            return 0;
+    }
+    return 1;
+}
+
+/* a location path made of name tests only, such as @id or a/b */
+static int
+xpc_domSimplePath( const xmlChar * cur, const xmlChar * end )
+{
+    if ( cur < end && *cur == '/' )
+        cur++;
+    if ( cur < end && *cur == '/' )
+        cur++;
+    while ( cur < end ) {
+        if ( cur[0] == '.' && cur + 1 < end && cur[1] == '.' ) {
+            cur += 2;
+        }
+        else if ( *cur == '.' ) {
+            cur++;
+        }
+        else {
+            if ( *cur == '@' )
+                cur++;
+            if ( cur < end && *cur == '*' ) {
+                cur++;
+            }
+            else {
+                if ( cur >= end || !xpc_domIsNameChar( *cur )
+                     || (*cur >= '0' && *cur <= '9') || *cur == '-'
+                     || *cur == '.' )
+                    return 0;
+                while ( cur < end && xpc_domIsNameChar( *cur ) )
+                    cur++;
+                if ( cur < end && *cur == ':' ) {
+                    cur++;
+                    if ( cur < end && *cur == '*' ) {
+                        cur++;
+                    }
+                    else {
+                        if ( cur >= end || !xpc_domIsNameChar( *cur ) )
+                            return 0;
+                        while ( cur < end && xpc_domIsNameChar( *cur ) )
+                            cur++;
+                    }
+                }
+            }
+        }
+        if ( cur == end )
+            return 1;
+        if ( *cur != '/' )
+            return 0;
+        cur++;
+        if ( cur < end && *cur == '/' )
+            cur++;
+    }
+    return 0;
+}
+
+/* a predicate which is known to be a boolean, i.e. not a position */
+static int
+xpc_domBooleanPredicate( const xmlChar * pred, int len )
+{
+    const xmlChar * cur = pred;
+    const xmlChar * end = pred + len;
+    const xmlChar * found;
+    static const char * booleans[] = { "not(", "boolean(", "contains(",
+                                       "starts-with(", "lang(", "true(",
+                                       "false(", NULL };
+    int i;
+
+    found = xmlStrstr( pred, (const xmlChar *)"position" );
+    if ( found != NULL && found < end )
+        return 0;
+    found = xmlStrstr( pred, (const xmlChar *)"last" );
+    if ( found != NULL && found < end )
+        return 0;
+
+    while ( cur < end && xmlIsBlank_ch( *cur ) )
+        cur++;
+    while ( end > cur && xmlIsBlank_ch( end[-1] ) )
+        end--;
+    pred = cur;
+
+    /* a location path is a nodeset, i.e. true if not empty */
+    if ( xpc_domSimplePath( pred, end ) )
+        return 1;
+
+    /* a comparison or a logical operator outside of any group binds
+       weaker than anything giving a number */
+    while ( cur < end ) {
+        if ( *cur == '"' || *cur == '\'' || *cur == '[' || *cur == '(' ) {
+            cur = xpc_domSkipGroup( cur );
+            if ( cur == NULL || cur > end )
+                return 0;
+            continue;
+        }
+        if ( *cur == '=' || *cur == '<' || *cur == '>' )
+            return 1;
+        if ( xmlIsBlank_ch( *cur ) ) {
+            if ( cur + 4 < end && xmlStrncmp( cur + 1, (const xmlChar *)"and", 3 ) == 0
+                 && !xpc_domIsNameChar( cur[4] ) )
+                return 1;
+            if ( cur + 3 < end && xmlStrncmp( cur + 1, (const xmlChar *)"or", 2 ) == 0
+                 && !xpc_domIsNameChar( cur[3] ) )
+                return 1;
+        }
+        cur++;
+    }
+
+    /* a call of a boolean function making up the whole predicate */
+    for ( i = 0; booleans[i] != NULL; i++ ) {
+        int blen = xmlStrlen( (const xmlChar *)booleans[i] );
+        if ( end - pred > blen
+             && xmlStrncmp( pred, (const xmlChar *)booleans[i], blen ) == 0 ) {
+            return xpc_domSkipGroup( pred + blen - 1 ) == end;
+        }
+    }
+    return 0;
+}
+
+/* splits //step... into step and the rest, NULL if not of that form */
+static const xmlChar *
+xpc_domScanSplit( const xmlChar * path, int * steplen )
+{
+    const xmlChar * cur = path;
+    const xmlChar * pred;
+    const xmlChar * rest;
+
+    while ( xmlIsBlank_ch( *cur ) )
+        cur++;
+    if ( cur[0] != '/' || cur[1] != '/' )
+        return NULL;
+    cur += 2;
+    path = cur;
+
+    /* a name test: name, prefix:name, prefix:* or * */
+    if ( *cur == '*' ) {
+        cur++;
+    }
+    else {
+        if ( !xpc_domIsNameChar( *cur ) || (*cur >= '0' && *cur <= '9')
+             || *cur == '-' || *cur == '.' )
+            return NULL;
+        while ( xpc_domIsNameChar( *cur ) )
+            cur++;
+        if ( *cur == ':' ) {
+            cur++;
+            if ( *cur == '*' ) {
+                cur++;
+            }
+            else {
+                if ( !xpc_domIsNameChar( *cur ) )
+                    return NULL;
+                while ( xpc_domIsNameChar( *cur ) )
+                    cur++;
+            }
+        }
+    }
+    /* node type tests and axes */
+    if ( *cur == '(' || *cur == ':' )
+        return NULL;
+
+    while ( *cur == '[' ) {
+        pred = cur + 1;
+        cur = xpc_domSkipGroup( cur );
+        if ( cur == NULL || !xpc_domBooleanPredicate( pred, cur - pred - 1 ) )
+            return NULL;
+    }
+    *steplen = cur - path;
+
+    /* the rest has to be a relative location path of its own */
+    rest = cur;
+    if ( *rest != 0 && *rest != '/' )
+        return NULL;
+    while ( *cur != 0 ) {
+        if ( *cur == '[' || *cur == '(' || *cur == '"' || *cur == '\'' ) {
+            cur = xpc_domSkipGroup( cur );
+            if ( cur == NULL )
+                return NULL;
+            continue;
+        }
+        if ( *cur == '|' || *cur == '=' || *cur == '!' || *cur == '<'
+             || *cur == '>' || *cur == '+' || *cur == ',' || *cur == ')'
+             || *cur == ']' || xmlIsBlank_ch( *cur ) )
+            return NULL;
+        cur++;
+    }
+    return rest;
+}
+
+/* whether the rest only goes down, so that every subtree's results
+   stay within it */
+static int
+xpc_domScanDownward( const xmlChar * cur )
+{
+    while ( *cur != 0 ) {
+        if ( *cur == '[' || *cur == '"' || *cur == '\'' ) {
+            cur = xpc_domSkipGroup( cur );
+            continue;
+        }
+        if ( (cur[0] == '.' && cur[1] == '.') || (cur[0] == ':' && cur[1] == ':') )
+            return 0;
+        cur++;
+    }
+    return 1;
+}
+
+struct _xpc_ScanJob {
+    xmlXPathContextPtr proto;
+    const xmlChar * expr;
+    xmlNodePtr * parts;
+    int nparts;
+    int nchunks;
+    xmlNodeSetPtr * results;
+};
+
+static void
+xpc_domScanChunk( xpc_ParallelJob * job, int index, void ** state )
+{
+    struct _xpc_ScanJob * scan = (struct _xpc_ScanJob *)job->data;
+    xpc_XPathWorker * worker = (xpc_XPathWorker *)*state;
+    xmlXPathContextPtr ctxt;
+    xmlXPathObjectPtr res;
+    xmlNodeSetPtr set;
+    int first = (int)((long)scan->nparts * index / scan->nchunks);
+    int last  = (int)((long)scan->nparts * (index + 1) / scan->nchunks);
+    int i, j;
+
+    if ( worker == NULL ) {
+        worker = xpc_domNewWorker( scan->proto, scan->expr );
+        if ( worker == NULL )
+            return;
+        /* the in-scope namespaces of the context node are only read */
+        worker->ctxt->namespaces = scan->proto->namespaces;
+        worker->ctxt->nsNr       = scan->proto->nsNr;
+        worker->ctxt->doc        = scan->proto->doc;
+        *state = worker;
+    }
+    if ( worker->comp == NULL )
+        return;
+    ctxt = worker->ctxt;
+
+    set = xmlXPathNodeSetCreate( NULL );
+    if ( set == NULL )
+        return;
+    for ( i = first; i < last; i++ ) {
+        ctxt->node = scan->parts[i];
+        res = xmlXPathCompiledEval( worker->comp, ctxt );
+        if ( res == NULL || res->type != XPATH_NODESET ) {
+            xmlXPathFreeObject( res );
+            xmlXPathFreeNodeSet( set );
+            return;
+        }
+        if ( res->nodesetval != NULL ) {
+            for ( j = 0; j < res->nodesetval->nodeNr; j++ )
+                xmlXPathNodeSetAddUnique( set, res->nodesetval->nodeTab[j] );
+        }
+        xmlXPathFreeObject( res );
+    }
+    scan->results[index] = set;
+}
+
+static void
+xpc_domScanDone( xpc_ParallelJob * job, void * state )
+{
+    xpc_XPathWorker * worker = (xpc_XPathWorker *)state;
+
+    if ( worker != NULL ) {
+        worker->ctxt->namespaces = NULL;
+        xpc_domFreeWorker( worker );
+    }
+}
+
+/* picks subtrees to evaluate in parallel and the nodes above them */
+static int
+xpc_domScanPartition( xmlDocPtr doc, int want, xmlNodePtr ** parts,
+                      int * nparts, xmlNodeSetPtr above )
+{
+    xmlNodePtr * cur = NULL;
+    xmlNodePtr * next;
+    xmlNodePtr child;
+    int ncur = 0, nnext, size, depth, expanded, i;
+
+    xmlXPathNodeSetAddUnique( above, (xmlNodePtr) doc );
+    cur = (xmlNodePtr *)xmlMalloc( sizeof(xmlNodePtr) );
+    if ( cur == NULL )
+        return -1;
+    for ( child = doc->children; child != NULL; child = child->next ) {
+        if ( child->type == XML_ELEMENT_NODE ) {
+            cur[ncur++] = child;
+            break;
+        }
+    }
+
+    for ( depth = 0; depth < XPC_SCAN_DEPTH && ncur < want; depth++ ) {
+        size = 0;
+        for ( i = 0; i < ncur; i++ ) {
+            int n = 0;
+            for ( child = cur[i]->children; child != NULL; child = child->next )
+                if ( child->type == XML_ELEMENT_NODE )
+                    n++;
+            size += n > 0 ? n : 1;
+        }
+        next = (xmlNodePtr *)xmlMalloc( sizeof(xmlNodePtr) * (size + 1) );
+        if ( next == NULL ) {
+            xmlFree( cur );
+            return -1;
+        }
+        nnext = 0;
+        expanded = 0;
+        for ( i = 0; i < ncur; i++ ) {
+            int n = 0;
+            for ( child = cur[i]->children; child != NULL; child = child->next ) {
+                if ( child->type == XML_ELEMENT_NODE ) {
+                    next[nnext++] = child;
+                    n++;
+                }
+            }
+            if ( n > 0 ) {
+                xmlXPathNodeSetAddUnique( above, cur[i] );
+                expanded = 1;
+            }
+            else {
+                next[nnext++] = cur[i];
+            }
+        }
+        xmlFree( cur );
+        cur  = next;
+        ncur = nnext;
+        if ( !expanded )
+            break;
+    }
+    *parts  = cur;
+    *nparts = ncur;
+    return 0;
+}
+
+#define XPC_RADIX_MIN  1024 /* nodes below which comparing is as fast */
+#define XPC_RADIX_BITS 11
+
+/* the document order number xpc_domNodeNormalizeOrder() gave an element,
+   kept in its content as xmlXPathOrderDocElems() does */
+#define XPC_NODE_ORDER(node) ( -(ptrdiff_t) (node)->content )
+
+/* the top of the tree node is in, the root element for a document */
+static xmlNodePtr
+xpc_domNodeOrderTop( xmlNodePtr node )
+{
+    while ( node->parent != NULL )
+        node = node->parent;
+    if ( node->type == XML_DOCUMENT_NODE || node->type == XML_HTML_DOCUMENT_NODE )
+        node = xmlDocGetRootElement( (xmlDocPtr) node );
+    return node;
+}
+
+/* the next node of the tree below top after cur which is walked for
+ * numbering, i.e. not going into anything but elements */
+static xmlNodePtr
+xpc_domNodeOrderNext( xmlNodePtr top, xmlNodePtr cur )
+{
+    if ( cur->children != NULL
+         && (cur->type == XML_ELEMENT_NODE || cur == top) )
+        return cur->children;
+    while ( cur != top && cur->next == NULL )
+        cur = cur->parent;
+    if ( cur == top )
+        return NULL;
+    return cur->next;
+}
+
+int
+xpc_domNodeNormalizeOrder( xmlNodePtr node, xpc_DocIndex ** indexes )
+{
+    xmlNodePtr cur;
+    xmlDocPtr doc = NULL;
+    ptrdiff_t ordinal = 0;
+    unsigned long signature = 0;
+    int sign;
+
+    if ( node == NULL )
+        return 0;
+    if ( indexes != NULL && node->type != XML_NAMESPACE_DECL )
+        doc = node->doc;
+    node = xpc_domNodeOrderTop( node );
+    if ( node == NULL )
+        return 0;
+    if ( node->type != XML_ELEMENT_NODE
+         && node->type != XML_DOCUMENT_FRAG_NODE ) {
+        xpc_domNodeNormalize( node );
+        return 0;
+    }
+    /* the document's indexes are checked in this walk if it is the
+       document's tree, and with one of their own otherwise */
+    sign = doc != NULL && xpc_domIndexHas( *indexes, doc )
+           && node->parent == (xmlNodePtr) doc;
+    if ( doc != NULL && !sign )
+        xpc_domIndexRevalidate( indexes, doc );
+
+    for ( cur = node; cur != NULL;
+          cur = xpc_domNodeOrderNext( node, cur ) ) {
+        if ( cur->type == XML_ELEMENT_NODE ) {
+            ordinal++;
+            cur->content = (xmlChar *) -ordinal;
+            if ( sign )
+                signature = xpc_domIndexSign( signature, cur );
+            xpc_domNodeNormalizeList( (xmlNodePtr) cur->properties );
+        }
+        else if ( cur->type == XML_TEXT_NODE ) {
+            xpc_domNodeNormalize( cur );
+        }
+    }
+    if ( sign )
+        xpc_domIndexCheck( indexes, doc, (int) ordinal, signature );
+    return (int) ordinal;
+}
+
+void
+xpc_domNodeClearOrder( xmlNodePtr node )
+{
+    xmlNodePtr cur;
+
+    if ( node == NULL )
+        return;
+    node = xpc_domNodeOrderTop( node );
+    if ( node == NULL || (node->type != XML_ELEMENT_NODE
+                          && node->type != XML_DOCUMENT_FRAG_NODE) )
+        return;
+    for ( cur = node; cur != NULL;
+          cur = xpc_domNodeOrderNext( node, cur ) ) {
+        if ( cur->type == XML_ELEMENT_NODE && XPC_NODE_ORDER( cur ) > 0 )
+            cur->content = NULL;
+    }
+}
+
+/* sorts the nodes of set by their document order numbers, a radix sort
+   of XPC_RADIX_BITS a pass; returns 0 without sorting if one of them is
+   not a numbered element of the same document */
+static int
+xpc_domNodeSetRadixSort( xmlNodeSetPtr set )
+{
+    xmlNodePtr * tmp, * from, * to, * swap;
+    ptrdiff_t max = 0, order;
+    int * count;
+    int buckets = 1 << XPC_RADIX_BITS;
+    int shift, i, sum, c;
+
+    for ( i = 0; i < set->nodeNr; i++ ) {
+        if ( set->nodeTab[i]->type != XML_ELEMENT_NODE
+             || set->nodeTab[i]->doc != set->nodeTab[0]->doc )
+            return 0;
+        order = XPC_NODE_ORDER( set->nodeTab[i] );
+        if ( order <= 0 )
+            return 0;
+        if ( order > max )
+            max = order;
+    }
+
+    tmp   = (xmlNodePtr *) xmlMalloc( set->nodeNr * sizeof(xmlNodePtr) );
+    count = (int *) xmlMalloc( buckets * sizeof(int) );
+    if ( tmp == NULL || count == NULL ) {
+        xmlFree( tmp );
+        xmlFree( count );
+        return 0;
+    }
+
+    from = set->nodeTab;
+    to   = tmp;
+    for ( shift = 0; shift == 0 || (max >> shift) > 0; shift += XPC_RADIX_BITS ) {
+        memset( count, 0, buckets * sizeof(int) );
+        for ( i = 0; i < set->nodeNr; i++ )
+            count[ (XPC_NODE_ORDER( from[i] ) >> shift) & (buckets - 1) ]++;
+        for ( i = 0, sum = 0; i < buckets; i++ ) {
+            c = count[i];
+            count[i] = sum;
+            sum += c;
+        }
+        for ( i = 0; i < set->nodeNr; i++ )
+            to[ count[ (XPC_NODE_ORDER( from[i] ) >> shift) & (buckets - 1) ]++ ] = from[i];
+        swap = from;
+        from = to;
+        to   = swap;
+    }
+    if ( from != set->nodeTab )
+        memcpy( set->nodeTab, from, set->nodeNr * sizeof(xmlNodePtr) );
+
+    xmlFree( tmp );
+    xmlFree( count );
+    return 1;
+}
+
+/* sorts a nodeset in document order, by the numbers of its elements if
+   it is large enough */
+static void
+xpc_domNodeSetSort( xmlNodeSetPtr set )
+{
+    if ( set == NULL || set->nodeNr < 2 )
+        return;
+    if ( set->nodeNr < XPC_RADIX_MIN || !xpc_domNodeSetRadixSort( set ) )
+        xmlXPathNodeSetSort( set );
+}
+
+/* sorts a nodeset made of several in document order and removes the
+   nodes found more than once */
+static void
+xpc_domNodeSetSortUnique( xmlNodeSetPtr set )
+{
+    int i, j;
+
+    if ( set == NULL || set->nodeNr < 2 )
+        return;
+    xpc_domNodeSetSort( set );
+    for ( i = 1, j = 1; i < set->nodeNr; i++ ) {
+        if ( set->nodeTab[i] != set->nodeTab[j - 1] )
+            set->nodeTab[j++] = set->nodeTab[i];
+    }
+    set->nodeNr = j;
+}
+
+xmlXPathObjectPtr
+xpc_domXPathScanParallel( xmlXPathContextPtr ctxt, const xmlChar * path,
+                          int nthreads, int * handled )
+{
+    const xmlChar * rest;
+    xmlChar * expr = NULL, * exprBelow = NULL;
+    xmlXPathCompExprPtr comp = NULL, compAbove = NULL;
+    xmlNodeSetPtr above = NULL, total = NULL;
+    xmlNodeSetPtr * results = NULL;
+    xmlNodePtr * parts = NULL;
+    xmlNodePtr oldnode = ctxt->node;
+    struct _xpc_ScanJob scan;
+    xpc_ParallelJob job;
+    xmlXPathObjectPtr res = NULL;
+    xmlStructuredErrorFunc olderror = ctxt->error;
+    int steplen, nparts = 0, nchunks = 0, i, j, sorted;
+
+    *handled = 0;
+    if ( ctxt->node == NULL || ctxt->node->doc == NULL || nthreads < 2 )
+        return NULL;
+    if ( !xpc_domScanSafe( path ) )
+        return NULL;
+    rest = xpc_domScanSplit( path, &steplen );
+    if ( rest == NULL )
+        return NULL;
+
+    /* if anything goes wrong, the caller evaluates the expression
+       again and reports it */
+    ctxt->error = (xmlStructuredErrorFunc)xpc_domIgnoreError;
+
+    /* descendant-or-self::step rest for the subtrees, self::step rest
+       for the nodes above them. every thread compiles the former for
+       itself, this one only checks that it compiles */
+    exprBelow = xmlStrdup( (const xmlChar *)"descendant-or-self::" );
+    exprBelow = xmlStrncat( exprBelow, rest - steplen, steplen );
+    exprBelow = xmlStrcat( exprBelow, rest );
+    comp = exprBelow != NULL ? xmlXPathCtxtCompile( ctxt, exprBelow ) : NULL;
+    expr = xmlStrdup( (const xmlChar *)"self::" );
+    expr = xmlStrncat( expr, rest - steplen, steplen );
+    expr = xmlStrcat( expr, rest );
+    compAbove = expr != NULL ? xmlXPathCtxtCompile( ctxt, expr ) : NULL;
+    xmlFree( expr );
+    if ( comp == NULL || compAbove == NULL )
+        goto done;
+
+    above = xmlXPathNodeSetCreate( NULL );
+    total = xmlXPathNodeSetCreate( NULL );
+    if ( above == NULL || total == NULL
+         || xpc_domScanPartition( ctxt->node->doc,
+                                  nthreads * XPC_SCAN_PARTITIONS,
+                                  &parts, &nparts, above ) != 0 )
+        goto done;
+
+    /* the nodes above the subtrees */
+    for ( i = 0; i < above->nodeNr; i++ ) {
+        ctxt->node = above->nodeTab[i];
+        res = xmlXPathCompiledEval( compAbove, ctxt );
+        if ( res == NULL || res->type != XPATH_NODESET ) {
+            xmlXPathFreeObject( res );
+            goto done;
+        }
+        if ( res->nodesetval != NULL ) {
+            for ( j = 0; j < res->nodesetval->nodeNr; j++ )
+                xmlXPathNodeSetAddUnique( total, res->nodesetval->nodeTab[j] );
+        }
+        xmlXPathFreeObject( res );
+    }
+    ctxt->node = oldnode;
+    /* the subtrees' results are in document order if they stay within
+       them and nothing was found above */
+    sorted = total->nodeNr == 0 && xpc_domScanDownward( rest );
+
+    if ( nparts > 0 ) {
+        nchunks = nthreads * XPC_SCAN_CHUNKS;
+        if ( nchunks > nparts )
+            nchunks = nparts;
+        results = (xmlNodeSetPtr *)xmlMalloc( sizeof(xmlNodeSetPtr) * nchunks );
+        if ( results == NULL )
+            goto done;
+        for ( i = 0; i < nchunks; i++ )
+            results[i] = NULL;
+
+        scan.proto   = ctxt;
+        scan.expr    = exprBelow;
+        scan.parts   = parts;
+        scan.nparts  = nparts;
+        scan.nchunks = nchunks;
+        scan.results = results;
+
+        job.count  = nchunks;
+        job.run    = xpc_domScanChunk;
+        job.finish = xpc_domScanDone;
+        job.data   = &scan;
+
+        xpc_domRunParallel( &job, nthreads );
+
+        for ( i = 0; i < nchunks; i++ ) {
+            if ( results[i] == NULL )
+                goto done;
+        }
+        for ( i = 0; i < nchunks; i++ ) {
+            for ( j = 0; j < results[i]->nodeNr; j++ )
+                xmlXPathNodeSetAddUnique( total, results[i]->nodeTab[j] );
+        }
+    }
+
+    if ( !sorted )
+        xpc_domNodeSetSortUnique( total );
+
+    *handled = 1;
+    res = xmlXPathWrapNodeSet( total );
+    total = NULL;
+
+done:
+    ctxt->node  = oldnode;
+    ctxt->error = olderror;
+    if ( !*handled )
+        res = NULL;
+    if ( results != NULL ) {
+        for ( i = 0; i < nchunks; i++ )
+            xmlXPathFreeNodeSet( results[i] );
+        xmlFree( results );
+    }
+    if ( parts != NULL )
+        xmlFree( parts );
+    xmlXPathFreeNodeSet( above );
+    xmlXPathFreeNodeSet( total );
+    xmlXPathFreeCompExpr( comp );
+    xmlXPathFreeCompExpr( compAbove );
+    xmlFree( exprBelow );
+    return res;
+}
+
+/* the QName at cur, returning where it ends or NULL */
+static const xmlChar *
+xpc_domSkipQName( const xmlChar * cur )
+{
+    int part;
+
+    for ( part = 0; part < 2; part++ ) {
+        if ( !xpc_domIsNameChar( *cur ) || (*cur >= '0' && *cur <= '9')
+             || *cur == '-' || *cur == '.' )
+            return NULL;
+        while ( xpc_domIsNameChar( *cur ) )
+            cur++;
+        if ( *cur != ':' || cur[1] == ':' )
+            break;
+        cur++;
+    }
+    return cur;
+}
+
+/* a predicate [@attr = 'literal'] or ['literal' = @attr] at pred; sets
+   the attribute's QName and the literal and returns where the
+   predicate ends, NULL if it is of another form */
+static const xmlChar *
+xpc_domAttrEquality( const xmlChar * pred, const xmlChar ** attr, int * attrlen,
+                     const xmlChar ** literal, int * literallen )
+{
+    const xmlChar * cur = pred + 1;
+    const xmlChar * end;
+    int side;
+
+    *attr    = NULL;
+    *literal = NULL;
+    for ( side = 0; side < 2; side++ ) {
+        while ( xmlIsBlank_ch( *cur ) )
+            cur++;
+        if ( *cur == '@' && *attr == NULL ) {
+            end = xpc_domSkipQName( cur + 1 );
+            if ( end == NULL )
+                return NULL;
+            *attr    = cur + 1;
+            *attrlen = end - cur - 1;
+        }
+        else if ( (*cur == '"' || *cur == '\'') && *literal == NULL ) {
+            end = xmlStrchr( cur + 1, *cur );
+            if ( end == NULL )
+                return NULL;
+            *literal    = cur + 1;
+            *literallen = end - cur - 1;
+            end++;
+        }
+        else {
+            return NULL;
+        }
+        cur = end;
+        while ( xmlIsBlank_ch( *cur ) )
+            cur++;
+        if ( side == 0 ) {
+            if ( *cur != '=' )
+                return NULL;
+            cur++;
+        }
+    }
+    return *cur == ']' ? cur + 1 : NULL;
+}
+
+/* a number literal, possibly negated, returning where it ends or NULL */
+static const xmlChar *
+xpc_domSkipNumber( const xmlChar * cur, double * value )
+{
+    const xmlChar * start = cur;
+    xmlChar * str;
+    int digits = 0;
+
+    if ( *cur == '-' )
+        cur++;
+    while ( *cur >= '0' && *cur <= '9' ) {
+        cur++;
+        digits++;
+    }
+    if ( *cur == '.' ) {
+        cur++;
+        while ( *cur >= '0' && *cur <= '9' ) {
+            cur++;
+            digits++;
+        }
+    }
+    if ( digits == 0 || xpc_domIsNameChar( *cur ) )
+        return NULL;
+    str = xmlStrndup( start, cur - start );
+    *value = xmlXPathStringEvalNumber( str );
+    xmlFree( str );
+    return cur;
+}
+
+/* a predicate comparing an attribute with numbers, such as
+   [@a > 1 and @a <= 5] or [1 < @a]; sets the attribute's QName and the
+   range and returns where the predicate ends, NULL if it is of another
+   form */
+static const xmlChar *
+xpc_domAttrRange( const xmlChar * pred, const xmlChar ** attr, int * attrlen,
+                  double * low, int * lowIncluded,
+                  double * high, int * highIncluded )
+{
+    const xmlChar * cur = pred + 1;
+    const xmlChar * name, * end;
+    double number;
+    int cmp, op, namelen, flip;
+
+    *attr = NULL;
+    *low  = xmlXPathNINF;
+    *high = xmlXPathPINF;
+    *lowIncluded = *highIncluded = 0;
+    for ( cmp = 0; cmp < 2; cmp++ ) {
+        name = NULL;
+        flip = 0;
+        while ( xmlIsBlank_ch( *cur ) )
+            cur++;
+        if ( *cur == '@' ) {
+            name = cur + 1;
+            cur = xpc_domSkipQName( name );
+        }
+        else {
+            cur = xpc_domSkipNumber( cur, &number );
+            flip = 1;
+        }
+        if ( cur == NULL )
+            return NULL;
+        if ( name != NULL )
+            namelen = cur - name;
+        while ( xmlIsBlank_ch( *cur ) )
+            cur++;
+
+        /* <, <=, >, >= or = as 'l', 'L', 'g', 'G' and 'e' */
+        if ( *cur == '<' || *cur == '>' ) {
+            op = *cur == '<' ? 'l' : 'g';
+            if ( cur[1] == '=' ) {
+                op = op == 'l' ? 'L' : 'G';
+                cur++;
+            }
+        }
+        else if ( *cur == '=' ) {
+            op = 'e';
+        }
+        else {
+            return NULL;
+        }
+        cur++;
+        while ( xmlIsBlank_ch( *cur ) )
+            cur++;
+        if ( flip ) {
+            if ( *cur != '@' )
+                return NULL;
+            name = cur + 1;
+            cur = xpc_domSkipQName( name );
+            if ( cur == NULL )
+                return NULL;
+            namelen = cur - name;
+            /* 1 < @a is @a > 1 */
+            switch ( op ) {
+                case 'l': op = 'g'; break;
+                case 'L': op = 'G'; break;
+                case 'g': op = 'l'; break;
+                case 'G': op = 'L'; break;
+            }
+        }
+        else {
+            cur = xpc_domSkipNumber( cur, &number );
+            if ( cur == NULL )
+                return NULL;
+        }
+        if ( *attr != NULL
+             && ( namelen != *attrlen || xmlStrncmp( name, *attr, namelen ) != 0 ) )
+            return NULL;
+        *attr    = name;
+        *attrlen = namelen;
+
+        if ( op != 'l' && op != 'L' ) {
+            if ( number > *low ) {
+                *low = number;
+                *lowIncluded = op != 'g';
+            }
+            else if ( number == *low && op == 'g' ) {
+                *lowIncluded = 0;
+            }
+        }
+        if ( op != 'g' && op != 'G' ) {
+            if ( number < *high ) {
+                *high = number;
+                *highIncluded = op != 'l';
+            }
+            else if ( number == *high && op == 'l' ) {
+                *highIncluded = 0;
+            }
+        }
+
+        while ( xmlIsBlank_ch( *cur ) )
+            cur++;
+        if ( cmp == 0 && xmlStrncmp( cur, (const xmlChar *) "and", 3 ) == 0
+             && !xpc_domIsNameChar( cur[3] ) )
+            cur += 3;
+        else
+            break;
+    }
+    end = cur;
+    return *end == ']' ? end + 1 : NULL;
+}
+
+/* resolves the prefix of a QName, setting *href to its namespace or to
+   NULL for none; returns the local name or NULL if the prefix is not
+   bound */
+static xmlChar *
+xpc_domResolveQName( xmlXPathContextPtr ctxt, const xmlChar * qname, int len,
+                     const xmlChar ** href )
+{
+    const xmlChar * colon = xmlStrchr( qname, ':' );
+    xmlChar * prefix;
+
+    *href = NULL;
+    if ( colon == NULL || colon >= qname + len )
+        return xmlStrndup( qname, len );
+    prefix = xmlStrndup( qname, colon - qname );
+    *href = xmlXPathNsLookup( ctxt, prefix );
+    xmlFree( prefix );
+    if ( *href == NULL )
+        return NULL;
+    return xmlStrndup( colon + 1, len - (colon + 1 - qname) );
+}
+
+/**
+ * answers //name[pred]/rest from the indexes of the context document
+ * (see index.c) instead of visiting every node: with names set from
+ * the element name index, and if the first predicate is
+ * [@attr = 'literal'] or compares @attr with numbers, as in
+ * [@attr > 1 and @attr <= 5], and hot tells to from the index of the
+ * values or the numbers of that attribute. the same conditions as for
+ * xpc_domXPathScanParallel() apply to the first step, which has to
+ * name an element, except that variables and functions may be used.
+ * if the expression is of another form, nothing is done and *handled
+ * is left unset.
+ **/
+xmlXPathObjectPtr
+xpc_domXPathFindIndexed( xmlXPathContextPtr ctxt, const xmlChar * path,
+                         xpc_DocIndex ** indexes, int names,
+                         xpc_IndexHotFunc hot, int * handled )
+{
+    xmlXPathCompExprPtr comp = NULL;
+    xmlXPathObjectPtr res = NULL, found;
+    xmlNodeSetPtr nodes = NULL, total = NULL;
+    xmlNodePtr oldnode = ctxt->node;
+    int oldsize = ctxt->contextSize;
+    int oldpos  = ctxt->proximityPosition;
+    const xmlChar * rest, * step, * cur, * preds, * href, * attrHref;
+    const xmlChar * attr, * literal;
+    xmlChar * name, * aname, * qname, * qattr, * value, * expr;
+    xmlStructuredErrorFunc olderror;
+    double low, high;
+    int steplen, attrlen = 0, literallen = 0, lowIncluded, highIncluded, i, j;
+
+    *handled = 0;
+    if ( ctxt->node == NULL || ctxt->node->type == XML_NAMESPACE_DECL
+         || ctxt->node->doc == NULL )
+        return NULL;
+    rest = xpc_domScanSplit( path, &steplen );
+    if ( rest == NULL )
+        return NULL;
+    step = rest - steplen;
+
+    /* the name test, which must not be a wildcard */
+    preds = xpc_domSkipQName( step );
+    if ( preds == NULL || *preds == '*' )
+        return NULL;
+    name = xpc_domResolveQName( ctxt, step, preds - step, &href );
+    if ( name == NULL )
+        return NULL;
+
+    if ( hot != NULL && *preds == '[' ) {
+        int numbers = 0;
+
+        cur = xpc_domAttrEquality( preds, &attr, &attrlen, &literal, &literallen );
+        if ( cur == NULL ) {
+            cur = xpc_domAttrRange( preds, &attr, &attrlen, &low, &lowIncluded,
+                                    &high, &highIncluded );
+            numbers = 1;
+        }
+        if ( cur != NULL ) {
+            qname = xmlStrndup( step, preds - step );
+            qattr = xmlStrndup( attr, attrlen );
+            if ( hot( ctxt, qname, qattr, numbers ) ) {
+                aname = xpc_domResolveQName( ctxt, attr, attrlen, &attrHref );
+                if ( aname != NULL && numbers ) {
+                    nodes = xpc_domIndexRange( indexes, ctxt->node->doc,
+                                               name, href,
+                                               aname, attrHref,
+                                               low, lowIncluded,
+                                               high, highIncluded );
+                }
+                else if ( aname != NULL ) {
+                    value = xmlStrndup( literal, literallen );
+                    nodes = xpc_domIndexAttributes( indexes, ctxt->node->doc,
+                                                    name, href,
+                                                    aname, attrHref, value );
+                    xmlFree( value );
+                }
+                xmlFree( aname );
+                if ( nodes != NULL )
+                    preds = cur;
+            }
+            xmlFree( qname );
+            xmlFree( qattr );
+        }
+    }
+    if ( nodes == NULL && names )
+        nodes = xpc_domIndexElements( indexes, ctxt->node->doc, name, href );
+    xmlFree( name );
+    if ( nodes == NULL )
+        return NULL;
+
+    if ( preds == rest && *rest == 0 ) {
+        *handled = 1;
+        return xmlXPathWrapNodeSet( nodes );
+    }
+
+    /* the other predicates and the rest for every element found */
+    expr = xmlStrdup( (const xmlChar *) "self::" );
+    expr = xmlStrncat( expr, step, xpc_domSkipQName( step ) - step );
+    expr = xmlStrncat( expr, preds, rest - preds );
+    expr = xmlStrcat( expr, rest );
+    olderror = ctxt->error;
+    ctxt->error = (xmlStructuredErrorFunc)xpc_domIgnoreError;
+    comp = xmlXPathCtxtCompile( ctxt, expr );
+    ctxt->error = olderror;
+    xmlFree( expr );
+    if ( comp == NULL )
+        goto done;
+    /* from here on errors are the query's own */
+    *handled = 1;
+
+    total = xmlXPathNodeSetCreate( NULL );
+    if ( total == NULL )
+        goto done;
+    for ( i = 0; i < nodes->nodeNr; i++ ) {
+        ctxt->node = nodes->nodeTab[i];
+        ctxt->contextSize       = 1;
+        ctxt->proximityPosition = 1;
+        found = xmlXPathCompiledEval( comp, ctxt );
+        if ( found == NULL || found->type != XPATH_NODESET ) {
+            xmlXPathFreeObject( found );
+            goto done;
+        }
+        for ( j = 0; found->nodesetval && j < found->nodesetval->nodeNr; j++ )
+            xmlXPathNodeSetAddUnique( total, found->nodesetval->nodeTab[j] );
+        xmlXPathFreeObject( found );
+    }
+    if ( *rest != 0 )
+        xpc_domNodeSetSortUnique( total );
+
+    res = xmlXPathWrapNodeSet( total );
+    total = NULL;
+
+done:
+    ctxt->node = oldnode;
+    ctxt->contextSize       = oldsize;
+    ctxt->proximityPosition = oldpos;
+    xmlXPathFreeNodeSet( nodes );
+    xmlXPathFreeNodeSet( total );
+    xmlXPathFreeCompExpr( comp );
+    return res;
+}
+
+/* ****************************************************************
+ * key()
+ * **************************************************************** */
+
+static void
+xpc_domKeyAdd( xmlHashTablePtr index, const xmlChar * value, xmlNodePtr node )
+{
+    xmlNodeSetPtr set = (xmlNodeSetPtr) xmlHashLookup( index, value );
+
+    if ( set == NULL ) {
+        set = xmlXPathNodeSetCreate( NULL );
+        if ( set == NULL )
+            return;
+        if ( xmlHashAddEntry( index, value, set ) != 0 ) {
+            xmlXPathFreeNodeSet( set );
+            return;
+        }
+    }
+    /* the values of a node are added one after the other, so a node
+       with a value twice is the last one of its set */
+    if ( set->nodeNr == 0 || set->nodeTab[set->nodeNr - 1] != node )
+        xmlXPathNodeSetAddUnique( set, node );
+}
+
+static void
+xpc_domKeyFreeSet( void * payload, const xmlChar * name )
+{
+    xmlXPathFreeNodeSet( (xmlNodeSetPtr) payload );
+}
+
+void
+xpc_domFreeKeyIndex( xmlHashTablePtr index )
+{
+    if ( index != NULL )
+        xmlHashFree( index, xpc_domKeyFreeSet );
+}
+
+/* maps the string values of use, evaluated for each node match selects
+ * from doc, to the nodes they were found for, in document order.
+ * returns NULL if either expression fails. */
+xmlHashTablePtr
+xpc_domBuildKeyIndex( xmlXPathContextPtr ctxt, xmlDocPtr doc,
+                      xmlXPathCompExprPtr match, xmlXPathCompExprPtr use )
+{
+    xmlHashTablePtr index;
+    xmlXPathObjectPtr matched, used;
+    xmlNodeSetPtr nodes;
+    xmlNodePtr oldnode = ctxt->node;
+    xmlDocPtr olddoc   = ctxt->doc;
+    int oldsize = ctxt->contextSize;
+    int oldpos  = ctxt->proximityPosition;
+    xmlChar * value;
+    int i, j;
+
+    index = xmlHashCreate( 64 );
+    if ( index == NULL )
+        return NULL;
+
+    ctxt->doc  = doc;
+    ctxt->node = (xmlNodePtr) doc;
+    ctxt->contextSize       = 1;
+    ctxt->proximityPosition = 1;
+    matched = xmlXPathCompiledEval( match, ctxt );
+    if ( matched == NULL || matched->type != XPATH_NODESET ) {
+        xpc_domFreeKeyIndex( index );
+        index = NULL;
+        goto done;
+    }
+
+    nodes = matched->nodesetval;
+    for ( i = 0; nodes != NULL && i < nodes->nodeNr; i++ ) {
+        xmlNodePtr node = nodes->nodeTab[i];
+
+        if ( node->type == XML_NAMESPACE_DECL )
+            continue;
+        ctxt->node = node;
+        ctxt->contextSize       = nodes->nodeNr;
+        ctxt->proximityPosition = i + 1;
+        used = xmlXPathCompiledEval( use, ctxt );
+        if ( used == NULL ) {
+            xpc_domFreeKeyIndex( index );
+            index = NULL;
+            break;
+        }
+        if ( used->type == XPATH_NODESET ) {
+            for ( j = 0; used->nodesetval && j < used->nodesetval->nodeNr; j++ ) {
+                value = xmlXPathCastNodeToString( used->nodesetval->nodeTab[j] );
+                if ( value != NULL ) {
+                    xpc_domKeyAdd( index, value, node );
+                    xmlFree( value );
+                }
+            }
+        }
+        else {
+            value = xmlXPathCastToString( used );
+            if ( value != NULL ) {
+                xpc_domKeyAdd( index, value, node );
+                xmlFree( value );
+            }
+        }
+        xmlXPathFreeObject( used );
+    }
+
+done:
+    xmlXPathFreeObject( matched );
+    ctxt->node = oldnode;
+    ctxt->doc  = olddoc;
+    ctxt->contextSize       = oldsize;
+    ctxt->proximityPosition = oldpos;
+    return index;
+}
+
+/* key(name, value) as in XSLT: the nodes of the context node's document
+ * which have value, or any of the string values of a nodeset value, for
+ * the key name. lookup finds the index of a key. */
+void
+xpc_domKeyFunction( xmlXPathParserContextPtr ctxt, int nargs,
+                    xpc_KeyIndexFunc lookup )
+{
+    xmlXPathObjectPtr name, value, ret;
+    xmlHashTablePtr index = NULL;
+    xmlNodeSetPtr set;
+    xmlNodePtr root;
+    xmlChar * str;
+    int i;
+
+    CHECK_ARITY(2);
+    value = valuePop( ctxt );
+    xmlXPathStringFunction( ctxt, 1 );
+    if ( ctxt->value == NULL || ctxt->value->type != XPATH_STRING ) {
+        xmlXPathFreeObject( value );
+        XP_ERROR(XPATH_INVALID_TYPE);
+    }
+    name = valuePop( ctxt );
+
+    /* the document of the context node, the shadow document of a
+       fragment, or else the one "/" selects */
+    root = ctxt->context->node;
+    if ( root != NULL && root->type == XML_NAMESPACE_DECL )
+        root = NULL;
+    while ( root != NULL && root->parent != NULL )
+        root = root->parent;
+    if ( root == NULL || ( root->type != XML_DOCUMENT_NODE
+                           && root->type != XML_HTML_DOCUMENT_NODE ) )
+        root = (xmlNodePtr) ctxt->context->doc;
+    if ( root != NULL ) {
+        index = lookup( ctxt->context, name->stringval, (xmlDocPtr) root );
+        if ( index == NULL ) {
+            xmlXPathFreeObject( name );
+            xmlXPathFreeObject( value );
+            /* reported by lookup */
+            ctxt->error = XPATH_EXPR_ERROR;
+            return;
+        }
+    }
+
+    ret = xmlXPathNewNodeSet( NULL );
+    if ( index != NULL && ret != NULL ) {
+        if ( value->type == XPATH_NODESET ) {
+            for ( i = 0; value->nodesetval && i < value->nodesetval->nodeNr; i++ ) {
+                str = xmlXPathCastNodeToString( value->nodesetval->nodeTab[i] );
+                set = (xmlNodeSetPtr) xmlHashLookup( index, str );
+                if ( set != NULL )
+                    ret->nodesetval = xmlXPathNodeSetMerge( ret->nodesetval, set );
+                xmlFree( str );
+            }
+            if ( value->nodesetval && value->nodesetval->nodeNr > 1 )
+                xpc_domNodeSetSort( ret->nodesetval );
+        }
+        else {
+            str = xmlXPathCastToString( value );
+            set = (xmlNodeSetPtr) xmlHashLookup( index, str );
+            if ( set != NULL )
+                ret->nodesetval = xmlXPathNodeSetMerge( ret->nodesetval, set );
+            xmlFree( str );
+        }
+    }
+    xmlXPathFreeObject( name );
+    xmlXPathFreeObject( value );
+    valuePush( ctxt, ret );
+}
+
+static void
+xpc_domCollectNs( void * payload, void * data, const xmlChar * name )
+{
+    const xmlChar *** cur = (const xmlChar ***) data;
+
+    *(*cur)++ = (const xmlChar *) payload;
+    *(*cur)++ = name;
+}
+
+xmlPatternPtr
+xpc_domCompilePattern( xmlXPathContextPtr ctxt, const xmlChar * pattern )
+{
+    const xmlChar ** namespaces = NULL, ** cur;
+    xmlPatternPtr comp;
+    int count = ctxt->nsHash != NULL ? xmlHashSize( ctxt->nsHash ) : 0;
+
+    if ( count > 0 ) {
+        namespaces = (const xmlChar **)
+            xmlMalloc( (2 * count + 2) * sizeof(const xmlChar *) );
+        if ( namespaces == NULL )
+            return NULL;
+        cur = namespaces;
+        xmlHashScan( ctxt->nsHash, xpc_domCollectNs, &cur );
+        cur[0] = cur[1] = NULL;
+    }
+    comp = xmlPatterncompile( pattern, NULL, XML_PATTERN_XPATH, namespaces );
+    xmlFree( (void *) namespaces );
+    if ( comp != NULL && xmlPatternStreamable( comp ) != 1 ) {
+        xmlFreePattern( comp );
+        comp = NULL;
+    }
+    return comp;
+}
+
+int
+xpc_domStreamFind( xmlTextReaderPtr reader, xmlPatternPtr pattern,
+                   xpc_StreamMatchFunc match, void * data )
+{
+    xmlStreamCtxtPtr stream;
+    xmlNodePtr node;
+    int ret, found, empty, count = 0;
+
+    stream = xmlPatternGetStreamCtxt( pattern );
+    if ( stream == NULL )
+        return -1;
+    /* the document node */
+    if ( xmlStreamPush( stream, NULL, NULL ) < 0 ) {
+        xmlFreeStreamCtxt( stream );
+        return -1;
+    }
+
+    ret = xmlTextReaderRead( reader );
+    while ( ret == 1 ) {
+        switch ( xmlTextReaderNodeType( reader ) ) {
+            case XML_READER_TYPE_ELEMENT:
+                empty = xmlTextReaderIsEmptyElement( reader );
+                found = xmlStreamPush( stream,
+                                       xmlTextReaderConstLocalName( reader ),
+                                       xmlTextReaderConstNamespaceUri( reader ) );
+                if ( found < 0 ) {
+                    ret = -1;
+                    continue;
+                }
+                if ( found ) {
+                    node = xmlTextReaderExpand( reader );
+                    if ( node == NULL ) {
+                        ret = -1;
+                        continue;
+                    }
+                    count++;
+                    if ( match( node, data ) != 0 ) {
+                        ret = 0;
+                        continue;
+                    }
+                }
+                if ( empty )
+                    xmlStreamPop( stream );
+                break;
+            case XML_READER_TYPE_END_ELEMENT:
+                xmlStreamPop( stream );
+                break;
+            default:
+                break;
+        }
+        ret = xmlTextReaderRead( reader );
+    }
+
+    xmlFreeStreamCtxt( stream );
+    return ret < 0 ? -1 : count;
+}
+
+struct _xpc_PushStream {
+    xmlParserCtxtPtr parser;
+    xmlPatternPtr * patterns;
+    int npatterns;
+    xpc_PushMatchFunc match;
+    void * data;
+    startElementNsSAX2Func startElementNs;
+    endElementNsSAX2Func endElementNs;
+    char * matched;  /* per open element, whether a pattern matches it */
+    int depth;
+    int maxDepth;
+    int inside;      /* open elements a pattern matches */
+    int stopped;
+};
+
+static int
+xpc_domPushMatches( xpc_PushStream * stream, xmlNodePtr node )
+{
+    int i;
+
+    for ( i = 0; i < stream->npatterns; i++ ) {
+        if ( xmlPatternMatch( stream->patterns[i], node ) == 1 )
+            return 1;
+    }
+    return 0;
+}
+
+static void
+xpc_domPushStart( void * ctx, const xmlChar * localname,
+                  const xmlChar * prefix, const xmlChar * URI,
+                  int nb_namespaces, const xmlChar ** namespaces,
+                  int nb_attributes, int nb_defaulted,
+                  const xmlChar ** attributes )
+{
+    xmlParserCtxtPtr parser = (xmlParserCtxtPtr) ctx;
+    xpc_PushStream * stream = (xpc_PushStream *) parser->_private;
+    char * grown;
+    int max;
+
+    stream->startElementNs( ctx, localname, prefix, URI,
+                            nb_namespaces, namespaces,
+                            nb_attributes, nb_defaulted, attributes );
+    if ( parser->node == NULL )
+        return;
+    if ( stream->depth == stream->maxDepth ) {
+        max = stream->maxDepth > 0 ? 2 * stream->maxDepth : 32;
+        grown = (char *) xmlRealloc( stream->matched, max );
+        if ( grown == NULL ) {
+            xmlStopParser( parser );
+            return;
+        }
+        stream->matched  = grown;
+        stream->maxDepth = max;
+    }
+    stream->matched[stream->depth] = xpc_domPushMatches( stream, parser->node );
+    if ( stream->matched[stream->depth] )
+        stream->inside++;
+    stream->depth++;
+}
+
+static void
+xpc_domPushEnd( void * ctx, const xmlChar * localname,
+                const xmlChar * prefix, const xmlChar * URI )
+{
+    xmlParserCtxtPtr parser = (xmlParserCtxtPtr) ctx;
+    xpc_PushStream * stream = (xpc_PushStream * ) parser->_private;
+    xmlNodePtr node = parser->node, parent, prev;
+    int i;
+
+    if ( node != NULL && stream->depth > 0 ) {
+        stream->depth--;
+        if ( stream->matched[stream->depth] ) {
+            stream->inside--;
+            for ( i = 0; i < stream->npatterns && !stream->stopped; i++ ) {
+                if ( xmlPatternMatch( stream->patterns[i], node ) == 1
+                     && stream->match( node, i, stream->data ) != 0 ) {
+                    stream->stopped = 1;
+                    xmlStopParser( parser );
+                }
+            }
+        }
+    }
+    stream->endElementNs( ctx, localname, prefix, URI );
+
+    /* nothing still open needs what is closed, except for the root */
+    if ( node != NULL && stream->inside == 0 && node->parent != NULL
+         && node->parent->type == XML_ELEMENT_NODE ) {
+        parent = node->parent;
+        while ( parent->children != node ) {
+            prev = parent->children;
+            xmlUnlinkNode( prev );
+            xmlFreeNode( prev );
+        }
+        xmlUnlinkNode( node );
+        xmlFreeNode( node );
+    }
+}
+
+xpc_PushStream *
+xpc_domPushStreamNew( xmlPatternPtr * patterns, int npatterns,
+                      xpc_PushMatchFunc match, void * data, int options )
+{
+    xpc_PushStream * stream;
+
+    stream = (xpc_PushStream *) xmlMalloc( sizeof(xpc_PushStream) );
+    if ( stream == NULL )
+        return NULL;
+    memset( stream, 0, sizeof(xpc_PushStream) );
+    stream->parser = xmlCreatePushParserCtxt( NULL, NULL, NULL, 0, NULL );
+    if ( stream->parser == NULL ) {
+        xmlFree( stream );
+        return NULL;
+    }
+    xmlCtxtUseOptions( stream->parser, options );
+    stream->parser->_private = stream;
+    stream->startElementNs = stream->parser->sax->startElementNs;
+    stream->endElementNs   = stream->parser->sax->endElementNs;
+    stream->parser->sax->startElementNs = xpc_domPushStart;
+    stream->parser->sax->endElementNs   = xpc_domPushEnd;
+
+    stream->patterns  = patterns;
+    stream->npatterns = npatterns;
+    stream->match     = match;
+    stream->data      = data;
+    return stream;
+}
+
+int
+xpc_domPushStreamFeed( xpc_PushStream * stream, const char * chunk, int len,
+                       int terminate )
+{
+    int ret;
+
+    if ( stream->stopped )
+        return -1;
+    ret = xmlParseChunk( stream->parser, chunk, len, terminate );
+    if ( stream->stopped )
+        return -1;
+    return ret;
+}
+
+void
+xpc_domPushStreamFree( xpc_PushStream * stream )
+{
+    int i;
+
+    if ( stream == NULL )
+        return;
+    if ( stream->parser->myDoc != NULL )
+        xmlFreeDoc( stream->parser->myDoc );
+    xmlFreeParserCtxt( stream->parser );
+    for ( i = 0; i < stream->npatterns; i++ )
+        xmlFreePattern( stream->patterns[i] );
+    xmlFree( stream->patterns );
+    xmlFree( stream->matched );
+    xmlFree( stream );
+}
+
+/* whether node lies within the subtree given as data, for
+   xmlC14NExecute() */
+static int
+xpc_domInSubtree( void * data, xmlNodePtr node, xmlNodePtr parent )
+{
+    xmlNodePtr top = (xmlNodePtr) data;
+
+    if ( node != NULL && node->type == XML_NAMESPACE_DECL )
+        node = parent;
+    while ( node != NULL && node != top )
+        node = node->parent;
+    return node != NULL;
+}
+
+int
+xpc_domSerializeNodeSet( xmlNodeSetPtr set, xmlOutputBufferPtr out,
+                         const xmlChar * separator, int c14n,
+                         int comments, int format )
+{
+    xmlNodePtr node;
+    xmlNsPtr ns;
+    int i;
+
+    if ( set == NULL )
+        return 0;
+    for ( i = 0; i < set->nodeNr; i++ ) {
+        node = set->nodeTab[i];
+        if ( i > 0 && separator != NULL )
+            xmlOutputBufferWriteString( out, (const char *) separator );
+        if ( node->type == XML_NAMESPACE_DECL ) {
+            /* a namespace node, as libxml2 hands those out */
+            ns = (xmlNsPtr) node;
+            xmlOutputBufferWriteString( out, "xmlns" );
+            if ( ns->prefix != NULL ) {
+                xmlOutputBufferWriteString( out, ":" );
+                xmlOutputBufferWriteString( out, (const char *) ns->prefix );
+            }
+            xmlOutputBufferWriteString( out, "=\"" );
+            xmlOutputBufferWriteEscape( out, ns->href, NULL );
+            xmlOutputBufferWriteString( out, "\"" );
+        }
+        else if ( c14n && node->doc != NULL ) {
+            if ( xmlC14NExecute( node->doc, xpc_domInSubtree, node,
+                                 c14n == 2 ? XML_C14N_EXCLUSIVE_1_0
+                                           : XML_C14N_1_0,
+                                 NULL, comments, out ) < 0 )
+                return -1;
+        }
+        else {
+            xmlNodeDumpOutput( out, node->doc, node, 0, format, NULL );
+        }
+        if ( out->error != 0 )
+            return -1;
+    }
+    return set->nodeNr;
+}
+
+/* how c is written inside a value in format, NULL if as it is */
+static const char *
+xpc_domExportEscape( xmlChar c, int format, char * hex )
+{
+    if ( format == XPC_EXPORT_CSV )
+        return c == '"' ? "\"\"" : NULL;
+    switch ( c ) {
+        case '\t': return "\\t";
+        case '\n': return "\\n";
+        case '\r': return "\\r";
+        case '\\': return "\\\\";
+    }
+    if ( format == XPC_EXPORT_TSV )
+        return NULL;
+    switch ( c ) {
+        case '"':  return "\\\"";
+        case '\b': return "\\b";
+        case '\f': return "\\f";
+    }
+    if ( c < 0x20 ) {
+        snprintf( hex, 8, "\\u%04x", c );
+        return hex;
+    }
+    return NULL;
+}
+
+/* writes value quoted and escaped as format needs it, the runs of
+   characters in between straight from the string */
+static void
+xpc_domExportString( xmlOutputBufferPtr out, const xmlChar * value,
+                     int format )
+{
+    const xmlChar * run = value;
+    const xmlChar * cur;
+    const char * escape;
+    char hex[8];
+    int quote = format == XPC_EXPORT_NDJSON;
+
+    if ( format == XPC_EXPORT_CSV ) {
+        quote = value[strcspn( (const char *) value, ",\"\r\n" )] != 0;
+        if ( !quote ) {
+            xmlOutputBufferWriteString( out, (const char *) value );
+            return;
+        }
+    }
+    if ( quote )
+        xmlOutputBufferWrite( out, 1, "\"" );
+    for ( cur = value; *cur != 0; cur++ ) {
+        escape = xpc_domExportEscape( *cur, format, hex );
+        if ( escape != NULL ) {
+            if ( cur > run )
+                xmlOutputBufferWrite( out, cur - run, (const char *) run );
+            xmlOutputBufferWriteString( out, escape );
+            run = cur + 1;
+        }
+    }
+    if ( cur > run )
+        xmlOutputBufferWrite( out, cur - run, (const char *) run );
+    if ( quote )
+        xmlOutputBufferWrite( out, 1, "\"" );
+}
+
+static void
+xpc_domExportValue( xmlOutputBufferPtr out, xmlXPathObjectPtr value,
+                    int format )
+{
+    xmlChar * string;
+
+    if ( format == XPC_EXPORT_NDJSON ) {
+        switch ( value->type ) {
+            case XPATH_NODESET:
+                if ( value->nodesetval == NULL
+                     || value->nodesetval->nodeNr == 0 ) {
+                    xmlOutputBufferWriteString( out, "null" );
+                    return;
+                }
+                break;
+            case XPATH_BOOLEAN:
+                xmlOutputBufferWriteString( out, value->boolval ? "true"
+                                                                : "false" );
+                return;
+            case XPATH_NUMBER:
+                if ( xmlXPathIsNaN( value->floatval )
+                     || xmlXPathIsInf( value->floatval ) ) {
+                    xmlOutputBufferWriteString( out, "null" );
+                    return;
+                }
+                string = xmlXPathCastNumberToString( value->floatval );
+                if ( string != NULL )
+                    xmlOutputBufferWriteString( out, (const char *) string );
+                xmlFree( string );
+                return;
+            default:
+                break;
+        }
+    }
+    string = xmlXPathCastToString( value );
+    if ( string != NULL )
+        xpc_domExportString( out, string, format );
+    xmlFree( string );
+}
+
+void
+xpc_domExportHeader( xpc_Export * export )
+{
+    int i;
+
+    if ( export->format == XPC_EXPORT_NDJSON )
+        return;
+    for ( i = 0; i < export->ncolumns; i++ ) {
+        if ( i > 0 )
+            xmlOutputBufferWriteString( export->out,
+                export->format == XPC_EXPORT_TSV ? "\t" : "," );
+        xpc_domExportString( export->out, export->names[i], export->format );
+    }
+    xmlOutputBufferWrite( export->out, 1, "\n" );
+}
+
+int
+xpc_domExportRow( xmlNodePtr row, void * data )
+{
+    xpc_Export * export = (xpc_Export *) data;
+    xmlXPathContextPtr ctxt = export->ctxt;
+    xmlNodePtr oldnode = ctxt->node;
+    xmlDocPtr olddoc = ctxt->doc;
+    xmlXPathObjectPtr value;
+    int i, failed = 0;
+
+    ctxt->node = row;
+    ctxt->doc  = row->doc;
+    if ( export->format == XPC_EXPORT_NDJSON )
+        xmlOutputBufferWrite( export->out, 1, "{" );
+    for ( i = 0; i < export->ncolumns; i++ ) {
+        value = xpc_domXPathFindCompiled( ctxt, export->columns[i],
+                                          export->shadow );
+        if ( value == NULL ) {
+            failed = 1;
+            break;
+        }
+        if ( i > 0 )
+            xmlOutputBufferWriteString( export->out,
+                export->format == XPC_EXPORT_TSV ? "\t" : "," );
+        if ( export->format == XPC_EXPORT_NDJSON ) {
+            xpc_domExportString( export->out, export->names[i],
+                                 XPC_EXPORT_NDJSON );
+            xmlOutputBufferWrite( export->out, 1, ":" );
+        }
+        xpc_domExportValue( export->out, value, export->format );
+        xmlXPathFreeObject( value );
+    }
+    if ( export->format == XPC_EXPORT_NDJSON )
+        xmlOutputBufferWrite( export->out, 1, "}" );
+    xmlOutputBufferWrite( export->out, 1, "\n" );
+    ctxt->node = oldnode;
+    ctxt->doc  = olddoc;
+    return failed || export->out->error != 0;
+}
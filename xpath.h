@@ -3,14 +3,224 @@
 
 #include <libxml/tree.h>
 #include <libxml/xpath.h>
+#include <libxml/parser.h>
+#include <libxml/pattern.h>
+#include <libxml/xmlreader.h>
+
+#include "index.h"
+
+/* resolves a document() URI (already made absolute against the base
+ * URI) to a node; href is the string passed to document(). returns
+ * NULL if the document cannot be loaded. */
+typedef xmlNodePtr (*xpc_DocumentLoaderFunc)( xmlXPathContextPtr ctxt,
+                                              const xmlChar * URI,
+                                              const xmlChar * href );
+
+/* announces the distinct URIs of a nodeset argument before they are
+ * loaded one by one */
+typedef void (*xpc_DocumentPrefetchFunc)( xmlXPathContextPtr ctxt,
+                                          const xmlChar ** URIs,
+                                          const xmlChar ** hrefs,
+                                          int count );
+
+/* called with an element matched by xpc_domStreamFind(); returns
+ * non-zero to stop reading */
+typedef int (*xpc_StreamMatchFunc)( xmlNodePtr node, void * data );
+
+/* called by a push stream with an element a pattern matches, once
+ * it is complete, and the index of the pattern; returns non-zero to
+ * stop parsing */
+typedef int (*xpc_PushMatchFunc)( xmlNodePtr node, int pattern, void * data );
+
+typedef struct _xpc_PushStream xpc_PushStream;
+
+typedef struct _xpc_DocumentLoader {
+    xpc_DocumentLoaderFunc load;
+    xpc_DocumentPrefetchFunc prefetch;  /* may be NULL */
+} xpc_DocumentLoader;
+
+/* the index of the key name for doc, see xpc_domBuildKeyIndex();
+ * returns NULL if there is no such key or it cannot be built, after
+ * reporting why */
+typedef xmlHashTablePtr (*xpc_KeyIndexFunc)( xmlXPathContextPtr ctxt,
+                                             const xmlChar * name,
+                                             xmlDocPtr doc );
+
+/* whether //elem[@attr = 'literal'] is to be answered from an index of
+ * the values of attr, or with numbers set //elem[@attr > 1] from an
+ * index of its numbers, given the QNames as written in the expression */
+typedef int (*xpc_IndexHotFunc)( xmlXPathContextPtr ctxt,
+                                 const xmlChar * elem,
+                                 const xmlChar * attr,
+                                 int numbers );
+
+/* a loop over count items which may be spread over several threads,
+ * see xpc_domRunParallel() */
+typedef struct _xpc_ParallelJob xpc_ParallelJob;
+struct _xpc_ParallelJob {
+    int count;
+    void (*run)( xpc_ParallelJob * job, int index, void ** state );
+    void (*finish)( xpc_ParallelJob * job, void * state );  /* may be NULL */
+    void * data;
+};
+
+void
+xpc_domRunParallel( xpc_ParallelJob * job, int nthreads );
+
+int
+xpc_domHaveThreads( void );
+
+int
+xpc_domDefaultThreads( void );
 
 void
 xpc_perlDocumentFunction( xmlXPathParserContextPtr ctxt, int nargs );
 
+void
+xpc_domDocumentFunction( xmlXPathParserContextPtr ctxt, int nargs,
+                         const xpc_DocumentLoader * loader );
+
+xmlDocPtr
+xpc_domReadDocument( xmlParserCtxtPtr pctxt, const char * URI, int options );
+
+void
+xpc_domReadDocuments( const xmlChar ** URIs, xmlDocPtr * docs, int count,
+                      int options, xmlDictPtr dict, int nthreads );
+
+/* normalizes the text nodes of the tree node is in, the root element's
+ * for a document, as xpc_domNodeNormalize() does and numbers its
+ * elements in document order as xmlXPathOrderDocElems() does, in the
+ * same walk, which makes sorting nodesets much cheaper. if indexes is
+ * given, those of node's document are checked on the way, see
+ * xpc_domIndexCheck(). returns how many elements were numbered. the
+ * numbers are trusted by libxml2 for as long as they are there, so
+ * xpc_domNodeClearOrder() has to be called once the query is over. */
+int
+xpc_domNodeNormalizeOrder( xmlNodePtr node, xpc_DocIndex ** indexes );
+
+/* removes the numbers xpc_domNodeNormalizeOrder() gave the elements of
+ * the tree node is in */
+void
+xpc_domNodeClearOrder( xmlNodePtr node );
+
 xmlNodeSetPtr
-xpc_domXPathSelect( xmlXPathContextPtr ctxt, xmlChar * xpathstring );
+xpc_domXPathSelect( xmlXPathContextPtr ctxt, xmlChar * xpathstring,
+                    xmlDocPtr * shadow );
+
+xmlXPathObjectPtr
+xpc_domXPathFind( xmlXPathContextPtr ctxt, xmlChar * xpathstring,
+                  xmlDocPtr * shadow );
+
+/* unlinks the tree xpc_domXPathFindCompiled() linked to doc for a query
+ * from a fragment, freeing doc unless it is *shadow */
+void
+xpc_domXPathUnshadow( xmlDocPtr doc, xmlDocPtr * shadow );
 
 xmlXPathObjectPtr
-xpc_domXPathFind( xmlXPathContextPtr ctxt, xmlChar * xpathstring );
+xpc_domXPathFindCompiled( xmlXPathContextPtr ctxt, xmlXPathCompExprPtr comp,
+                          xmlDocPtr * shadow );
+
+/* the operations of comp as libxml2 dumps them, to be freed by the
+ * caller; NULL if libxml2 has no debugging support */
+xmlChar *
+xpc_domXPathDump( xmlXPathCompExprPtr comp );
+
+void
+xpc_domXPathEvalMany( xmlXPathContextPtr proto, const xmlChar * expr,
+                      xmlNodePtr * nodes, xmlXPathObjectPtr * results,
+                      int count, int nthreads );
+
+xmlXPathObjectPtr
+xpc_domXPathScanParallel( xmlXPathContextPtr ctxt, const xmlChar * path,
+                          int nthreads, int * handled );
+
+xmlXPathObjectPtr
+xpc_domXPathFindIndexed( xmlXPathContextPtr ctxt, const xmlChar * path,
+                         xpc_DocIndex ** indexes, int names,
+                         xpc_IndexHotFunc hot, int * handled );
+
+xmlHashTablePtr
+xpc_domBuildKeyIndex( xmlXPathContextPtr ctxt, xmlDocPtr doc,
+                      xmlXPathCompExprPtr match, xmlXPathCompExprPtr use );
+
+void
+xpc_domFreeKeyIndex( xmlHashTablePtr index );
+
+void
+xpc_domKeyFunction( xmlXPathParserContextPtr ctxt, int nargs,
+                    xpc_KeyIndexFunc lookup );
+
+/* compiles a streamable XPath pattern as xmlPatterncompile() does, with
+ * the namespace prefixes registered with ctxt. returns NULL if the
+ * pattern is invalid or cannot be streamed. */
+xmlPatternPtr
+xpc_domCompilePattern( xmlXPathContextPtr ctxt, const xmlChar * pattern );
+
+/* reads through reader calling match with every element pattern
+ * matches, expanded to its whole subtree, which the reader frees as it
+ * moves on; elements within a matching one are matched as well.
+ * returns the number of matches, or -1 if reading failed. match
+ * returning non-zero stops the reading. */
+int
+xpc_domStreamFind( xmlTextReaderPtr reader, xmlPatternPtr pattern,
+                   xpc_StreamMatchFunc match, void * data );
+
+/* a push parser, fed with xpc_domPushStreamFeed(), calling match with
+ * every element one of the patterns matches as soon as its end tag is
+ * parsed. the patterns, allocated with xmlMalloc(), belong to the
+ * stream. elements are freed once closed unless inside a matching one,
+ * so only the open elements and the matching subtrees are kept. */
+xpc_PushStream *
+xpc_domPushStreamNew( xmlPatternPtr * patterns, int npatterns,
+                      xpc_PushMatchFunc match, void * data, int options );
+
+/* parses the next chunk, the last one if terminate is set. returns 0,
+ * the parser's error code, or -1 if match asked to stop. */
+int
+xpc_domPushStreamFeed( xpc_PushStream * stream, const char * chunk, int len,
+                       int terminate );
+
+void
+xpc_domPushStreamFree( xpc_PushStream * stream );
+
+/* writes the nodes of set to out one after the other, separated by
+ * separator unless it is NULL: with xmlNodeDumpOutput(), or as
+ * canonical XML if c14n is 1, exclusive canonical XML if it is 2,
+ * with or without comments. returns the number of nodes written, or -1
+ * if writing failed. */
+int
+xpc_domSerializeNodeSet( xmlNodeSetPtr set, xmlOutputBufferPtr out,
+                         const xmlChar * separator, int c14n,
+                         int comments, int format );
+
+/* the formats of xpc_domExportRow() */
+#define XPC_EXPORT_CSV    0
+#define XPC_EXPORT_TSV    1
+#define XPC_EXPORT_NDJSON 2
+
+/* a table written row by row: every column is evaluated relative to
+ * the row node and written to out in format */
+typedef struct _xpc_Export {
+    xmlXPathContextPtr ctxt;
+    xmlXPathCompExprPtr * columns;
+    const xmlChar ** names;
+    int ncolumns;
+    int format;
+    xmlOutputBufferPtr out;
+    xmlDocPtr * shadow;  /* passed on to xpc_domXPathFindCompiled() */
+} xpc_Export;
+
+/* writes the line of column names of a CSV or TSV table */
+void
+xpc_domExportHeader( xpc_Export * export );
+
+/* evaluates the columns for row and writes the line of their values:
+ * CSV quoted as in RFC 4180, TSV with tab, newline, carriage return and
+ * backslash escaped by a backslash, or an NDJSON object keyed by the
+ * column names, with numbers and booleans as such and an empty nodeset
+ * as null. returns non-zero if a column cannot be evaluated or writing
+ * failed, so it can be given to xpc_domStreamFind() as it is. */
+int
+xpc_domExportRow( xmlNodePtr row, void * export );
 
 #endif